@@ -64,6 +64,31 @@ RTLSDR_API int rtlsdr_open(rtlsdr_dev_t **dev, uint32_t index);
 
 RTLSDR_API int rtlsdr_close(rtlsdr_dev_t *dev);
 
+enum rtlsdr_replay_flags {
+	RTLSDR_REPLAY_FAST = 0,		/* deliver samples as fast as possible */
+	RTLSDR_REPLAY_PACED = 1 << 0,	/* deliver samples at the sample rate */
+	RTLSDR_REPLAY_LOOP = 1 << 1	/* rewind at end of file */
+};
+
+/*!
+ * Open a recording of 8 bit unsigned IQ samples (as written by rtl_sdr)
+ * as a virtual device. All configuration functions succeed without
+ * touching any hardware, and rtlsdr_read_sync() / rtlsdr_read_async()
+ * return the recorded samples.
+ *
+ * Setting the environment variable RTLSDR_REPLAY_FILE makes the recording
+ * show up as an additional device after all USB devices, so unmodified
+ * applications can open it with rtlsdr_open(). RTLSDR_REPLAY_PACED=1 and
+ * RTLSDR_REPLAY_LOOP=1 select the corresponding flags in that case.
+ *
+ * \param dev the device handle
+ * \param filename path of the recording, "-" reads from stdin
+ * \param flags combination of enum rtlsdr_replay_flags
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_open_file(rtlsdr_dev_t **dev, const char *filename,
+				int flags);
+
 /* configuration functions */
 
 /*!
@@ -144,6 +169,48 @@ RTLSDR_API int rtlsdr_read_eeprom(rtlsdr_dev_t *dev, uint8_t *data,
 
 RTLSDR_API int rtlsdr_set_center_freq(rtlsdr_dev_t *dev, uint32_t freq);
 
+typedef struct rtlsdr_ctrl_stats {
+	uint32_t transactions;		/* committed so far */
+	uint64_t total_us;		/* time spent in all of them */
+	uint32_t last_transfers;	/* control transfers of the last one */
+	uint32_t last_round_trips;	/* times the last one waited for the device */
+	uint64_t last_us;		/* duration of the last one */
+} rtlsdr_ctrl_stats_t;
+
+/*!
+ * Start a control transaction. Until rtlsdr_ctrl_commit(), register
+ * writes are queued instead of waiting for the device one by one, and
+ * are then submitted back to back so the USB round trip is paid once.
+ * Reads whose result is needed flush the queue first, so the order of
+ * register accesses is kept. Transactions nest, only the outermost
+ * commit submits.
+ *
+ * rtlsdr_set_center_freq(), rtlsdr_set_sample_rate() and
+ * rtlsdr_set_tuner_gain() use a transaction internally.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_ctrl_begin(rtlsdr_dev_t *dev);
+
+/*!
+ * Submit the queued register writes and wait for their completion.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return 0 on success, the first libusb error of the transaction otherwise
+ */
+RTLSDR_API int rtlsdr_ctrl_commit(rtlsdr_dev_t *dev);
+
+/*!
+ * Get the timing of committed control transactions.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param stats receives the statistics
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_get_ctrl_stats(rtlsdr_dev_t *dev,
+				     rtlsdr_ctrl_stats_t *stats);
+
 /*!
  * Get actual frequency the device is tuned to.
  *
@@ -187,6 +254,30 @@ enum rtlsdr_tuner {
  */
 RTLSDR_API enum rtlsdr_tuner rtlsdr_get_tuner_type(rtlsdr_dev_t *dev);
 
+/*!
+ * Get the statistics of the tuner PLL parameter cache. Retuning to a
+ * frequency which has been used before skips the PLL calculation and
+ * the register read it depends on.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param hits receives the number of tunes served from the cache
+ * \param misses receives the number of tunes which had to be calculated
+ * \return 0 on success, -1 if the tuner has no such cache
+ */
+RTLSDR_API int rtlsdr_get_tuner_cache_stats(rtlsdr_dev_t *dev, uint32_t *hits,
+					    uint32_t *misses);
+
+/*!
+ * Get the tuner band a frequency falls in. Retuning between frequencies
+ * of the same band only reprograms the PLL, crossing bands also switches
+ * the tuner's input filters. Useful to order frequency hops.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param freq frequency in Hz
+ * \return -1 on error, the band otherwise, 0 for tuners without bands
+ */
+RTLSDR_API int rtlsdr_get_tuner_band(rtlsdr_dev_t *dev, uint32_t freq);
+
 /*!
  * Get a list of gains supported by the tuner.
  *
@@ -362,6 +453,46 @@ RTLSDR_API int rtlsdr_read_async(rtlsdr_dev_t *dev,
 				 uint32_t buf_num,
 				 uint32_t buf_len);
 
+enum rtlsdr_block_flags {
+	/* samples were lost between the previous block and this one */
+	RTLSDR_BLOCK_DISCONTINUITY = (1 << 0),
+	/* tuner settings changed since the previous block */
+	RTLSDR_BLOCK_RETUNED = (1 << 1)
+};
+
+typedef struct rtlsdr_block_info {
+	uint64_t sample_index;	/* first I/Q sample of the block */
+	uint64_t timestamp_us;	/* CLOCK_MONOTONIC arrival time */
+	uint32_t flags;		/* enum rtlsdr_block_flags */
+} rtlsdr_block_info_t;
+
+typedef void(*rtlsdr_read_async_ex_cb_t)(unsigned char *buf, uint32_t len,
+					 const rtlsdr_block_info_t *info,
+					 void *ctx);
+
+/*!
+ * Same as rtlsdr_read_async(), but every block comes with its position in
+ * the sample stream and its arrival time.
+ *
+ * The sample index counts I/Q pairs since the start of streaming. Blocks
+ * which were dropped still advance it, so the size of a gap is known.
+ * Failed USB transfers lose an unknown number of samples and only set
+ * RTLSDR_BLOCK_DISCONTINUITY on the next block.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param cb callback function to return received samples
+ * \param ctx user specific context to pass via the callback function
+ * \param buf_num optional buffer count, set to 0 for default buffer count (32)
+ * \param buf_len optional buffer length, must be multiple of 512,
+ *		  set to 0 for default buffer length (16 * 32 * 512)
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_read_async_ex(rtlsdr_dev_t *dev,
+				    rtlsdr_read_async_ex_cb_t cb,
+				    void *ctx,
+				    uint32_t buf_num,
+				    uint32_t buf_len);
+
 /*!
  * Cancel all pending asynchronous operations on the device.
  *
@@ -370,6 +501,100 @@ RTLSDR_API int rtlsdr_read_async(rtlsdr_dev_t *dev,
  */
 RTLSDR_API int rtlsdr_cancel_async(rtlsdr_dev_t *dev);
 
+/*!
+ * Start streaming into a ring of transfer buffers owned by the library.
+ * Unlike rtlsdr_read_async(), this function returns immediately: the
+ * library runs the USB event loop on its own thread and a (single)
+ * consumer thread borrows filled buffers with rtlsdr_stream_acquire().
+ * A buffer is handed back to the USB stack with rtlsdr_stream_release(),
+ * so nothing is copied and a slow consumer never blocks the event loop.
+ *
+ * If the consumer holds too many buffers, new data is dropped in favour
+ * of keeping transfers in flight, see rtlsdr_stream_get_overruns().
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param buf_num optional buffer count, set to 0 for default buffer count (32)
+ * \param buf_len optional buffer length, must be multiple of 512,
+ *		  set to 0 for default buffer length (16 * 32 * 512)
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_stream_start(rtlsdr_dev_t *dev, uint32_t buf_num,
+				   uint32_t buf_len);
+
+/*!
+ * Borrow the oldest filled buffer. Buffers must be released in the order
+ * they have been acquired, several may be held at the same time.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param buf receives a pointer to the samples
+ * \param len receives the number of valid bytes
+ * \param timeout_ms time to wait for data, 0 polls, negative waits forever
+ * \return 0 on success, -ETIMEDOUT if no data arrived in time
+ * \return -2 if not streaming or the stream has ended
+ */
+RTLSDR_API int rtlsdr_stream_acquire(rtlsdr_dev_t *dev, unsigned char **buf,
+				     uint32_t *len, int timeout_ms);
+
+/*!
+ * Same as rtlsdr_stream_acquire(), additionally returning the block
+ * metadata described at rtlsdr_read_async_ex(). Overruns are reported
+ * as RTLSDR_BLOCK_DISCONTINUITY on the next acquired block.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param buf receives a pointer to the samples
+ * \param len receives the number of valid bytes
+ * \param info receives the block metadata, may be NULL
+ * \param timeout_ms time to wait for data, 0 polls, negative waits forever
+ * \return 0 on success, -ETIMEDOUT if no data arrived in time
+ * \return -2 if not streaming or the stream has ended
+ */
+RTLSDR_API int rtlsdr_stream_acquire_ex(rtlsdr_dev_t *dev, unsigned char **buf,
+					uint32_t *len, rtlsdr_block_info_t *info,
+					int timeout_ms);
+
+/*!
+ * Tune to a new frequency and report the first sample taken after the
+ * tuner has settled. Settling is detected from the PLL lock indicator
+ * on tuners which have one, otherwise a fixed time is waited.
+ *
+ * While streaming, the index refers to rtlsdr_block_info_t.sample_index
+ * and earlier samples should be discarded by the caller. Otherwise the
+ * sample buffer is reset and the index is that of the next sample
+ * returned by rtlsdr_read_sync(), so nothing has to be discarded.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param freq frequency in Hz the device should be tuned to
+ * \param sample_index receives the first valid sample, may be NULL
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_set_center_freq_sync(rtlsdr_dev_t *dev, uint32_t freq,
+					   uint64_t *sample_index);
+
+/*!
+ * Return the oldest acquired buffer to the USB stack.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return 0 on success, -2 if no buffer is held
+ */
+RTLSDR_API int rtlsdr_stream_release(rtlsdr_dev_t *dev);
+
+/*!
+ * Stop streaming and wait for the event thread to finish. Buffers which
+ * are still held become invalid.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_stream_stop(rtlsdr_dev_t *dev);
+
+/*!
+ * Get the number of buffers dropped because the consumer fell behind.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return number of dropped buffers since rtlsdr_stream_start()
+ */
+RTLSDR_API uint32_t rtlsdr_stream_get_overruns(rtlsdr_dev_t *dev);
+
 #ifdef __cplusplus
 }
 #endif
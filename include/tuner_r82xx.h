@@ -41,6 +41,9 @@
 
 #define VER_NUM			49
 
+#define PLL_CACHE_BITS		12
+#define PLL_CACHE_SIZE		(1 << PLL_CACHE_BITS)
+
 enum r82xx_chip {
 	CHIP_R820T,
 	CHIP_R620D,
@@ -72,11 +75,26 @@ struct r82xx_config {
 	int use_predetect;
 };
 
+/* PLL register values computed for one LO frequency */
+struct r82xx_pll_entry {
+	uint32_t	freq;
+	uint32_t	xtal;
+	uint16_t	sdm;
+	uint8_t		div_num;
+	uint8_t		ni_si;
+	uint8_t		pw_sdm;
+	uint8_t		valid;
+};
+
 struct r82xx_priv {
 	struct r82xx_config		*cfg;
 
 	uint8_t				regs[NUM_REGS];
 	uint8_t				buf[NUM_REGS + 1];
+	/* write combining, regs[] differs from the chip where dirty */
+	int				regs_known;
+	int				batch;
+	uint32_t			dirty;
 	enum r82xx_xtal_cap_value	xtal_cap_sel;
 	uint16_t			pll;	/* kHz */
 	uint32_t			int_freq;
@@ -91,6 +109,12 @@ struct r82xx_priv {
 
 	uint32_t			bw;	/* in MHz */
 
+	/* tune path caches, the mux range is NULL when unknown */
+	const struct r82xx_freq_range	*mux_range;
+	struct r82xx_pll_entry		pll_cache[PLL_CACHE_SIZE];
+	uint32_t			pll_cache_hits;
+	uint32_t			pll_cache_misses;
+
 	void *rtl_dev;
 };
 
@@ -116,5 +140,8 @@ int r82xx_init(struct r82xx_priv *priv);
 int r82xx_set_freq(struct r82xx_priv *priv, uint32_t freq);
 int r82xx_set_gain(struct r82xx_priv *priv, int set_manual_gain, int gain);
 int r82xx_set_nomod(struct r82xx_priv *priv);
+int r82xx_get_band(struct r82xx_priv *priv, uint32_t freq);
+void r82xx_get_pll_cache_stats(struct r82xx_priv *priv, uint32_t *hits,
+			       uint32_t *misses);
 
 #endif
@@ -27,17 +27,22 @@ while(string != ''):
 
 f.close()
 
-#Open radio
-rtl_power_mod.find_and_open_dev()
+#Open radio, a session per dongle
+session = rtl_power_mod.session_new()
+if rtl_power_mod.session_open(session, 0) < 0:
+    sys.exit(1)
 
 #Set tuner table to settings
 
 for x in freq_data:
-    rtl_power_mod.initialize_tuner_values(freq_data.index(x))
-    rtl_power_mod.set_value(freq_data.index(x), 'f', x[0]*1000000)
-    rtl_power_mod.set_value(freq_data.index(x), 'r', x[1]*1000)
-    rtl_power_mod.set_value(freq_data.index(x), 'b', x[2])
-    rtl_power_mod.set_value(freq_data.index(x), 'g', x[3])
+    n = rtl_power_mod.session_add_tune(session)
+    rtl_power_mod.session_set_value(session, n, 'f', x[0]*1000000)
+    rtl_power_mod.session_set_value(session, n, 'r', x[1]*1000)
+    rtl_power_mod.session_set_value(session, n, 'b', x[2])
+    rtl_power_mod.session_set_value(session, n, 'g', x[3])
+
+#Order the hops to save retuning, rows keep their own settings
+rtl_power_mod.session_plan_hops(session)
 
 #Initialize variables for storage
 rms_pow_val = rtl_power_mod.new_doublep()
@@ -45,21 +50,22 @@ rms_pow_dc_val = rtl_power_mod.new_doublep()
 db_data = list()
 
 #Sweep radio, collect data
-for x in range(0,len(freq_data)):
+for n in range(0,len(freq_data)):
+    x = rtl_power_mod.session_get_hop(session, n)
     temp_list = list()
     data = rtl_power_mod.new_uint8_array(pow(2,int(freq_data[x][2])))
-    rtl_power_mod.set_tuner(x)
-    rtl_power_mod.read_data(x, data)
-    rtl_power_mod.rms_power(0, data, rms_pow_val, rms_pow_dc_val)
+    rtl_power_mod.session_set_tuner(session, x)
+    rtl_power_mod.session_read_data(session, x, data)
+    rtl_power_mod.session_rms_power(session, x, data, rms_pow_val, rms_pow_dc_val)
     rtl_power_mod.delete_uint8_array(data)
     temp_list.append(time.strftime("%d %b %Y %H:%M:%S", time.localtime()))
     temp_list.append(int(freq_data[x][0]))
     temp_list.append(int(freq_data[x][1]))
     temp_list.append(rtl_power_mod.doublep_value(rms_pow_val))
     db_data.append(temp_list)
-    #print rtl_power_mod.get_value('f')
-    #print rtl_power_mod.get_value('r')
-    #print rtl_power_mod.get_value('g')
+    #print rtl_power_mod.session_get_value(session, 'f')
+    #print rtl_power_mod.session_get_value(session, 'r')
+    #print rtl_power_mod.session_get_value(session, 'g')
 
 #print rtl_power_mod.uint8_array_getitem(data, 0)
 #print rtl_power_mod.doublep_value(rms_pow_val)
@@ -78,6 +84,6 @@ with con:
 
             
 #Close radio
-rtl_power_mod.close_dev()
+rtl_power_mod.session_free(session)
 
 
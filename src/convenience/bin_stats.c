@@ -0,0 +1,228 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* P-square after Jain and Chlamtac, CACM 28(10), 1985 */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bin_stats.h"
+
+#define M	BIN_STATS_MARKERS
+
+int bin_stats_init(struct bin_stats *s, int bins, const double *quantiles,
+		   int quantile_count)
+{
+	int k, m;
+	size_t per_quantile = 2 * M - 2;  /* heights and the inner positions */
+	double *p;
+	memset(s, 0, sizeof(struct bin_stats));
+	if (bins < 1 || quantile_count < 0 || quantile_count > BIN_STATS_MAX_QUANTILES) {
+		return -1;}
+	for (k=0; k<quantile_count; k++) {
+		if (!(quantiles[k] >= 0.0 && quantiles[k] <= 1.0)) {
+			return -1;}
+	}
+	s->block = malloc((4 + M + quantile_count * per_quantile) * bins * sizeof(double));
+	if (!s->block) {
+		return -1;}
+	s->bins = bins;
+	s->quantile_count = quantile_count;
+	p = s->block;
+	s->min = p;   p += bins;
+	s->max = p;   p += bins;
+	s->mean = p;  p += bins;
+	s->m2 = p;    p += bins;
+	s->first = p; p += M * bins;
+	for (k=0; k<quantile_count; k++) {
+		s->quant[k].p = quantiles[k];
+		for (m=0; m<M; m++) {
+			s->quant[k].height[m] = p;
+			p += bins;
+		}
+		for (m=1; m<M-1; m++) {
+			s->quant[k].pos[m] = p;
+			p += bins;
+		}
+	}
+	bin_stats_reset(s);
+	return 0;
+}
+
+void bin_stats_reset(struct bin_stats *s)
+{
+	struct bin_quantile *q;
+	int k;
+	s->count = 0;
+	for (k=0; k<s->quantile_count; k++) {
+		q = &s->quant[k];
+		q->want[0] = 1.0;
+		q->want[1] = 1.0 + 2.0 * q->p;
+		q->want[2] = 1.0 + 4.0 * q->p;
+		q->want[3] = 3.0 + 2.0 * q->p;
+		q->want[4] = 5.0;
+		q->step[0] = 0.0;
+		q->step[1] = q->p / 2.0;
+		q->step[2] = q->p;
+		q->step[3] = (1.0 + q->p) / 2.0;
+		q->step[4] = 1.0;
+	}
+}
+
+void bin_stats_free(struct bin_stats *s)
+{
+	free(s->block);
+	s->block = NULL;
+}
+
+static void sort_small(double *v, int n)
+{
+	int i, j;
+	double t;
+	for (i=1; i<n; i++) {
+		t = v[i];
+		for (j=i; j>0 && v[j-1] > t; j--) {
+			v[j] = v[j-1];}
+		v[j] = t;
+	}
+}
+
+static void markers_start(struct bin_stats *s)
+/* the first five frames, sorted, are the first markers */
+{
+	int j, k, m;
+	double v[M];
+	for (j=0; j<s->bins; j++) {
+		for (m=0; m<M; m++) {
+			v[m] = s->first[m * s->bins + j];}
+		sort_small(v, M);
+		for (k=0; k<s->quantile_count; k++) {
+			for (m=0; m<M; m++) {
+				s->quant[k].height[m][j] = v[m];}
+			for (m=1; m<M-1; m++) {
+				s->quant[k].pos[m][j] = (double)(m + 1);}
+		}
+	}
+}
+
+static void quantile_push(struct bin_quantile *q, const double *x, int bins, double count)
+/* count is the position of the last marker after this frame */
+{
+	int j, m, cell;
+	double *h0 = q->height[0], *h1 = q->height[1], *h2 = q->height[2];
+	double *h3 = q->height[3], *h4 = q->height[4];
+	double n[M], h[M], d, hp;
+	for (m=0; m<M; m++) {
+		q->want[m] += q->step[m];}
+	for (j=0; j<bins; j++) {
+		h[0] = h0[j]; h[1] = h1[j]; h[2] = h2[j]; h[3] = h3[j]; h[4] = h4[j];
+		n[0] = 1.0;
+		n[1] = q->pos[1][j];
+		n[2] = q->pos[2][j];
+		n[3] = q->pos[3][j];
+		n[4] = count;
+		/* the cell of x, stretching the ends */
+		if (x[j] < h[0]) {
+			h[0] = x[j];
+			cell = 0;
+		} else if (x[j] >= h[4]) {
+			h[4] = x[j];
+			cell = 3;
+		} else {
+			cell = (x[j] >= h[1]) + (x[j] >= h[2]) + (x[j] >= h[3]);}
+		for (m=cell+1; m<M-1; m++) {
+			n[m] += 1.0;}
+		/* nudge the inner markers toward where they belong */
+		for (m=1; m<M-1; m++) {
+			d = q->want[m] - n[m];
+			if ((d >= 1.0 && n[m+1] - n[m] > 1.0) || (d <= -1.0 && n[m-1] - n[m] < -1.0)) {
+				d = d > 0.0 ? 1.0 : -1.0;
+				hp = h[m] + d / (n[m+1] - n[m-1]) *
+					((n[m] - n[m-1] + d) * (h[m+1] - h[m]) / (n[m+1] - n[m]) +
+					 (n[m+1] - n[m] - d) * (h[m] - h[m-1]) / (n[m] - n[m-1]));
+				if (!(h[m-1] < hp && hp < h[m+1])) {
+					/* parabola overshot, go linear */
+					hp = h[m] + d * (h[m + (int)d] - h[m]) / (n[m + (int)d] - n[m]);}
+				h[m] = hp;
+				n[m] += d;
+			}
+		}
+		h0[j] = h[0]; h1[j] = h[1]; h2[j] = h[2]; h3[j] = h[3]; h4[j] = h[4];
+		q->pos[1][j] = n[1];
+		q->pos[2][j] = n[2];
+		q->pos[3][j] = n[3];
+	}
+}
+
+void bin_stats_push(struct bin_stats *s, const double *x, int frames)
+{
+	int f, j, k, bins = s->bins;
+	double *mn = s->min, *mx = s->max, *mean = s->mean, *m2 = s->m2;
+	double delta, inv;
+	for (f=0; f<frames; f++, x+=bins) {
+		s->count++;
+		if (s->count == 1) {
+			memcpy(mn, x, bins * sizeof(double));
+			memcpy(mx, x, bins * sizeof(double));
+			memcpy(mean, x, bins * sizeof(double));
+			memset(m2, 0, bins * sizeof(double));
+		} else {
+			inv = 1.0 / (double)s->count;
+			for (j=0; j<bins; j++) {
+				mn[j] = x[j] < mn[j] ? x[j] : mn[j];
+				mx[j] = x[j] > mx[j] ? x[j] : mx[j];
+			}
+			for (j=0; j<bins; j++) {
+				delta = x[j] - mean[j];
+				mean[j] += delta * inv;
+				m2[j] += delta * (x[j] - mean[j]);
+			}
+		}
+		if (!s->quantile_count) {
+			continue;}
+		if (s->count <= M) {
+			memcpy(s->first + (s->count - 1) * bins, x, bins * sizeof(double));
+			if (s->count == M) {
+				markers_start(s);}
+			continue;
+		}
+		for (k=0; k<s->quantile_count; k++) {
+			quantile_push(&s->quant[k], x, bins, (double)s->count);}
+	}
+}
+
+double bin_stats_variance(const struct bin_stats *s, int j)
+{
+	if (s->count < 2) {
+		return 0.0;}
+	return s->m2[j] / (double)(s->count - 1);
+}
+
+double bin_stats_quantile(const struct bin_stats *s, int k, int j)
+{
+	double v[M];
+	int m, n = (int)s->count;
+	if (n < 1) {
+		return 0.0;}
+	if (n > M) {
+		return s->quant[k].height[2][j];}
+	/* the markers only start moving with the next frame,
+	 * until then the nearest rank of what there is */
+	for (m=0; m<n; m++) {
+		v[m] = s->first[m * s->bins + j];}
+	sort_small(v, n);
+	m = (int)(s->quant[k].p * (double)(n - 1) + 0.5);
+	return v[m];
+}
@@ -0,0 +1,99 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* one pass statistics of many bins, fed a frame at a time
+ *
+ * Min, max, mean and variance are exact (Welford).  Percentiles use the
+ * P-square estimator, five markers per bin and percentile, so memory
+ * does not grow with the frame count.  Every statistic is an array over
+ * the bins and every bin sees the same frames, the loops run along the
+ * bins and vectorize.
+ * */
+
+#define BIN_STATS_MAX_QUANTILES	8
+#define BIN_STATS_MARKERS	5
+
+struct bin_quantile
+{
+	double p;  /* 0 to 1 */
+	double *height[BIN_STATS_MARKERS];
+	double *pos[BIN_STATS_MARKERS];  /* only 1 to 3, the ends are fixed */
+	double want[BIN_STATS_MARKERS];  /* desired positions, the same for all bins */
+	double step[BIN_STATS_MARKERS];
+};
+
+struct bin_stats
+{
+	int bins;
+	int quantile_count;
+	long count;  /* frames pushed */
+	double *min;
+	double *max;
+	double *mean;
+	double *m2;  /* sum of squared deviations */
+	double *first;  /* the first BIN_STATS_MARKERS frames */
+	struct bin_quantile quant[BIN_STATS_MAX_QUANTILES];
+	double *block;
+};
+
+/*!
+ * Set up an accumulator
+ *
+ * \param s accumulator to fill in
+ * \param bins values per frame
+ * \param quantiles percentiles to track, each from 0 to 1
+ * \param quantile_count 0 to BIN_STATS_MAX_QUANTILES
+ * \return 0 on success, -1 on bad arguments or allocation failure
+ */
+
+int bin_stats_init(struct bin_stats *s, int bins, const double *quantiles,
+		   int quantile_count);
+
+/*!
+ * Forget every frame, the quantiles stay
+ */
+
+void bin_stats_reset(struct bin_stats *s);
+
+void bin_stats_free(struct bin_stats *s);
+
+/*!
+ * Add frames
+ *
+ * \param s accumulator
+ * \param x frames one after the other, bins values each
+ * \param frames number of frames
+ */
+
+void bin_stats_push(struct bin_stats *s, const double *x, int frames);
+
+/*!
+ * \return unbiased variance of bin j, 0 before the second frame
+ */
+
+double bin_stats_variance(const struct bin_stats *s, int j);
+
+/*!
+ * Estimate of a tracked percentile
+ *
+ * Exact for up to BIN_STATS_MARKERS frames.
+ *
+ * \param s accumulator
+ * \param k index into the quantiles given to bin_stats_init()
+ * \param j bin
+ * \return the estimate, 0 before the first frame
+ */
+
+double bin_stats_quantile(const struct bin_stats *s, int k, int j);
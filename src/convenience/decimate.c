@@ -0,0 +1,485 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Only every factor-th output is computed, which is what a polyphase
+ * bank does without splitting the taps into phases.  Each output is one
+ * dot product of the reversed taps with the newest window.  Taps are
+ * stored so that one vector lane always holds I and the next Q, and
+ * padded with zeros to whole vectors; the work buffers are padded too
+ * and only ever hold finite values, so the overhang multiplies by zero.
+ * */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define _USE_MATH_DEFINES
+#endif
+
+#include <math.h>
+
+#include "decimate.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DECIM_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(DECIM_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DECIM_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DECIM_NEON
+#include <arm_neon.h>
+#endif
+
+#define DECIM_BLOCK	4096  /* complex samples copied in per pass */
+#define DECIM_PAD	16  /* taps per whole vector, for every kernel */
+
+struct decim_kernels
+{
+	/* x and c are 2*padded long, out gets one complex sample */
+	void (*dot)(const float *x, const float *c, int padded, float *out);
+	void (*dot16)(const int16_t *x, const struct decim_fir *f, int32_t *out);
+};
+
+static int simd_enabled = 1;
+
+static void dot_scalar(const float *x, const float *c, int padded, float *out)
+{
+	int j;
+	float re = 0.0f, im = 0.0f;
+	for (j=0; j<2*padded; j+=2) {
+		re += x[j]   * c[j];
+		im += x[j+1] * c[j+1];
+	}
+	out[0] = re;
+	out[1] = im;
+}
+
+static void dot16_scalar(const int16_t *x, const struct decim_fir *f, int32_t *out)
+{
+	int j;
+	int32_t re = 0, im = 0;
+	for (j=0; j<f->taps; j++) {
+		re += (int32_t)x[2*j]   * f->coef16[j];
+		im += (int32_t)x[2*j+1] * f->coef16[j];
+	}
+	out[0] = re;
+	out[1] = im;
+}
+
+#ifdef DECIM_SSE2
+static void dot_sse2(const float *x, const float *c, int padded, float *out)
+{
+	int j;
+	float s[4];
+	__m128 acc = _mm_setzero_ps();
+	for (j=0; j<2*padded; j+=4) {
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x+j), _mm_loadu_ps(c+j)));}
+	_mm_storeu_ps(s, acc);
+	out[0] = s[0] + s[2];
+	out[1] = s[1] + s[3];
+}
+
+static void dot16_sse2(const int16_t *x, const struct decim_fir *f, int32_t *out)
+{
+	int j;
+	int32_t s[4], t[4];
+	__m128i v, ai = _mm_setzero_si128(), aq = _mm_setzero_si128();
+	for (j=0; j<2*f->padded; j+=8) {
+		v = _mm_loadu_si128((const __m128i*)(x+j));
+		ai = _mm_add_epi32(ai, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i*)(f->coef16_i+j))));
+		aq = _mm_add_epi32(aq, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i*)(f->coef16_q+j))));
+	}
+	_mm_storeu_si128((__m128i*)s, ai);
+	_mm_storeu_si128((__m128i*)t, aq);
+	out[0] = s[0] + s[1] + s[2] + s[3];
+	out[1] = t[0] + t[1] + t[2] + t[3];
+}
+#endif
+
+#ifdef DECIM_AVX2
+static __attribute__((target("avx2,fma"))) void dot_avx2(const float *x, const float *c, int padded, float *out)
+{
+	int j;
+	float s[8];
+	__m256 acc = _mm256_setzero_ps();
+	for (j=0; j<2*padded; j+=8) {
+		acc = _mm256_fmadd_ps(_mm256_loadu_ps(x+j), _mm256_loadu_ps(c+j), acc);}
+	_mm256_storeu_ps(s, acc);
+	out[0] = (s[0] + s[2]) + (s[4] + s[6]);
+	out[1] = (s[1] + s[3]) + (s[5] + s[7]);
+}
+
+static __attribute__((target("avx2"))) void dot16_avx2(const int16_t *x, const struct decim_fir *f, int32_t *out)
+{
+	int j;
+	int32_t s[8], t[8];
+	__m256i v, ai = _mm256_setzero_si256(), aq = _mm256_setzero_si256();
+	for (j=0; j<2*f->padded; j+=16) {
+		v = _mm256_loadu_si256((const __m256i*)(x+j));
+		ai = _mm256_add_epi32(ai, _mm256_madd_epi16(v, _mm256_loadu_si256((const __m256i*)(f->coef16_i+j))));
+		aq = _mm256_add_epi32(aq, _mm256_madd_epi16(v, _mm256_loadu_si256((const __m256i*)(f->coef16_q+j))));
+	}
+	_mm256_storeu_si256((__m256i*)s, ai);
+	_mm256_storeu_si256((__m256i*)t, aq);
+	out[0] = s[0] + s[1] + s[2] + s[3] + s[4] + s[5] + s[6] + s[7];
+	out[1] = t[0] + t[1] + t[2] + t[3] + t[4] + t[5] + t[6] + t[7];
+}
+#endif
+
+#ifdef DECIM_NEON
+static void dot_neon(const float *x, const float *c, int padded, float *out)
+{
+	int j;
+	float s[4];
+	float32x4_t acc = vdupq_n_f32(0.0f);
+	for (j=0; j<2*padded; j+=4) {
+		acc = vmlaq_f32(acc, vld1q_f32(x+j), vld1q_f32(c+j));}
+	vst1q_f32(s, acc);
+	out[0] = s[0] + s[2];
+	out[1] = s[1] + s[3];
+}
+
+static void dot16_neon(const int16_t *x, const struct decim_fir *f, int32_t *out)
+{
+	int j;
+	int16x8x2_t v;
+	int16x8_t c;
+	int32x4_t ai = vdupq_n_s32(0), aq = vdupq_n_s32(0);
+	int32_t s[4], t[4];
+	for (j=0; j<f->padded; j+=8) {
+		v = vld2q_s16(x + 2*j);
+		c = vld1q_s16(f->coef16 + j);
+		ai = vmlal_s16(ai, vget_low_s16(v.val[0]),  vget_low_s16(c));
+		ai = vmlal_s16(ai, vget_high_s16(v.val[0]), vget_high_s16(c));
+		aq = vmlal_s16(aq, vget_low_s16(v.val[1]),  vget_low_s16(c));
+		aq = vmlal_s16(aq, vget_high_s16(v.val[1]), vget_high_s16(c));
+	}
+	vst1q_s32(s, ai);
+	vst1q_s32(t, aq);
+	out[0] = s[0] + s[1] + s[2] + s[3];
+	out[1] = t[0] + t[1] + t[2] + t[3];
+}
+#endif
+
+static const struct decim_kernels kernels_scalar = {dot_scalar, dot16_scalar};
+#ifdef DECIM_SSE2
+static const struct decim_kernels kernels_sse2 = {dot_sse2, dot16_sse2};
+#endif
+#ifdef DECIM_AVX2
+static const struct decim_kernels kernels_avx2 = {dot_avx2, dot16_avx2};
+#endif
+#ifdef DECIM_NEON
+static const struct decim_kernels kernels_neon = {dot_neon, dot16_neon};
+#endif
+
+static const struct decim_kernels *pick_kernels(void)
+{
+	if (!simd_enabled) {
+		return &kernels_scalar;}
+#ifdef DECIM_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return &kernels_avx2;}
+#endif
+#if defined(DECIM_SSE2)
+	return &kernels_sse2;
+#elif defined(DECIM_NEON)
+	return &kernels_neon;
+#else
+	return &kernels_scalar;
+#endif
+}
+
+void decim_set_simd(int enable)
+{
+	simd_enabled = enable;
+}
+
+int decim_fir_init(struct decim_fir *f, const double *h, int taps, int factor)
+{
+	int j, len;
+	double peak = 0.0;
+	memset(f, 0, sizeof(struct decim_fir));
+	if (taps < 1 || taps > DECIM_MAX_TAPS || factor < 1) {
+		return -1;}
+	f->taps = taps;
+	f->factor = factor;
+	f->padded = (taps + DECIM_PAD - 1) / DECIM_PAD * DECIM_PAD;
+	f->k = pick_kernels();
+	/* history plus a block, plus the overhang of the last window */
+	len = 2 * (f->padded + DECIM_BLOCK);
+	f->coef = calloc(2 * f->padded, sizeof(float));
+	f->coef16 = calloc(2 * f->padded, sizeof(int16_t));
+	f->coef16_i = calloc(2 * f->padded, sizeof(int16_t));
+	f->coef16_q = calloc(2 * f->padded, sizeof(int16_t));
+	f->work = calloc(len, sizeof(float));
+	f->work16 = calloc(len, sizeof(int16_t));
+	if (!f->coef || !f->coef16 || !f->coef16_i || !f->coef16_q || !f->work || !f->work16) {
+		decim_fir_free(f);
+		return -1;
+	}
+	for (j=0; j<taps; j++) {
+		peak = fabs(h[j]) > peak ? fabs(h[j]) : peak;}
+	/* as many fraction bits as the largest tap leaves room for */
+	f->shift16 = 15;
+	while (f->shift16 > 0 && peak * (double)(1 << f->shift16) > 32767.0) {
+		f->shift16--;}
+	for (j=0; j<taps; j++) {
+		f->coef[2*j]   = (float)h[taps-1-j];
+		f->coef[2*j+1] = (float)h[taps-1-j];
+		f->coef16[j] = (int16_t)lrint(h[taps-1-j] * (double)(1 << f->shift16));
+		f->coef16_i[2*j]   = f->coef16[j];
+		f->coef16_q[2*j+1] = f->coef16[j];
+	}
+	return 0;
+}
+
+void decim_fir_reset(struct decim_fir *f)
+{
+	f->skip = 0;
+	f->fill = 0;
+}
+
+void decim_fir_free(struct decim_fir *f)
+{
+	free(f->coef);
+	free(f->coef16);
+	free(f->coef16_i);
+	free(f->coef16_q);
+	free(f->work);
+	free(f->work16);
+	memset(f, 0, sizeof(struct decim_fir));
+}
+
+static int next_window(struct decim_fir *f, int i)
+/* drop what the window starting at i no longer needs
+ * returns the samples to keep */
+{
+	if (i > f->fill) {
+		f->skip = i - f->fill;
+		return 0;
+	}
+	f->skip = 0;
+	return f->fill - i;
+}
+
+int decim_fir_float(struct decim_fir *f, const float *in, int n, float *out)
+{
+	int i, m, keep, done = 0, outs = 0;
+	while (done < n) {
+		m = n - done < DECIM_BLOCK ? n - done : DECIM_BLOCK;
+		memcpy(f->work + 2*f->fill, in + 2*done, 2 * m * sizeof(float));
+		f->fill += m;
+		done += m;
+		/* never overtakes the copy, so out may be in */
+		for (i=f->skip; i+f->taps<=f->fill; i+=f->factor) {
+			f->k->dot(f->work + 2*i, f->coef, f->padded, out + 2*outs);
+			outs++;
+		}
+		keep = next_window(f, i);
+		memmove(f->work, f->work + 2*(f->fill - keep), 2 * keep * sizeof(float));
+		f->fill = keep;
+	}
+	return outs;
+}
+
+static int16_t saturate16(int32_t v)
+{
+	if (v > INT16_MAX) {
+		return INT16_MAX;}
+	if (v < INT16_MIN) {
+		return INT16_MIN;}
+	return (int16_t)v;
+}
+
+int decim_fir_int16(struct decim_fir *f, const int16_t *in, int n, int16_t *out)
+{
+	int i, m, keep, done = 0, outs = 0;
+	int32_t acc[2];
+	while (done < n) {
+		m = n - done < DECIM_BLOCK ? n - done : DECIM_BLOCK;
+		memcpy(f->work16 + 2*f->fill, in + 2*done, 2 * m * sizeof(int16_t));
+		f->fill += m;
+		done += m;
+		for (i=f->skip; i+f->taps<=f->fill; i+=f->factor) {
+			f->k->dot16(f->work16 + 2*i, f, acc);
+			out[2*outs]   = saturate16(acc[0] >> f->shift16);
+			out[2*outs+1] = saturate16(acc[1] >> f->shift16);
+			outs++;
+		}
+		keep = next_window(f, i);
+		memmove(f->work16, f->work16 + 2*(f->fill - keep), 2 * keep * sizeof(int16_t));
+		f->fill = keep;
+	}
+	return outs;
+}
+
+static double blackman(int i, int taps)
+{
+	double t;
+	if (taps < 2) {
+		return 1.0;}
+	t = (double)i / (double)(taps - 1);
+	return 0.42 - 0.5*cos(2*M_PI*t) + 0.08*cos(4*M_PI*t);
+}
+
+static void normalize(double *h, int taps)
+{
+	int i;
+	double sum = 0.0;
+	for (i=0; i<taps; i++) {
+		sum += h[i];}
+	for (i=0; i<taps; i++) {
+		h[i] /= sum;}
+}
+
+void decim_design_lowpass(double *h, int taps, double cutoff)
+{
+	int i;
+	double x;
+	for (i=0; i<taps; i++) {
+		x = (double)i - (double)(taps - 1) / 2.0;
+		h[i] = x == 0.0 ? 2.0 * cutoff : sin(2*M_PI*cutoff*x) / (M_PI*x);
+		h[i] *= blackman(i, taps);
+	}
+	normalize(h, taps);
+}
+
+int decim_design_halfband(double *h, int taps)
+{
+	int i;
+	taps = 4 * (taps / 4) + 3;
+	decim_design_lowpass(h, taps, 0.25);
+	/* exact zeros, the sinc only gets them to rounding */
+	for (i=0; i<taps; i++) {
+		if (i != (taps - 1) / 2 && (i - (taps - 1) / 2) % 2 == 0) {
+			h[i] = 0.0;}
+	}
+	normalize(h, taps);
+	return taps;
+}
+
+int decim_design_cic(double *h, int order, int ratio)
+{
+	int i, j, k, len = 1;
+	double s;
+	h[0] = 1.0;
+	/* convolve order boxcars of length ratio */
+	for (k=0; k<order; k++) {
+		for (i=len+ratio-2; i>=0; i--) {
+			s = 0.0;
+			for (j=0; j<ratio; j++) {
+				if (i-j >= 0 && i-j < len) {
+					s += h[i-j];}
+			}
+			h[i] = s;
+		}
+		len += ratio - 1;
+	}
+	normalize(h, len);
+	return len;
+}
+
+double decim_response(const double *h, int taps, double f)
+{
+	int i;
+	double re = 0.0, im = 0.0;
+	for (i=0; i<taps; i++) {
+		re += h[i] * cos(2*M_PI*f*i);
+		im -= h[i] * sin(2*M_PI*f*i);
+	}
+	return sqrt(re*re + im*im);
+}
+
+#define COMP_GRID	256
+#define COMP_MAX_HALF	64
+
+int decim_design_comp(double *h, int taps, const double *stage, int stage_taps,
+		      int passes, double passband)
+/* symmetric taps, so fit a cosine series: h[m +- k] = a[k]/2
+ * above the passband is left free, the cascade already falls there */
+{
+	int i, j, k, g, m, n;
+	double f, want, g0, p;
+	double ata[COMP_MAX_HALF+1][COMP_MAX_HALF+2];
+	double basis[COMP_MAX_HALF+1];
+	double a[COMP_MAX_HALF+1];
+	if (taps < 1 || !(taps & 1) || passes < 0 || passband <= 0.0 || passband >= 0.5) {
+		return -1;}
+	m = (taps - 1) / 2;
+	if (m > COMP_MAX_HALF) {
+		return -1;}
+	n = m + 1;
+	memset(ata, 0, sizeof(ata));
+	g0 = 1.0;
+	for (k=1; k<=passes; k++) {
+		g0 *= decim_response(stage, stage_taps, 0.0);}
+	for (g=0; g<=COMP_GRID; g++) {
+		f = 0.5 * (double)g / (double)COMP_GRID;
+		if (f > passband) {
+			break;}
+		/* stage k from the end runs 2^k times faster */
+		p = 1.0;
+		for (k=1; k<=passes; k++) {
+			p *= decim_response(stage, stage_taps, f / (double)(1 << k));}
+		want = p > 1e-6 ? g0 / p : 0.0;
+		for (k=0; k<n; k++) {
+			basis[k] = k == 0 ? 1.0 : cos(2*M_PI*f*k);}
+		for (i=0; i<n; i++) {
+			for (j=0; j<n; j++) {
+				ata[i][j] += basis[i] * basis[j];}
+			ata[i][n] += basis[i] * want;
+		}
+	}
+	/* gaussian elimination with partial pivoting */
+	for (i=0; i<n; i++) {
+		k = i;
+		for (j=i+1; j<n; j++) {
+			if (fabs(ata[j][i]) > fabs(ata[k][i])) {
+				k = j;}
+		}
+		for (j=0; j<=n; j++) {
+			p = ata[i][j];
+			ata[i][j] = ata[k][j];
+			ata[k][j] = p;
+		}
+		if (fabs(ata[i][i]) < 1e-12) {
+			return -1;}
+		for (j=i+1; j<n; j++) {
+			p = ata[j][i] / ata[i][i];
+			for (k=i; k<=n; k++) {
+				ata[j][k] -= p * ata[i][k];}
+		}
+	}
+	for (i=n-1; i>=0; i--) {
+		p = ata[i][n];
+		for (j=i+1; j<n; j++) {
+			p -= ata[i][j] * a[j];}
+		a[i] = p / ata[i][i];
+	}
+	h[m] = a[0];
+	for (k=1; k<=m; k++) {
+		h[m-k] = a[k] / 2.0;
+		h[m+k] = a[k] / 2.0;
+	}
+	normalize(h, taps);
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* polyphase FIR decimation of interleaved complex streams
+ *
+ * A filter keeps its history between calls, so a stream cut into
+ * buffers comes out as if it were one long buffer.  A fresh or reset
+ * filter emits nothing until its first window is full, there is no
+ * ramp up from zeros to cut away.
+ * */
+
+#include <stdint.h>
+
+#define DECIM_MAX_TAPS	1024
+
+struct decim_kernels;
+
+struct decim_fir
+{
+	int taps;
+	int factor;
+	int padded;  /* taps rounded up to whole vectors */
+	int skip;  /* samples to drop before the next window starts */
+	int fill;  /* samples waiting in the work buffers */
+	float *coef;  /* reversed, every tap twice for I and Q */
+	int16_t *coef16;  /* reversed, scaled by 2^shift16 */
+	int16_t *coef16_i;  /* the same interleaved with zeros, I lanes */
+	int16_t *coef16_q;  /* and Q lanes */
+	int shift16;
+	float *work;
+	int16_t *work16;
+	const struct decim_kernels *k;
+};
+
+/*!
+ * Enable or disable the SIMD kernels
+ *
+ * Only affects filters initialized afterwards.
+ *
+ * \param enable 0 forces the portable scalar kernels
+ */
+
+void decim_set_simd(int enable);
+
+/*!
+ * Set up a decimating filter
+ *
+ * \param f filter to fill in
+ * \param h taps, any gain, a coefficient over 2^15/(2^15-1) costs the
+ *          int16 path precision
+ * \param taps number of taps, 1 to DECIM_MAX_TAPS
+ * \param factor keep one output per factor inputs, 1 just filters
+ * \return 0 on success, -1 on bad arguments or allocation failure
+ */
+
+int decim_fir_init(struct decim_fir *f, const double *h, int taps, int factor);
+
+/*!
+ * Forget the history, the next output waits for a full window again
+ */
+
+void decim_fir_reset(struct decim_fir *f);
+
+void decim_fir_free(struct decim_fir *f);
+
+/*!
+ * Filter and decimate float samples
+ *
+ * A filter should be fed with only one of the sample types.
+ *
+ * \param f filter
+ * \param in n interleaved complex samples
+ * \param n number of complex samples
+ * \param out room for n/factor + 1 complex samples, may be in
+ * \return complex samples written to out
+ */
+
+int decim_fir_float(struct decim_fir *f, const float *in, int n, float *out);
+
+/*!
+ * Filter and decimate int16 samples
+ *
+ * Sums in 32 bits and saturates the result.
+ *
+ * \param f filter
+ * \param in n interleaved complex samples
+ * \param n number of complex samples
+ * \param out room for n/factor + 1 complex samples, may be in
+ * \return complex samples written to out
+ */
+
+int decim_fir_int16(struct decim_fir *f, const int16_t *in, int n, int16_t *out);
+
+/*!
+ * Blackman windowed sinc low pass, unity gain at DC
+ *
+ * \param h receives taps coefficients
+ * \param taps odd length
+ * \param cutoff -6dB point in cycles per input sample, under 0.5
+ */
+
+void decim_design_lowpass(double *h, int taps, double cutoff);
+
+/*!
+ * Blackman windowed halfband for decimating by two
+ *
+ * Every other tap but the center is zero.
+ *
+ * \param h receives taps coefficients
+ * \param taps 4m+3, other lengths are rounded up
+ * \return the length used
+ */
+
+int decim_design_halfband(double *h, int taps);
+
+/*!
+ * A CIC decimator written out as an FIR, unity gain at DC
+ *
+ * order 5 with ratio 2 is the classic (1,5,10,10,5,1) binomial.
+ *
+ * \param h receives order*(ratio-1)+1 coefficients
+ * \param order number of integrator/comb pairs
+ * \param ratio decimation of the CIC
+ * \return the length used
+ */
+
+int decim_design_cic(double *h, int order, int ratio);
+
+/*!
+ * Droop compensation for a cascade of decimate by two stages
+ *
+ * Least squares fit of the inverse cascade response over the passband.
+ * Runs at the output rate of the cascade.
+ *
+ * \param h receives taps coefficients, unity gain at DC
+ * \param taps odd length
+ * \param stage taps of one decimate by two stage
+ * \param stage_taps number of those
+ * \param passes stages in the cascade
+ * \param passband edge in cycles per output sample, under 0.5
+ * \return 0 on success, -1 on bad arguments
+ */
+
+int decim_design_comp(double *h, int taps, const double *stage, int stage_taps,
+		      int passes, double passband);
+
+/*!
+ * Magnitude response of a filter
+ *
+ * \param f frequency in cycles per input sample
+ */
+
+double decim_response(const double *h, int taps, double f);
@@ -0,0 +1,428 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* radix-4 decimation in time, with one radix-2 pass for odd sizes
+ *
+ * After the bit reversal the four quarter blocks of a group hold the
+ * sub-DFTs of the residues 0, 2, 1, 3 (mod 4).  Each stage multiplies
+ * those by W^2k, W^k and W^3k and does a twiddle free 4 point DFT.
+ * Twiddles are stored per stage, k ascending, each complex as the pair
+ * of vectors {c, c} and {-d, d} so a complex multiply is two products
+ * and a swap in every instruction set.
+ * */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define _USE_MATH_DEFINES
+#endif
+
+#include <math.h>
+#include <pthread.h>
+
+#include "fft.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FFT_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(FFT_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FFT_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FFT_NEON
+#include <arm_neon.h>
+#endif
+
+/* butterflies k0 to k1-1 of every group, the vector kernels want both
+ * aligned to their width */
+typedef void (*radix4_fn)(float *iq, int n, int l, const float *tw, int k0, int k1);
+
+struct fft_plan
+{
+	int log2n;
+	int n;
+	uint32_t *swaps;  /* bit reversal pairs, i < j */
+	int swap_count;
+	float *tw;  /* 12*l floats per radix-4 stage */
+	radix4_fn radix4;
+};
+
+static struct fft_plan *plans[FFT_MAX_LOG2 + 1];
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+static int simd_enabled = 1;
+
+static void radix2_pass(float *iq, int n)
+{
+	int i;
+	float ar, ai, br, bi;
+	for (i=0; i<2*n; i+=4) {
+		ar = iq[i];   ai = iq[i+1];
+		br = iq[i+2]; bi = iq[i+3];
+		iq[i]   = ar + br; iq[i+1] = ai + bi;
+		iq[i+2] = ar - br; iq[i+3] = ai - bi;
+	}
+}
+
+static void radix4_scalar(float *iq, int n, int l, const float *tw, int k0, int k1)
+{
+	int i, k;
+	float *p0, *p1, *p2, *p3;
+	const float *w1, *w2, *w3;
+	float t1r, t1i, t2r, t2i, t3r, t3i;
+	float sr, si, dr, di, ur, ui, vr, vi;
+	for (i=0; i<n; i+=4*l) {
+		p0 = iq + 2*i;
+		p1 = p0 + 2*l;
+		p2 = p1 + 2*l;
+		p3 = p2 + 2*l;
+		w1 = tw;
+		w2 = tw + 4*l;
+		w3 = tw + 8*l;
+		for (k=2*k0; k<2*k1; k+=2) {
+			t1r = p1[k]*w1[k] - p1[k+1]*w1[2*l+k+1];
+			t1i = p1[k+1]*w1[k] + p1[k]*w1[2*l+k+1];
+			t2r = p2[k]*w2[k] - p2[k+1]*w2[2*l+k+1];
+			t2i = p2[k+1]*w2[k] + p2[k]*w2[2*l+k+1];
+			t3r = p3[k]*w3[k] - p3[k+1]*w3[2*l+k+1];
+			t3i = p3[k+1]*w3[k] + p3[k]*w3[2*l+k+1];
+			sr = p0[k] + t1r; si = p0[k+1] + t1i;
+			dr = p0[k] - t1r; di = p0[k+1] - t1i;
+			ur = t2r + t3r;   ui = t2i + t3i;
+			vr = t2r - t3r;   vi = t2i - t3i;
+			p0[k] = sr + ur;  p0[k+1] = si + ui;
+			p2[k] = sr - ur;  p2[k+1] = si - ui;
+			/* -i * v */
+			p1[k] = dr + vi;  p1[k+1] = di - vr;
+			p3[k] = dr - vi;  p3[k+1] = di + vr;
+		}
+	}
+}
+
+#ifdef FFT_SSE2
+static void radix4_sse2(float *iq, int n, int l, const float *tw, int k0, int k1)
+{
+	int i, k;
+	float *p0, *p1, *p2, *p3;
+	const float *w1, *w2, *w3;
+	__m128 a, b, c, d, s, u, v, jv;
+	const __m128 odd = _mm_castsi128_ps(_mm_set_epi32((int)0x80000000, 0, (int)0x80000000, 0));
+	if (l < 2) {
+		radix4_scalar(iq, n, l, tw, k0, k1);
+		return;
+	}
+	for (i=0; i<n; i+=4*l) {
+		p0 = iq + 2*i;
+		p1 = p0 + 2*l;
+		p2 = p1 + 2*l;
+		p3 = p2 + 2*l;
+		w1 = tw;
+		w2 = tw + 4*l;
+		w3 = tw + 8*l;
+		for (k=2*k0; k<2*k1; k+=4) {
+			a = _mm_loadu_ps(p0+k);
+			b = _mm_loadu_ps(p1+k);
+			c = _mm_loadu_ps(p2+k);
+			d = _mm_loadu_ps(p3+k);
+			b = _mm_add_ps(_mm_mul_ps(b, _mm_loadu_ps(w1+k)),
+				_mm_mul_ps(_mm_shuffle_ps(b, b, 0xB1), _mm_loadu_ps(w1+2*l+k)));
+			c = _mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(w2+k)),
+				_mm_mul_ps(_mm_shuffle_ps(c, c, 0xB1), _mm_loadu_ps(w2+2*l+k)));
+			d = _mm_add_ps(_mm_mul_ps(d, _mm_loadu_ps(w3+k)),
+				_mm_mul_ps(_mm_shuffle_ps(d, d, 0xB1), _mm_loadu_ps(w3+2*l+k)));
+			s = _mm_add_ps(a, b);
+			a = _mm_sub_ps(a, b);
+			u = _mm_add_ps(c, d);
+			v = _mm_sub_ps(c, d);
+			jv = _mm_xor_ps(_mm_shuffle_ps(v, v, 0xB1), odd);
+			_mm_storeu_ps(p0+k, _mm_add_ps(s, u));
+			_mm_storeu_ps(p2+k, _mm_sub_ps(s, u));
+			_mm_storeu_ps(p1+k, _mm_add_ps(a, jv));
+			_mm_storeu_ps(p3+k, _mm_sub_ps(a, jv));
+		}
+	}
+}
+#endif
+
+#ifdef FFT_AVX2
+static __attribute__((target("avx2,fma"))) void radix4_avx2(float *iq, int n, int l, const float *tw, int k0, int k1)
+{
+	int i, k;
+	float *p0, *p1, *p2, *p3;
+	const float *w1, *w2, *w3;
+	__m256 a, b, c, d, s, u, v, jv;
+	const __m256 odd = _mm256_castsi256_ps(_mm256_set_epi32(
+		(int)0x80000000, 0, (int)0x80000000, 0,
+		(int)0x80000000, 0, (int)0x80000000, 0));
+	if (l < 4) {
+		radix4_sse2(iq, n, l, tw, k0, k1);
+		return;
+	}
+	for (i=0; i<n; i+=4*l) {
+		p0 = iq + 2*i;
+		p1 = p0 + 2*l;
+		p2 = p1 + 2*l;
+		p3 = p2 + 2*l;
+		w1 = tw;
+		w2 = tw + 4*l;
+		w3 = tw + 8*l;
+		for (k=2*k0; k<2*k1; k+=8) {
+			a = _mm256_loadu_ps(p0+k);
+			b = _mm256_loadu_ps(p1+k);
+			c = _mm256_loadu_ps(p2+k);
+			d = _mm256_loadu_ps(p3+k);
+			b = _mm256_fmadd_ps(_mm256_permute_ps(b, 0xB1), _mm256_loadu_ps(w1+2*l+k),
+				_mm256_mul_ps(b, _mm256_loadu_ps(w1+k)));
+			c = _mm256_fmadd_ps(_mm256_permute_ps(c, 0xB1), _mm256_loadu_ps(w2+2*l+k),
+				_mm256_mul_ps(c, _mm256_loadu_ps(w2+k)));
+			d = _mm256_fmadd_ps(_mm256_permute_ps(d, 0xB1), _mm256_loadu_ps(w3+2*l+k),
+				_mm256_mul_ps(d, _mm256_loadu_ps(w3+k)));
+			s = _mm256_add_ps(a, b);
+			a = _mm256_sub_ps(a, b);
+			u = _mm256_add_ps(c, d);
+			v = _mm256_sub_ps(c, d);
+			jv = _mm256_xor_ps(_mm256_permute_ps(v, 0xB1), odd);
+			_mm256_storeu_ps(p0+k, _mm256_add_ps(s, u));
+			_mm256_storeu_ps(p2+k, _mm256_sub_ps(s, u));
+			_mm256_storeu_ps(p1+k, _mm256_add_ps(a, jv));
+			_mm256_storeu_ps(p3+k, _mm256_sub_ps(a, jv));
+		}
+	}
+}
+#endif
+
+#ifdef FFT_NEON
+static void radix4_neon(float *iq, int n, int l, const float *tw, int k0, int k1)
+{
+	int i, k;
+	float *p0, *p1, *p2, *p3;
+	const float *w1, *w2, *w3;
+	float32x4_t a, b, c, d, s, u, v, jv;
+	static const float odd_sign[4] = {1.0f, -1.0f, 1.0f, -1.0f};
+	const float32x4_t odd = vld1q_f32(odd_sign);
+	if (l < 2) {
+		radix4_scalar(iq, n, l, tw, k0, k1);
+		return;
+	}
+	for (i=0; i<n; i+=4*l) {
+		p0 = iq + 2*i;
+		p1 = p0 + 2*l;
+		p2 = p1 + 2*l;
+		p3 = p2 + 2*l;
+		w1 = tw;
+		w2 = tw + 4*l;
+		w3 = tw + 8*l;
+		for (k=2*k0; k<2*k1; k+=4) {
+			a = vld1q_f32(p0+k);
+			b = vld1q_f32(p1+k);
+			c = vld1q_f32(p2+k);
+			d = vld1q_f32(p3+k);
+			b = vmlaq_f32(vmulq_f32(b, vld1q_f32(w1+k)), vrev64q_f32(b), vld1q_f32(w1+2*l+k));
+			c = vmlaq_f32(vmulq_f32(c, vld1q_f32(w2+k)), vrev64q_f32(c), vld1q_f32(w2+2*l+k));
+			d = vmlaq_f32(vmulq_f32(d, vld1q_f32(w3+k)), vrev64q_f32(d), vld1q_f32(w3+2*l+k));
+			s = vaddq_f32(a, b);
+			a = vsubq_f32(a, b);
+			u = vaddq_f32(c, d);
+			v = vsubq_f32(c, d);
+			jv = vmulq_f32(vrev64q_f32(v), odd);
+			vst1q_f32(p0+k, vaddq_f32(s, u));
+			vst1q_f32(p2+k, vsubq_f32(s, u));
+			vst1q_f32(p1+k, vaddq_f32(a, jv));
+			vst1q_f32(p3+k, vsubq_f32(a, jv));
+		}
+	}
+}
+#endif
+
+static radix4_fn pick_radix4(void)
+{
+	if (!simd_enabled) {
+		return radix4_scalar;}
+#ifdef FFT_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return radix4_avx2;}
+#endif
+#if defined(FFT_SSE2)
+	return radix4_sse2;
+#elif defined(FFT_NEON)
+	return radix4_neon;
+#else
+	return radix4_scalar;
+#endif
+}
+
+void fft_set_simd(int enable)
+{
+	simd_enabled = enable;
+}
+
+const char *fft_simd_name(void)
+{
+	radix4_fn f = pick_radix4();
+#ifdef FFT_AVX2
+	if (f == radix4_avx2) {
+		return "avx2";}
+#endif
+#ifdef FFT_SSE2
+	if (f == radix4_sse2) {
+		return "sse2";}
+#endif
+#ifdef FFT_NEON
+	if (f == radix4_neon) {
+		return "neon";}
+#endif
+	return "scalar";
+}
+
+static uint32_t bit_reverse(uint32_t x, int bits)
+{
+	uint32_t r = 0;
+	int i;
+	for (i=0; i<bits; i++) {
+		r = (r << 1) | (x & 1);
+		x >>= 1;
+	}
+	return r;
+}
+
+static void plan_free(struct fft_plan *p)
+{
+	if (!p) {
+		return;}
+	free(p->swaps);
+	free(p->tw);
+	free(p);
+}
+
+static struct fft_plan *plan_build(int log2n)
+{
+	struct fft_plan *p;
+	int i, j, k, l, n;
+	size_t tw_len;
+	float *tw;
+	double a;
+	p = calloc(1, sizeof(struct fft_plan));
+	if (!p) {
+		return NULL;}
+	n = 1 << log2n;
+	p->log2n = log2n;
+	p->n = n;
+	p->radix4 = pick_radix4();
+	/* every index pairs with its reverse, about half of them move */
+	p->swaps = malloc((n/2 + 1) * 2 * sizeof(uint32_t));
+	if (!p->swaps) {
+		plan_free(p);
+		return NULL;
+	}
+	for (i=0; i<n; i++) {
+		j = (int)bit_reverse((uint32_t)i, log2n);
+		if (i < j) {
+			p->swaps[2*p->swap_count]   = (uint32_t)i;
+			p->swaps[2*p->swap_count+1] = (uint32_t)j;
+			p->swap_count++;
+		}
+	}
+	tw_len = 0;
+	for (l=(log2n & 1) ? 2 : 1; l<n; l*=4) {
+		tw_len += 12 * (size_t)l;
+	}
+	p->tw = malloc((tw_len + 1) * sizeof(float));
+	if (!p->tw) {
+		plan_free(p);
+		return NULL;
+	}
+	tw = p->tw;
+	for (l=(log2n & 1) ? 2 : 1; l<n; l*=4) {
+		/* block 1 wants W^2k, block 2 W^k, block 3 W^3k, W = e^(-2pi i/4l) */
+		for (j=0; j<3; j++) {
+			for (k=0; k<l; k++) {
+				a = -2.0 * M_PI * (double)(k * (j==0 ? 2 : (j==1 ? 1 : 3))) / (double)(4*l);
+				tw[2*k]         = (float)cos(a);
+				tw[2*k+1]       = (float)cos(a);
+				tw[2*l + 2*k]   = (float)-sin(a);
+				tw[2*l + 2*k+1] = (float)sin(a);
+			}
+			tw += 4*l;
+		}
+	}
+	return p;
+}
+
+struct fft_plan *fft_plan_get(int log2n)
+{
+	struct fft_plan *p;
+	if (log2n < 0 || log2n > FFT_MAX_LOG2) {
+		return NULL;}
+	pthread_mutex_lock(&plan_lock);
+	if (!plans[log2n]) {
+		plans[log2n] = plan_build(log2n);}
+	p = plans[log2n];
+	pthread_mutex_unlock(&plan_lock);
+	return p;
+}
+
+void fft_execute(struct fft_plan *p, float *iq)
+{
+	fft_execute_band(p, iq, p->n);
+}
+
+void fft_execute_band(struct fft_plan *p, float *iq, int width)
+/* Every stage leaves DFTs of length 4l in place.  Bins near DC of one
+ * only need bins near DC of its quarters, so once l > 2*width only the
+ * butterflies k < width and k >= l - width have a bin worth keeping. */
+{
+	int i, l;
+	uint32_t a, b;
+	float t;
+	const float *tw = p->tw;
+	/* whole vectors for every kernel */
+	width = (width + 3) & ~3;
+	for (i=0; i<p->swap_count; i++) {
+		a = 2 * p->swaps[2*i];
+		b = 2 * p->swaps[2*i+1];
+		t = iq[a];   iq[a] = iq[b];     iq[b] = t;
+		t = iq[a+1]; iq[a+1] = iq[b+1]; iq[b+1] = t;
+	}
+	l = 1;
+	if (p->log2n & 1) {
+		radix2_pass(iq, p->n);
+		l = 2;
+	}
+	for (; l<p->n; l*=4) {
+		if (l > 2*width) {
+			p->radix4(iq, p->n, l, tw, 0, width);
+			p->radix4(iq, p->n, l, tw, l - width, l);
+		} else {
+			p->radix4(iq, p->n, l, tw, 0, l);}
+		tw += 12 * l;
+	}
+}
+
+void fft_plans_free(void)
+{
+	int i;
+	pthread_mutex_lock(&plan_lock);
+	for (i=0; i<=FFT_MAX_LOG2; i++) {
+		plan_free(plans[i]);
+		plans[i] = NULL;
+	}
+	pthread_mutex_unlock(&plan_lock);
+}
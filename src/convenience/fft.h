@@ -0,0 +1,78 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* single precision complex FFT with cached plans */
+
+#define FFT_MAX_LOG2	21
+
+struct fft_plan;
+
+/*!
+ * Enable or disable the SIMD kernels
+ *
+ * Only affects plans created afterwards, call before fft_plan_get().
+ *
+ * \param enable 0 forces the portable scalar kernels
+ */
+
+void fft_set_simd(int enable);
+
+/*!
+ * Name of the kernels new plans will use
+ *
+ * \return "avx2", "sse2", "neon" or "scalar"
+ */
+
+const char *fft_simd_name(void);
+
+/*!
+ * Get the plan for a transform size, building it on first use
+ *
+ * Plans are shared and thread safe to execute concurrently.
+ *
+ * \param log2n transform length as a power of two, 0 to FFT_MAX_LOG2
+ * \return plan, or NULL on bad size or allocation failure
+ */
+
+struct fft_plan *fft_plan_get(int log2n);
+
+/*!
+ * Forward transform, in place, not normalized
+ *
+ * \param plan from fft_plan_get()
+ * \param iq interleaved real/imaginary floats, 2 << log2n long
+ */
+
+void fft_execute(struct fft_plan *plan, float *iq);
+
+/*!
+ * Forward transform of only the bins around DC
+ *
+ * Bins k < width and k >= n - width come out exactly as from
+ * fft_execute(), the others are left undefined.  Work is saved in the
+ * stages longer than eight times the width.
+ *
+ * \param plan from fft_plan_get()
+ * \param iq interleaved real/imaginary floats, 2 << log2n long
+ * \param width bins kept on each side of DC, n/2 or more is everything
+ */
+
+void fft_execute_band(struct fft_plan *plan, float *iq, int width);
+
+/*!
+ * Release every cached plan
+ */
+
+void fft_plans_free(void);
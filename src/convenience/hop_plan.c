@@ -0,0 +1,287 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* hop ordering against a measured retune cost model
+ *
+ * A transition costs the sum of what it changes: sampling mode, rate,
+ * gain, frequency, and on top of the frequency a tuner band switch.
+ * The costs are timed on the device so the model follows whatever the
+ * tuner driver actually writes.  Sweeps repeat, so the tour is closed.
+ * */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtl-sdr.h"
+#include "hop_plan.h"
+#include "hop_timing.h"
+
+#define MEASURE_REPS	4
+#define TWO_OPT_PASSES	16
+
+enum hop_kind {
+	HOP_FREQ,
+	HOP_BAND,
+	HOP_RATE,
+	HOP_GAIN,
+	HOP_DIRECT
+};
+
+static void apply(rtlsdr_dev_t *dev, enum hop_kind kind, const struct hop_key *k)
+{
+	switch (kind) {
+	case HOP_FREQ:
+	case HOP_BAND:
+		rtlsdr_set_center_freq_sync(dev, k->freq, NULL);
+		break;
+	case HOP_RATE:
+		rtlsdr_set_sample_rate(dev, k->rate);
+		break;
+	case HOP_GAIN:
+		rtlsdr_set_tuner_gain(dev, k->gain);
+		break;
+	case HOP_DIRECT:
+		rtlsdr_set_direct_sampling(dev, k->direct_sampling);
+		break;
+	}
+}
+
+static double time_pair(rtlsdr_dev_t *dev, enum hop_kind kind,
+			const struct hop_key *a, const struct hop_key *b)
+/* average of a->b and b->a */
+{
+	int i;
+	uint64_t t;
+	apply(dev, kind, a);
+	t = hop_timing_now();
+	for (i=0; i<MEASURE_REPS; i++) {
+		apply(dev, kind, b);
+		apply(dev, kind, a);
+	}
+	return (double)(hop_timing_now() - t) / (2.0 * MEASURE_REPS);
+}
+
+int hop_cost_measure(rtlsdr_dev_t *dev, const struct hop_key *keys, int count,
+		     struct hop_cost *cost)
+{
+	int i, n, *gains;
+	const struct hop_key *k0 = &keys[0];
+	struct hop_key a, b;
+	memset(cost, 0, sizeof(struct hop_cost));
+	if (!dev || count < 2) {
+		return -1;}
+	for (i=1; i<count; i++) {
+		if (keys[i].direct_sampling != k0->direct_sampling) {
+			/* leaving direct sampling reinitializes the tuner */
+			cost->direct = time_pair(dev, HOP_DIRECT, k0, &keys[i]);
+			break;
+		}
+	}
+	for (i=1; i<count; i++) {
+		if (keys[i].rate != k0->rate) {
+			cost->rate = time_pair(dev, HOP_RATE, k0, &keys[i]);
+			break;
+		}
+	}
+	for (i=1; i<count; i++) {
+		if (keys[i].gain != k0->gain) {
+			break;}
+	}
+	/* auto gain is no register value, time two manual ones instead */
+	n = rtlsdr_get_tuner_gains(dev, NULL);
+	if (i < count && n > 1) {
+		gains = malloc(n * sizeof(int));
+		if (gains && rtlsdr_get_tuner_gains(dev, gains) == n) {
+			a = *k0;
+			b = *k0;
+			a.gain = gains[0];
+			b.gain = gains[n-1];
+			rtlsdr_set_tuner_gain_mode(dev, 1);
+			cost->gain = time_pair(dev, HOP_GAIN, &a, &b);
+		}
+		free(gains);
+	}
+	/* a retune inside the first band, made up if the plan has none */
+	a = *k0;
+	b = *k0;
+	b.freq = 0;
+	for (i=1; i<count; i++) {
+		if (keys[i].band == k0->band && keys[i].freq != k0->freq) {
+			b.freq = keys[i].freq;
+			break;
+		}
+	}
+	if (!b.freq) {
+		b.freq = k0->freq + 100000;
+		if (rtlsdr_get_tuner_band(dev, b.freq) != k0->band) {
+			b.freq = k0->freq - 100000;}
+	}
+	cost->freq = time_pair(dev, HOP_FREQ, &a, &b);
+	for (i=1; i<count; i++) {
+		if (keys[i].band != k0->band) {
+			cost->band = time_pair(dev, HOP_BAND, k0, &keys[i]) - cost->freq;
+			break;
+		}
+	}
+	if (cost->band < 0.0) {
+		cost->band = 0.0;}
+	return 0;
+}
+
+double hop_transition_cost(const struct hop_cost *cost,
+			   const struct hop_key *a, const struct hop_key *b)
+{
+	double c = 0.0;
+	if (a->direct_sampling != b->direct_sampling) {
+		c += cost->direct;}
+	if (a->rate != b->rate) {
+		c += cost->rate;}
+	if (a->gain != b->gain) {
+		c += cost->gain;}
+	if (a->freq != b->freq) {
+		c += cost->freq;}
+	if (a->band != b->band) {
+		c += cost->band;}
+	return c;
+}
+
+struct sort_ctx
+{
+	const struct hop_key *keys;
+	int prio[4];  /* enum hop_kind, costliest first */
+};
+
+static int attr(const struct hop_key *k, int kind)
+{
+	switch (kind) {
+	case HOP_RATE:
+		return (int)k->rate;
+	case HOP_GAIN:
+		return k->gain;
+	case HOP_DIRECT:
+		return k->direct_sampling;
+	default:
+		return k->band;
+	}
+}
+
+static int hop_cmp(const struct sort_ctx *ctx, int x, int y)
+{
+	int i, a, b;
+	const struct hop_key *kx = &ctx->keys[x];
+	const struct hop_key *ky = &ctx->keys[y];
+	for (i=0; i<4; i++) {
+		a = attr(kx, ctx->prio[i]);
+		b = attr(ky, ctx->prio[i]);
+		if (a != b) {
+			return a < b ? -1 : 1;}
+	}
+	if (kx->freq != ky->freq) {
+		return kx->freq < ky->freq ? -1 : 1;}
+	return x - y;
+}
+
+static void merge_sort(const struct sort_ctx *ctx, int *v, int *tmp, int n)
+{
+	int h, i, j, k;
+	if (n < 2) {
+		return;}
+	h = n / 2;
+	merge_sort(ctx, v, tmp, h);
+	merge_sort(ctx, v + h, tmp, n - h);
+	i = 0; j = h; k = 0;
+	while (i < h && j < n) {
+		tmp[k++] = hop_cmp(ctx, v[i], v[j]) <= 0 ? v[i++] : v[j++];}
+	while (i < h) {
+		tmp[k++] = v[i++];}
+	while (j < n) {
+		tmp[k++] = v[j++];}
+	memcpy(v, tmp, n * sizeof(int));
+}
+
+static double tour_cost(const struct hop_key *keys, int count,
+			const struct hop_cost *cost, const int *order)
+{
+	int i;
+	double c = 0.0;
+	for (i=0; i<count; i++) {
+		c += hop_transition_cost(cost, &keys[order[i]], &keys[order[(i+1) % count]]);}
+	return c;
+}
+
+double hop_plan_order(const struct hop_key *keys, int count,
+		      const struct hop_cost *cost, int *order)
+{
+	struct sort_ctx ctx;
+	double w[5], delta;
+	int i, j, a, b, c, d, s, improved, pass, *tmp;
+	for (i=0; i<count; i++) {
+		order[i] = i;}
+	if (count < 2) {
+		return 0.0;}
+	/* group the expensive settings so each value is set once a sweep */
+	ctx.keys = keys;
+	w[HOP_FREQ] = 0.0;
+	w[HOP_BAND] = cost->band;
+	w[HOP_RATE] = cost->rate;
+	w[HOP_GAIN] = cost->gain;
+	w[HOP_DIRECT] = cost->direct;
+	ctx.prio[0] = HOP_DIRECT;
+	ctx.prio[1] = HOP_RATE;
+	ctx.prio[2] = HOP_GAIN;
+	ctx.prio[3] = HOP_BAND;
+	for (i=1; i<4; i++) {
+		for (j=i; j>0 && w[ctx.prio[j]] > w[ctx.prio[j-1]]; j--) {
+			s = ctx.prio[j];
+			ctx.prio[j] = ctx.prio[j-1];
+			ctx.prio[j-1] = s;
+		}
+	}
+	tmp = malloc(count * sizeof(int));
+	if (!tmp) {
+		return tour_cost(keys, count, cost, order);}
+	merge_sort(&ctx, order, tmp, count);
+	free(tmp);
+	/* then 2-opt, reversing a stretch when that joins it up cheaper */
+	improved = 1;
+	for (pass=0; improved && pass<TWO_OPT_PASSES && count>3; pass++) {
+		improved = 0;
+		for (i=0; i<count-2; i++) {
+			for (j=i+2; j<count; j++) {
+				if (i == 0 && j == count-1) {
+					continue;}
+				a = order[i];
+				b = order[i+1];
+				c = order[j];
+				d = order[(j+1) % count];
+				delta = hop_transition_cost(cost, &keys[a], &keys[c])
+				      + hop_transition_cost(cost, &keys[b], &keys[d])
+				      - hop_transition_cost(cost, &keys[a], &keys[b])
+				      - hop_transition_cost(cost, &keys[c], &keys[d]);
+				if (delta > -1e-6) {
+					continue;}
+				for (a=i+1, b=j; a<b; a++, b--) {
+					s = order[a];
+					order[a] = order[b];
+					order[b] = s;
+				}
+				improved = 1;
+			}
+		}
+	}
+	return tour_cost(keys, count, cost, order);
+}
+
@@ -0,0 +1,78 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* hop ordering against a measured retune cost model */
+
+struct hop_key
+/* what one hop asks of the dongle */
+{
+	uint32_t freq;
+	uint32_t rate;
+	int gain;  /* tenths of a dB, any fixed value for auto */
+	int direct_sampling;
+	int band;  /* from rtlsdr_get_tuner_band() */
+};
+
+struct hop_cost
+/* microseconds per transition */
+{
+	double freq;  /* retune inside one band */
+	double band;  /* extra for crossing bands */
+	double rate;
+	double gain;
+	double direct;  /* direct sampling mode change */
+};
+
+/*!
+ * Time the kinds of transition a plan contains on the device
+ *
+ * Kinds the plan never makes are left at zero.  Changes the tuning,
+ * rate, gain and sampling mode, set them again afterwards.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param keys the hops, with band filled in
+ * \param count number of hops
+ * \param cost receives the model
+ * \return 0 on success
+ */
+
+int hop_cost_measure(rtlsdr_dev_t *dev, const struct hop_key *keys, int count,
+		     struct hop_cost *cost);
+
+/*!
+ * Modelled cost of going from one hop to another
+ *
+ * \return microseconds
+ */
+
+double hop_transition_cost(const struct hop_cost *cost,
+			   const struct hop_key *a, const struct hop_key *b);
+
+/*!
+ * Order hops for the cheapest repeated sweep
+ *
+ * Sorts by the costliest settings first, then improves the closed tour
+ * with 2-opt.  A plan differing only in frequency comes out ascending.
+ *
+ * \param keys the hops
+ * \param count number of hops
+ * \param cost the model
+ * \param order receives count hop indexes in sweep order
+ * \return modelled microseconds per sweep, wrap around included
+ */
+
+double hop_plan_order(const struct hop_key *keys, int count,
+		      const struct hop_cost *cost, int *order);
+
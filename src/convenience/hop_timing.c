@@ -0,0 +1,256 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "hop_timing.h"
+
+static const char *stage_names[HOP_TIMING_STAGES] = {
+	"tune", "settle", "stall", "read", "convert", "fft", "merge", "format"};
+
+uint64_t hop_timing_now(void)
+{
+#ifdef _WIN32
+	/* the tick count only moves every millisecond or more */
+	static LARGE_INTEGER f;
+	LARGE_INTEGER c;
+	if (!f.QuadPart) {
+		QueryPerformanceFrequency(&f);}
+	QueryPerformanceCounter(&c);
+	return (uint64_t)(c.QuadPart / f.QuadPart) * 1000000
+		+ (uint64_t)(c.QuadPart % f.QuadPart) * 1000000 / f.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+int hop_timing_init(struct hop_timing *t, int hops)
+{
+	t->hops = hops < 0 ? 0 : hops;
+	t->hist = calloc((size_t)(t->hops + 1) * HOP_TIMING_STAGES, sizeof(struct timing_hist));
+	return t->hist ? 0 : -1;
+}
+
+void hop_timing_reset(struct hop_timing *t)
+{
+	memset(t->hist, 0, (size_t)(t->hops + 1) * HOP_TIMING_STAGES * sizeof(struct timing_hist));
+}
+
+void hop_timing_free(struct hop_timing *t)
+{
+	free(t->hist);
+	t->hist = NULL;
+}
+
+const char *hop_stage_name(int stage)
+{
+	if (stage < 0 || stage >= HOP_TIMING_STAGES) {
+		return "?";}
+	return stage_names[stage];
+}
+
+static struct timing_hist *hist_at(const struct hop_timing *t, int hop, int stage)
+{
+	if (hop < 0 || hop >= t->hops) {
+		hop = t->hops;}
+	return &t->hist[hop * HOP_TIMING_STAGES + stage];
+}
+
+void hop_timing_add(struct hop_timing *t, int hop, int stage, uint64_t us)
+{
+	struct timing_hist *h;
+	int b = 0;
+	if (stage < 0 || stage >= HOP_TIMING_STAGES) {
+		return;}
+	h = hist_at(t, hop, stage);
+	while (b < HOP_TIMING_BUCKETS - 1 && (us >> b)) {
+		b++;}
+	if (!h->n || us < h->min_us) {
+		h->min_us = us;}
+	h->bucket[b]++;
+	h->n++;
+	h->sum_us += us;
+	if (us > h->max_us) {
+		h->max_us = us;}
+}
+
+static void hist_add(struct timing_hist *dst, const struct timing_hist *src)
+{
+	int b;
+	if (!src->n) {
+		return;}
+	for (b=0; b<HOP_TIMING_BUCKETS; b++) {
+		dst->bucket[b] += src->bucket[b];}
+	if (!dst->n || src->min_us < dst->min_us) {
+		dst->min_us = src->min_us;}
+	dst->n += src->n;
+	dst->sum_us += src->sum_us;
+	if (src->max_us > dst->max_us) {
+		dst->max_us = src->max_us;}
+}
+
+void hop_timing_merge(struct hop_timing *dst, const struct hop_timing *src)
+{
+	int i;
+	if (dst->hops != src->hops) {
+		return;}
+	for (i=0; i<(src->hops + 1) * HOP_TIMING_STAGES; i++) {
+		hist_add(&dst->hist[i], &src->hist[i]);}
+}
+
+void hop_timing_stage(const struct hop_timing *t, int stage, struct timing_hist *out)
+{
+	int i;
+	memset(out, 0, sizeof(struct timing_hist));
+	for (i=0; i<=t->hops; i++) {
+		hist_add(out, &t->hist[i * HOP_TIMING_STAGES + stage]);}
+}
+
+double timing_hist_percentile(const struct timing_hist *h, double p)
+{
+	int b;
+	double target, seen = 0.0, lo, hi;
+	if (!h->n) {
+		return 0.0;}
+	target = p * (double)h->n;
+	for (b=0; b<HOP_TIMING_BUCKETS; b++) {
+		if (!h->bucket[b] || seen + (double)h->bucket[b] < target) {
+			seen += (double)h->bucket[b];
+			continue;
+		}
+		lo = b ? (double)((uint64_t)1 << (b - 1)) : 0.0;
+		hi = (double)((uint64_t)1 << b);
+		/* the top bucket is open, and nothing went past min and max */
+		if (lo < (double)h->min_us) {
+			lo = (double)h->min_us;}
+		if (b == HOP_TIMING_BUCKETS - 1 || hi > (double)h->max_us) {
+			hi = (double)h->max_us;}
+		if (hi < lo) {
+			hi = lo;}
+		return lo + (hi - lo) * (target - seen) / (double)h->bucket[b];
+	}
+	return (double)h->max_us;
+}
+
+static void print_stages(const struct timing_hist *row, FILE *file)
+{
+	int s, b;
+	const struct timing_hist *h;
+	for (s=0; s<HOP_TIMING_STAGES; s++) {
+		h = &row[s];
+		if (!h->n) {
+			continue;}
+		fprintf(file, "  %-8s %9llu %10.1f %10.1f %10.1f %10.1f %10llu\n", stage_names[s],
+			(unsigned long long)h->n, (double)h->sum_us / (double)h->n,
+			timing_hist_percentile(h, 0.5), timing_hist_percentile(h, 0.9),
+			timing_hist_percentile(h, 0.99), (unsigned long long)h->max_us);
+		fprintf(file, "  %8s", "");
+		for (b=0; b<HOP_TIMING_BUCKETS; b++) {
+			if (h->bucket[b]) {
+				fprintf(file, " %llu:%u", b ? (unsigned long long)1 << (b - 1) : 0ULL, h->bucket[b]);}
+		}
+		fprintf(file, "\n");
+	}
+}
+
+void hop_timing_print(const struct hop_timing *t, FILE *file, const int *hz, int per_hop)
+{
+	int s, i;
+	const struct timing_hist *row;
+	struct timing_hist total[HOP_TIMING_STAGES];
+	for (s=0; s<HOP_TIMING_STAGES; s++) {
+		hop_timing_stage(t, s, &total[s]);}
+	fprintf(file, "Hop timing in microseconds, histograms by lower bucket edge:\n");
+	fprintf(file, "  %-8s %9s %10s %10s %10s %10s %10s\n",
+		"stage", "count", "mean", "p50", "p90", "p99", "max");
+	print_stages(total, file);
+	for (i=0; per_hop && i<=t->hops; i++) {
+		row = &t->hist[i * HOP_TIMING_STAGES];
+		for (s=0; s<HOP_TIMING_STAGES && !row[s].n; s++) {;}
+		if (s == HOP_TIMING_STAGES) {
+			continue;}
+		if (i == t->hops) {
+			fprintf(file, "Other hops:\n");
+		} else if (hz) {
+			fprintf(file, "Hop %.6fMHz:\n", (double)hz[i] / 1e6);
+		} else {
+			fprintf(file, "Hop %i:\n", i);}
+		print_stages(row, file);
+	}
+}
+
+static void json_stages(const struct timing_hist *row, FILE *file)
+{
+	int s, b, last, first = 1;
+	const struct timing_hist *h;
+	fprintf(file, "{");
+	for (s=0; s<HOP_TIMING_STAGES; s++) {
+		h = &row[s];
+		if (!h->n) {
+			continue;}
+		fprintf(file, "%s\"%s\":{\"n\":%llu,\"mean_us\":%.1f,\"p50_us\":%.1f,"
+			"\"p90_us\":%.1f,\"p99_us\":%.1f,\"min_us\":%llu,\"max_us\":%llu,\"hist\":[",
+			first ? "" : ",", stage_names[s], (unsigned long long)h->n,
+			(double)h->sum_us / (double)h->n, timing_hist_percentile(h, 0.5),
+			timing_hist_percentile(h, 0.9), timing_hist_percentile(h, 0.99),
+			(unsigned long long)h->min_us, (unsigned long long)h->max_us);
+		for (last=HOP_TIMING_BUCKETS-1; last>0 && !h->bucket[last]; last--) {;}
+		for (b=0; b<=last; b++) {
+			fprintf(file, "%s%u", b ? "," : "", h->bucket[b]);}
+		fprintf(file, "]}");
+		first = 0;
+	}
+	fprintf(file, "}");
+}
+
+void hop_timing_json(const struct hop_timing *t, FILE *file, time_t when,
+		     const int *hz, int per_hop)
+{
+	int s, i, first = 1;
+	const struct timing_hist *row;
+	struct timing_hist total[HOP_TIMING_STAGES];
+	for (s=0; s<HOP_TIMING_STAGES; s++) {
+		hop_timing_stage(t, s, &total[s]);}
+	fprintf(file, "{\"time\":%lld,\"stages\":", (long long)when);
+	json_stages(total, file);
+	if (per_hop) {
+		fprintf(file, ",\"hops\":[");
+		for (i=0; i<t->hops; i++) {
+			row = &t->hist[i * HOP_TIMING_STAGES];
+			for (s=0; s<HOP_TIMING_STAGES && !row[s].n; s++) {;}
+			if (s == HOP_TIMING_STAGES) {
+				continue;}
+			if (hz) {
+				fprintf(file, "%s{\"hz\":%i,\"stages\":", first ? "" : ",", hz[i]);
+			} else {
+				fprintf(file, "%s{\"hop\":%i,\"stages\":", first ? "" : ",", i);}
+			json_stages(row, file);
+			fprintf(file, "}");
+			first = 0;
+		}
+		fprintf(file, "]");
+	}
+	fprintf(file, "}\n");
+}
@@ -0,0 +1,142 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* where the time of a sweep goes, per hop and stage
+ *
+ * Log2 histograms of microseconds.  A table is not locked, give every
+ * thread its own and add them up with hop_timing_merge() while the
+ * threads are idle.
+ * */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* bucket 0 is under 1us, bucket b from 2^(b-1) up to 2^b,
+ * the last one takes everything longer */
+#define HOP_TIMING_BUCKETS	24
+
+enum hop_stage
+{
+	HOP_TIMING_TUNE,  /* register writes, and the settle wait of tuners without a lock bit */
+	HOP_TIMING_SETTLE,  /* stream samples dropped until the new frequency settled */
+	HOP_TIMING_STALL,  /* waiting for a free capture buffer */
+	HOP_TIMING_READ,
+	HOP_TIMING_CONVERT,  /* to int16, decimation, dc removal */
+	HOP_TIMING_FFT,  /* window, fft and power sums */
+	HOP_TIMING_MERGE,  /* into the shared sums, lock wait included */
+	HOP_TIMING_FORMAT,  /* scaling and writing the reports */
+	HOP_TIMING_STAGES
+};
+
+struct timing_hist
+{
+	uint64_t n;
+	uint64_t sum_us;
+	uint64_t min_us;
+	uint64_t max_us;
+	uint32_t bucket[HOP_TIMING_BUCKETS];
+};
+
+struct hop_timing
+{
+	int hops;
+	struct timing_hist *hist;  /* hops + 1 rows of HOP_TIMING_STAGES, the last for other hops */
+};
+
+/*!
+ * \return microseconds on a monotonic clock, the one all sweep timings use
+ */
+
+uint64_t hop_timing_now(void);
+
+/*!
+ * Set up an empty table
+ *
+ * \param t table to fill in
+ * \param hops hop indices with a row of their own
+ * \return 0 on success, -1 on allocation failure
+ */
+
+int hop_timing_init(struct hop_timing *t, int hops);
+
+void hop_timing_reset(struct hop_timing *t);
+
+void hop_timing_free(struct hop_timing *t);
+
+/*!
+ * Count one pass through a stage
+ *
+ * \param t table
+ * \param hop index, those without a row are counted together
+ * \param stage enum hop_stage
+ * \param us duration
+ */
+
+void hop_timing_add(struct hop_timing *t, int hop, int stage, uint64_t us);
+
+/*!
+ * Add every count of src to dst, both need the same hop count
+ */
+
+void hop_timing_merge(struct hop_timing *dst, const struct hop_timing *src);
+
+/*!
+ * Sum a stage over all hops
+ */
+
+void hop_timing_stage(const struct hop_timing *t, int stage, struct timing_hist *out);
+
+/*!
+ * Estimate a percentile, linear inside the bucket
+ *
+ * \param h histogram
+ * \param p 0 to 1
+ * \return microseconds, 0 for an empty histogram
+ */
+
+double timing_hist_percentile(const struct timing_hist *h, double p);
+
+const char *hop_stage_name(int stage);
+
+/*!
+ * Human readable table, one line per stage with its histogram
+ *
+ * \param t table
+ * \param file where to
+ * \param hz hop frequencies for the labels, NULL labels by index
+ * \param per_hop also one block per hop
+ */
+
+void hop_timing_print(const struct hop_timing *t, FILE *file, const int *hz, int per_hop);
+
+/*!
+ * The same as one line of json
+ *
+ * {"time":..., "stages":{"tune":{"n":...,"mean_us":...,"p50_us":...,
+ * "p90_us":...,"p99_us":...,"min_us":...,"max_us":...,"hist":[...]},...},
+ * "hops":[...]}
+ * Stages that never ran are left out, hist stops at the last bucket
+ * with counts.  Each entry of "hops" has "hz" or "hop" and its stages.
+ *
+ * \param t table
+ * \param file where to
+ * \param when seconds since the epoch
+ * \param hz hop frequencies, NULL gives indices
+ * \param per_hop include "hops"
+ */
+
+void hop_timing_json(const struct hop_timing *t, FILE *file, time_t when,
+		     const int *hz, int per_hop);
@@ -0,0 +1,196 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "iq_stats.h"
+
+/* IQ_SCALAR builds the plain loop, for testing it on x86 */
+#if !defined(IQ_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define IQ_SSE2
+#include <emmintrin.h>
+#endif
+
+/* complex samples per block, the 32 bit sums of a block cannot overflow */
+#define BLOCK	4096
+
+/* the kernels work in half steps, 2*x - 255 is odd and symmetric */
+struct block_sums
+{
+	int32_t i;
+	int32_t q;
+	int32_t power;  /* i*i + q*q */
+	int32_t peak;
+	double mag;
+};
+
+static void block_scalar(const uint8_t *buf, int n, struct block_sums *s)
+{
+	int k;
+	int32_t a, b, p;
+	for (k=0; k<n; k++) {
+		a = 2 * (int32_t)buf[2*k] - 255;
+		b = 2 * (int32_t)buf[2*k+1] - 255;
+		p = a*a + b*b;
+		s->i += a;
+		s->q += b;
+		s->power += p;
+		if (p > s->peak) {
+			s->peak = p;}
+		s->mag += sqrtf((float)p);
+	}
+}
+
+#ifdef IQ_SSE2
+static int32_t hsum_epi32(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+static __m128i max_epi32(__m128i a, __m128i b)
+/* sse2 has no 32 bit max */
+{
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+static void block_sse2(const uint8_t *buf, int n, struct block_sums *s)
+/* eight complex samples per step, madd pairs up i*i + q*q */
+{
+	int k, j;
+	double lanes[2];
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mid = _mm_set1_epi16(255);
+	const __m128i pick_i = _mm_set1_epi32(1);
+	const __m128i pick_q = _mm_set1_epi32(1 << 16);
+	__m128i v, lo, hi, p_lo, p_hi;
+	__m128i sum_i = zero, sum_q = zero, power = zero, peak = zero;
+	__m128 mag;
+	__m128d mag_lo = _mm_setzero_pd(), mag_hi = _mm_setzero_pd();
+	for (k=0; k+8<=n; k+=8) {
+		v = _mm_loadu_si128((const __m128i *)(buf + 2*k));
+		lo = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(v, zero), 1), mid);
+		hi = _mm_sub_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(v, zero), 1), mid);
+		p_lo = _mm_madd_epi16(lo, lo);
+		p_hi = _mm_madd_epi16(hi, hi);
+		sum_i = _mm_add_epi32(sum_i, _mm_add_epi32(_mm_madd_epi16(lo, pick_i), _mm_madd_epi16(hi, pick_i)));
+		sum_q = _mm_add_epi32(sum_q, _mm_add_epi32(_mm_madd_epi16(lo, pick_q), _mm_madd_epi16(hi, pick_q)));
+		power = _mm_add_epi32(power, _mm_add_epi32(p_lo, p_hi));
+		peak = max_epi32(peak, max_epi32(p_lo, p_hi));
+		/* float sums drift by 1e-6 over a block, keep them in double */
+		mag = _mm_add_ps(_mm_sqrt_ps(_mm_cvtepi32_ps(p_lo)),
+				 _mm_sqrt_ps(_mm_cvtepi32_ps(p_hi)));
+		mag_lo = _mm_add_pd(mag_lo, _mm_cvtps_pd(mag));
+		mag_hi = _mm_add_pd(mag_hi, _mm_cvtps_pd(_mm_movehl_ps(mag, mag)));
+	}
+	s->i += hsum_epi32(sum_i);
+	s->q += hsum_epi32(sum_q);
+	s->power += hsum_epi32(power);
+	peak = max_epi32(peak, _mm_shuffle_epi32(peak, _MM_SHUFFLE(1, 0, 3, 2)));
+	peak = max_epi32(peak, _mm_shuffle_epi32(peak, _MM_SHUFFLE(2, 3, 0, 1)));
+	if (_mm_cvtsi128_si32(peak) > s->peak) {
+		s->peak = _mm_cvtsi128_si32(peak);}
+	_mm_storeu_pd(lanes, _mm_add_pd(mag_lo, mag_hi));
+	for (j=0; j<2; j++) {
+		s->mag += lanes[j];}
+	block_scalar(buf + 2*k, n - k, s);
+}
+#endif
+
+void iq_stats_measure(const uint8_t *buf, int len, struct iq_stats *out)
+{
+	int k, n;
+	int64_t sum_i = 0, sum_q = 0;
+	uint64_t power = 0;
+	int32_t peak = 0;
+	double mag = 0.0, ms;
+	struct block_sums s;
+	memset(out, 0, sizeof(struct iq_stats));
+	n = len / 2;
+	if (n < 1) {
+		return;}
+	for (k=0; k<n; k+=BLOCK) {
+		memset(&s, 0, sizeof(s));
+#ifdef IQ_SSE2
+		block_sse2(buf + 2*k, n - k < BLOCK ? n - k : BLOCK, &s);
+#else
+		block_scalar(buf + 2*k, n - k < BLOCK ? n - k : BLOCK, &s);
+#endif
+		sum_i += s.i;
+		sum_q += s.q;
+		power += (uint64_t)s.power;
+		if (s.peak > peak) {
+			peak = s.peak;}
+		mag += (double)s.mag;
+	}
+	/* back from half steps */
+	out->samples = n;
+	out->dc_i = (double)sum_i / (2.0 * n);
+	out->dc_q = (double)sum_q / (2.0 * n);
+	ms = (double)power / (4.0 * n) - out->dc_i * out->dc_i - out->dc_q * out->dc_q;
+	out->rms = ms > 0.0 ? sqrt(ms) : 0.0;
+	out->mean_mag = mag / (2.0 * n);
+	out->peak = sqrt((double)peak) / 2.0;
+}
+
+double iq_stats_mean_mag(const uint8_t *buf, int len, double dc_i, double dc_q)
+{
+	int k, n;
+	double i, q, mag = 0.0;
+	n = len / 2;
+	if (n < 1) {
+		return 0.0;}
+	dc_i += 127.5;
+	dc_q += 127.5;
+	for (k=0; k<n; k++) {
+		i = (double)buf[2*k] - dc_i;
+		q = (double)buf[2*k+1] - dc_q;
+		mag += sqrt(i*i + q*q);
+	}
+	return mag / n;
+}
+
+void iq_stats_reference(const uint8_t *buf, int len, struct iq_stats *out)
+{
+	int k, n;
+	double i, q, m, sum_i = 0.0, sum_q = 0.0, power = 0.0, mag = 0.0, peak = 0.0;
+	memset(out, 0, sizeof(struct iq_stats));
+	n = len / 2;
+	if (n < 1) {
+		return;}
+	for (k=0; k<n; k++) {
+		sum_i += (double)buf[2*k] - 127.5;
+		sum_q += (double)buf[2*k+1] - 127.5;
+	}
+	out->samples = n;
+	out->dc_i = sum_i / n;
+	out->dc_q = sum_q / n;
+	for (k=0; k<n; k++) {
+		i = (double)buf[2*k] - 127.5;
+		q = (double)buf[2*k+1] - 127.5;
+		power += (i - out->dc_i) * (i - out->dc_i) + (q - out->dc_q) * (q - out->dc_q);
+		m = sqrt(i*i + q*q);
+		mag += m;
+		if (m > peak) {
+			peak = m;}
+	}
+	out->rms = sqrt(power / n);
+	out->mean_mag = mag / n;
+	out->peak = peak;
+}
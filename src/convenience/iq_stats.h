@@ -0,0 +1,66 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* level statistics of raw 8 bit I/Q, in ADC steps
+ *
+ * Samples count from the midpoint 127.5 of the converter.  The rms is
+ * taken about the measured dc, magnitudes about the midpoint so one
+ * pass will do, the dc moves their mean by at most its own size.
+ * */
+
+#include <stdint.h>
+
+struct iq_stats
+{
+	int samples;  /* complex */
+	double dc_i;
+	double dc_q;
+	double rms;  /* of the complex samples, dc removed */
+	double mean_mag;
+	double peak;  /* largest magnitude */
+};
+
+/*!
+ * One pass, integer sums and a vector kernel where there is one
+ *
+ * \param buf interleaved I/Q bytes
+ * \param len bytes, an odd last one is ignored
+ * \param out the results, all 0 for an empty buffer
+ */
+
+void iq_stats_measure(const uint8_t *buf, int len, struct iq_stats *out);
+
+/*!
+ * Mean magnitude about a given centre, a second pass over the buffer
+ *
+ * For magnitudes with the dc removed, pass the dc found by
+ * iq_stats_measure().  A centre of 0, 0 gives its mean_mag again.
+ *
+ * \param buf interleaved I/Q bytes
+ * \param len bytes, an odd last one is ignored
+ * \param dc_i centre in ADC steps from the midpoint
+ * \param dc_q centre in ADC steps from the midpoint
+ * \return the mean magnitude in ADC steps, 0 for an empty buffer
+ */
+
+double iq_stats_mean_mag(const uint8_t *buf, int len, double dc_i, double dc_q);
+
+/*!
+ * The same numbers the slow and obvious way, in double precision
+ *
+ * To check iq_stats_measure() against.
+ */
+
+void iq_stats_reference(const uint8_t *buf, int len, struct iq_stats *out);
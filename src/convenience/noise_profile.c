@@ -0,0 +1,105 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "noise_profile.h"
+
+/* sanity limits for what a file may claim */
+#define PROFILE_MAX_HOPS	100000
+#define PROFILE_MAX_BINS	(1 << 21)
+
+int noise_profile_alloc(struct noise_profile *p, int hop_count, int bin_count)
+{
+	memset(p, 0, sizeof(struct noise_profile));
+	if (hop_count < 1 || hop_count > PROFILE_MAX_HOPS
+	    || bin_count < 1 || bin_count > PROFILE_MAX_BINS) {
+		return -1;}
+	p->freq = calloc(hop_count, sizeof(int32_t));
+	p->floor = calloc((size_t)hop_count * bin_count, sizeof(float));
+	if (!p->freq || !p->floor) {
+		noise_profile_free(p);
+		return -1;
+	}
+	p->head.magic = NOISE_PROFILE_MAGIC;
+	p->head.version = NOISE_PROFILE_VERSION;
+	p->head.hop_count = (uint32_t)hop_count;
+	p->head.bin_count = (uint32_t)bin_count;
+	return 0;
+}
+
+void noise_profile_free(struct noise_profile *p)
+{
+	free(p->freq);
+	free(p->floor);
+	p->freq = NULL;
+	p->floor = NULL;
+}
+
+int noise_profile_save(const char *path, const struct noise_profile *p)
+{
+	uint32_t i, n;
+	struct noise_profile_hop hop;
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		return -1;}
+	n = p->head.bin_count;
+	fwrite(&p->head, sizeof(p->head), 1, file);
+	for (i=0; i<p->head.hop_count; i++) {
+		memset(&hop, 0, sizeof(hop));
+		hop.freq = p->freq[i];
+		fwrite(&hop, sizeof(hop), 1, file);
+		fwrite(p->floor + (size_t)i * n, sizeof(float), n, file);
+	}
+	if (ferror(file)) {
+		fclose(file);
+		return -1;
+	}
+	return fclose(file) ? -1 : 0;
+}
+
+int noise_profile_load(const char *path, struct noise_profile *p)
+{
+	uint32_t i, n;
+	struct noise_profile_header head;
+	struct noise_profile_hop hop;
+	FILE *file = fopen(path, "rb");
+	memset(p, 0, sizeof(struct noise_profile));
+	if (!file) {
+		return -1;}
+	if (fread(&head, sizeof(head), 1, file) != 1
+	    || head.magic != NOISE_PROFILE_MAGIC
+	    || head.version != NOISE_PROFILE_VERSION
+	    || noise_profile_alloc(p, (int)head.hop_count, (int)head.bin_count) < 0) {
+		fclose(file);
+		return -1;
+	}
+	p->head = head;
+	n = head.bin_count;
+	for (i=0; i<head.hop_count; i++) {
+		if (fread(&hop, sizeof(hop), 1, file) != 1
+		    || fread(p->floor + (size_t)i * n, sizeof(float), n, file) != n) {
+			noise_profile_free(p);
+			fclose(file);
+			return -1;
+		}
+		p->freq[i] = hop.freq;
+	}
+	fclose(file);
+	return 0;
+}
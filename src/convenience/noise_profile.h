@@ -0,0 +1,77 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* per hop, per bin noise floor measured by rtl_power -N
+ *
+ * A file is a noise_profile_header, then for every hop a
+ * noise_profile_hop followed by bin_count floats.  The floats are the
+ * mean power per Hz that rtl_power takes the log of, in FFT order with
+ * DC first.  Host byte order, the magic tells.
+ * */
+
+#include <stdint.h>
+
+#define NOISE_PROFILE_MAGIC	0x464e5452	/* "RTNF" on little endian */
+#define NOISE_PROFILE_VERSION	1
+
+struct noise_profile_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t hop_count;
+	uint32_t bin_count;
+	uint32_t rate;
+	int32_t downsample;
+	int32_t gain;		/* tenths of a dB, -100 for auto */
+	uint32_t reserved2;
+};
+
+struct noise_profile_hop
+{
+	int32_t freq;
+	uint32_t reserved;
+};
+
+struct noise_profile
+{
+	struct noise_profile_header head;
+	int32_t *freq;		/* hop_count */
+	float *floor;		/* bin_count per hop */
+};
+
+/*!
+ * Allocate an empty profile, the header is filled in
+ *
+ * \return 0 on success, -1 on allocation failure
+ */
+
+int noise_profile_alloc(struct noise_profile *p, int hop_count, int bin_count);
+
+void noise_profile_free(struct noise_profile *p);
+
+/*!
+ * \return 0 on success, -1 if the file could not be written
+ */
+
+int noise_profile_save(const char *path, const struct noise_profile *p);
+
+/*!
+ * Read a profile written by noise_profile_save()
+ *
+ * \return 0 on success, -1 if unreadable, truncated or not a profile
+ */
+
+int noise_profile_load(const char *path, struct noise_profile *p);
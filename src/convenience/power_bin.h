@@ -0,0 +1,54 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* binary rtl_power output
+ *
+ * A file is a sequence of records, one per hop and report.  Each record
+ * is a power_bin_record followed by bin_count values and zero padding up
+ * to record_len, a multiple of 8.  Within one run every record has the
+ * same length, so record n starts at n * record_len and files can be
+ * mapped and bisected by time.  Host byte order, the magic tells.
+ *
+ * The values are the CSV dB columns without the trailing repeat of the
+ * last bin.
+ * */
+
+#include <stdint.h>
+
+#define POWER_BIN_MAGIC		0x57505452	/* "RTPW" on little endian */
+#define POWER_BIN_VERSION	1
+
+enum power_bin_format {
+	POWER_BIN_FLOAT32 = 0,	/* dB as float */
+	POWER_BIN_CENTI_DB = 1	/* dB * 100 as int16_t */
+};
+
+/* int16 value standing for no power (-inf dB) */
+#define POWER_BIN_NO_POWER	INT16_MIN
+
+struct power_bin_record
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t format;	/* enum power_bin_format */
+	uint32_t record_len;	/* bytes, header and padded bins */
+	uint32_t bin_count;
+	int64_t time;		/* seconds since the epoch */
+	int32_t hz_low;
+	int32_t hz_high;
+	double hz_step;
+	int32_t samples;
+	uint32_t reserved;
+};
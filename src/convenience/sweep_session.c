@@ -0,0 +1,271 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtl-sdr.h"
+#include "convenience.h"
+#include "hop_plan.h"
+#include "hop_timing.h"
+#include "sweep_session.h"
+
+#define ARENA_ALIGN	SWEEP_ARENA_ALIGN
+#define ALIGN_UP(x)	(((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+#define DEFAULT_FREQ	1000000000
+#define DEFAULT_RATE	2048000
+#define DEFAULT_BUF_LEN	16384
+
+struct sweep_session *sweep_session_new(void)
+{
+	return calloc(1, sizeof(struct sweep_session));
+}
+
+void sweep_session_free(struct sweep_session *s)
+{
+	if (!s) {
+		return;}
+	sweep_session_close(s);
+	free(s->hops);
+	free(s->order);
+	free(s->arena);
+	if (s->timing) {
+		hop_timing_free(s->timing);}
+	free(s->timing);
+	free(s);
+}
+
+int sweep_session_open(struct sweep_session *s, int dev_index)
+{
+	if (s->dev || dev_index < 0) {
+		return -1;}
+	if (rtlsdr_open(&s->dev, (uint32_t)dev_index) < 0) {
+		s->dev = NULL;
+		return -1;
+	}
+	s->applied_valid = 0;
+	return 0;
+}
+
+void sweep_session_close(struct sweep_session *s)
+{
+	if (s->dev) {
+		rtlsdr_close(s->dev);}
+	s->dev = NULL;
+	s->applied_valid = 0;
+}
+
+void sweep_hop_defaults(struct sweep_hop *hop)
+{
+	memset(hop, 0, sizeof(struct sweep_hop));
+	hop->freq = DEFAULT_FREQ;
+	hop->rate = DEFAULT_RATE;
+	hop->gain = SWEEP_AUTO_GAIN;
+	hop->buf_len = DEFAULT_BUF_LEN;
+}
+
+int sweep_session_add_hop(struct sweep_session *s)
+{
+	struct sweep_hop *hops;
+	int alloc;
+	if (s->hop_count == s->hop_alloc) {
+		alloc = s->hop_alloc ? 2 * s->hop_alloc : 16;
+		hops = realloc(s->hops, alloc * sizeof(struct sweep_hop));
+		if (!hops) {
+			return -1;}
+		s->hops = hops;
+		s->hop_alloc = alloc;
+	}
+	sweep_hop_defaults(&s->hops[s->hop_count]);
+	return s->hop_count++;
+}
+
+struct sweep_hop *sweep_session_hop(struct sweep_session *s, int index)
+{
+	if (index < 0 || index >= s->hop_count) {
+		return NULL;}
+	return &s->hops[index];
+}
+
+int sweep_session_arena(struct sweep_session *s, size_t extra)
+{
+	int i;
+	size_t len = 0;
+	for (i=0; i<s->hop_count; i++) {
+		len += ALIGN_UP((size_t)s->hops[i].buf_len);}
+	len += ALIGN_UP(extra);
+	free(s->arena);
+	s->arena = NULL;
+	s->arena_len = s->arena_used = 0;
+	for (i=0; i<s->hop_count; i++) {
+		s->hops[i].buf = NULL;}
+	/* one spare alignment step, malloc only promises 16 */
+	s->arena = calloc(len + ARENA_ALIGN, 1);
+	if (!s->arena) {
+		return -1;}
+	s->arena_len = len + ARENA_ALIGN;
+	s->arena_used = ALIGN_UP((size_t)(uintptr_t)s->arena) - (size_t)(uintptr_t)s->arena;
+	for (i=0; i<s->hop_count; i++) {
+		s->hops[i].buf = s->arena + s->arena_used;
+		s->arena_used += ALIGN_UP((size_t)s->hops[i].buf_len);
+	}
+	return 0;
+}
+
+int sweep_session_timing(struct sweep_session *s)
+{
+	if (s->timing) {
+		hop_timing_free(s->timing);
+	} else {
+		s->timing = malloc(sizeof(struct hop_timing));}
+	if (!s->timing) {
+		return -1;}
+	if (hop_timing_init(s->timing, s->hop_count) < 0) {
+		free(s->timing);
+		s->timing = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void *sweep_session_carve(struct sweep_session *s, size_t len)
+{
+	void *p;
+	len = ALIGN_UP(len);
+	if (!s->arena || len > s->arena_len - s->arena_used) {
+		return NULL;}
+	p = s->arena + s->arena_used;
+	s->arena_used += len;
+	return p;
+}
+
+double sweep_session_plan(struct sweep_session *s)
+{
+	struct hop_key *keys;
+	struct hop_cost cost;
+	int i, *order;
+	double sweep_us;
+	if (!s->dev || s->hop_count < 1) {
+		return -1.0;}
+	keys = calloc(s->hop_count, sizeof(struct hop_key));
+	order = realloc(s->order, s->hop_count * sizeof(int));
+	if (!keys || !order) {
+		free(keys);
+		return -1.0;
+	}
+	s->order = order;
+	for (i=0; i<s->hop_count; i++) {
+		keys[i].freq = (uint32_t)s->hops[i].freq;
+		keys[i].rate = (uint32_t)s->hops[i].rate;
+		keys[i].gain = s->hops[i].gain;
+		keys[i].direct_sampling = s->hops[i].direct_sampling;
+		keys[i].band = rtlsdr_get_tuner_band(s->dev, keys[i].freq);
+	}
+	hop_cost_measure(s->dev, keys, s->hop_count, &cost);
+	sweep_us = hop_plan_order(keys, s->hop_count, &cost, s->order);
+	s->planned = s->hop_count;
+	/* measuring moved the dongle around */
+	s->applied_valid = 0;
+	free(keys);
+	return sweep_us;
+}
+
+int sweep_session_get_hop(struct sweep_session *s, int n)
+{
+	if (n < 0 || n >= s->planned) {
+		return n;}
+	return s->order[n];
+}
+
+int sweep_session_apply(struct sweep_session *s, int index, uint64_t *valid)
+{
+	struct sweep_hop *hop = sweep_session_hop(s, index);
+	struct sweep_hop *last = s->applied_valid ? &s->applied : NULL;
+	int r = 0;
+	uint64_t t0 = 0;
+	if (!hop || !s->dev) {
+		return -1;}
+	if (s->timing) {
+		t0 = hop_timing_now();}
+
+	if (last ? hop->direct_sampling != last->direct_sampling : hop->direct_sampling) {
+		verbose_direct_sampling(s->dev, hop->direct_sampling);
+		/* the tuner was reinitialized */
+		last = NULL;
+	}
+
+	if (hop->offset_tuning && (!last || !last->offset_tuning)) {
+		verbose_offset_tuning(s->dev);
+	}
+
+	/* Set the tuner gain */
+	if (!last || hop->gain != last->gain) {
+		if (hop->gain == SWEEP_AUTO_GAIN) {
+			verbose_auto_gain(s->dev);
+		} else {
+			hop->gain = nearest_gain(s->dev, hop->gain);
+			verbose_gain_set(s->dev, hop->gain);
+		}
+	}
+
+	if (!last || hop->custom_ppm != last->custom_ppm || hop->ppm_error != last->ppm_error) {
+		if (!hop->custom_ppm) {
+			verbose_ppm_eeprom(s->dev, &hop->ppm_error);
+		}
+		verbose_ppm_set(s->dev, hop->ppm_error);
+	}
+
+	/* Reset endpoint before we start reading from it (mandatory) */
+	if (!valid) {
+		verbose_reset_buffer(s->dev);
+	}
+
+	if (!last || hop->rate != last->rate) {
+		rtlsdr_set_sample_rate(s->dev, (uint32_t)hop->rate);
+	}
+
+	/* waits for PLL lock, a sync read also loses the stale samples
+	 * a stream keeps running, only retune when the frequency moves */
+	if (!valid || rtlsdr_get_center_freq(s->dev) != (uint32_t)hop->freq) {
+		r = rtlsdr_set_center_freq_sync(s->dev, (uint32_t)hop->freq, valid);}
+
+	s->applied = *hop;
+	s->applied_valid = 1;
+	if (s->timing) {
+		hop_timing_add(s->timing, index, HOP_TIMING_TUNE, hop_timing_now() - t0);}
+	return r < 0 ? -1 : 0;
+}
+
+int sweep_session_read(struct sweep_session *s, int index, uint8_t *buf)
+{
+	struct sweep_hop *hop = sweep_session_hop(s, index);
+	int r, n_read = 0;
+	uint64_t t0 = 0;
+	if (!hop || !s->dev) {
+		return -1;}
+	if (!buf) {
+		buf = hop->buf;}
+	if (!buf) {
+		return -1;}
+	if (s->timing) {
+		t0 = hop_timing_now();}
+	r = rtlsdr_read_sync(s->dev, buf, hop->buf_len, &n_read);
+	if (s->timing) {
+		hop_timing_add(s->timing, index, HOP_TIMING_READ, hop_timing_now() - t0);}
+	return r < 0 ? -1 : n_read;
+}
@@ -0,0 +1,186 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* a sweep session owns one dongle, its hop plan and the plan's buffers
+ *
+ * Nothing is shared between sessions, each one can run on its own
+ * thread.  A single session is not locked, keep it to one thread.
+ * Include rtl-sdr.h first.
+ * */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SWEEP_AUTO_GAIN	-100
+#define SWEEP_ARENA_ALIGN	32  /* bytes, hop buffers and carved blocks */
+
+struct hop_timing;
+
+struct sweep_hop
+/* what one hop asks of the dongle */
+{
+	int freq;  /* tuned frequency */
+	int rate;
+	int gain;  /* tenths of a dB, or SWEEP_AUTO_GAIN */
+	int direct_sampling;
+	int offset_tuning;
+	int ppm_error;
+	int custom_ppm;  /* else ppm_error is read from the eeprom */
+	int buf_len;  /* bytes per visit */
+	uint8_t *buf;  /* in the arena, NULL until sweep_session_arena() */
+};
+
+struct sweep_session
+{
+	rtlsdr_dev_t *dev;
+	struct sweep_hop *hops;
+	int hop_count;
+	int hop_alloc;
+	int *order;  /* sweep order of the planned hops */
+	int planned;
+	struct sweep_hop applied;  /* what the dongle was last given */
+	int applied_valid;
+	uint8_t *arena;
+	size_t arena_len;
+	size_t arena_used;
+	struct hop_timing *timing;  /* NULL, else apply and read log their time */
+};
+
+/*!
+ * Create an empty session
+ *
+ * \return the session, NULL on allocation failure
+ */
+
+struct sweep_session *sweep_session_new(void);
+
+/*!
+ * Close the device if open and free everything the session owns
+ */
+
+void sweep_session_free(struct sweep_session *s);
+
+/*!
+ * Open a device for the session
+ *
+ * \param s the session
+ * \param dev_index as from verbose_device_search()
+ * \return 0 on success, -1 if no device could be opened
+ */
+
+int sweep_session_open(struct sweep_session *s, int dev_index);
+
+void sweep_session_close(struct sweep_session *s);
+
+/*!
+ * 1GHz at 2.048MS/s, auto gain, 16k bytes per visit, no buffer
+ */
+
+void sweep_hop_defaults(struct sweep_hop *hop);
+
+/*!
+ * Append a hop with default settings
+ *
+ * Pointers into the hop table change when it grows, ask for them again.
+ *
+ * \return index of the new hop, -1 on allocation failure
+ */
+
+int sweep_session_add_hop(struct sweep_session *s);
+
+/*!
+ * \return the hop, NULL if index is out of range
+ */
+
+struct sweep_hop *sweep_session_hop(struct sweep_session *s, int index);
+
+/*!
+ * Allocate the arena for the current plan
+ *
+ * One block holds buf_len bytes for every hop and extra bytes for
+ * sweep_session_carve().  Calling it again drops the old block and
+ * everything carved out of it.
+ *
+ * \param s the session
+ * \param extra bytes to keep for sweep_session_carve()
+ * \return 0 on success, -1 on allocation failure
+ */
+
+int sweep_session_arena(struct sweep_session *s, size_t extra);
+
+/*!
+ * Start timing apply and read, see hop_timing.h
+ *
+ * Every hop so far gets a row, later ones share the last.  Calling it
+ * again starts over.
+ *
+ * \return 0 on success, -1 on allocation failure
+ */
+
+int sweep_session_timing(struct sweep_session *s);
+
+/*!
+ * Hand out zeroed, aligned memory from the arena
+ *
+ * Every block takes len rounded up to SWEEP_ARENA_ALIGN.
+ *
+ * \return len bytes, NULL once the extra room is used up
+ */
+
+void *sweep_session_carve(struct sweep_session *s, size_t len);
+
+/*!
+ * Order the hops for the cheapest repeated sweep
+ *
+ * Times the device for the cost model, see hop_plan.h.
+ *
+ * \return modelled retune time of one sweep in microseconds,
+ *         -1.0 without a device or hops
+ */
+
+double sweep_session_plan(struct sweep_session *s);
+
+/*!
+ * \return the hop to visit n-th, n itself for hops outside the plan
+ */
+
+int sweep_session_get_hop(struct sweep_session *s, int n);
+
+/*!
+ * Give the dongle the settings of a hop
+ *
+ * Only what differs from the last applied hop is written.  With valid
+ * NULL the device is read synchronously and the buffer gets reset.
+ * With a running stream pass valid, it receives the sample index from
+ * which the new frequency has settled, see rtlsdr_set_center_freq_sync().
+ *
+ * \param s the session
+ * \param index hop to apply
+ * \param valid NULL or first settled sample for stream reads
+ * \return 0 on success, -1 on a bad index or a failed retune
+ */
+
+int sweep_session_apply(struct sweep_session *s, int index, uint64_t *valid);
+
+/*!
+ * Read one visit worth of samples synchronously
+ *
+ * \param s the session
+ * \param index the hop, for buf_len
+ * \param buf room for buf_len bytes, NULL reads into the hop buffer
+ * \return bytes read, -1 on error
+ */
+
+int sweep_session_read(struct sweep_session *s, int index, uint8_t *buf);
@@ -22,12 +22,15 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/mman.h>
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
 #include <libusb.h>
+#include <pthread.h>
 
 /*
  * All libusb callback functions should be marked with the LIBUSB_CALL macro
@@ -39,6 +42,12 @@
 #define LIBUSB_CALL
 #endif
 
+/* usbfs can map transfer buffers into user space since libusb 1.0.21 */
+#if defined(__linux__) && defined(LIBUSB_API_VERSION) && \
+    (LIBUSB_API_VERSION >= 0x01000105)
+#define HAVE_LIBUSB_DEV_MEM
+#endif
+
 /* two raised to the power of n */
 #define TWO_POW(n)		((double)(1ULL<<(n)))
 
@@ -66,6 +75,54 @@ enum rtlsdr_async_status {
 	RTLSDR_RUNNING
 };
 
+/*
+ * Lock-free index access for the single-producer/single-consumer
+ * stream ring: stores publish, loads observe what has been published.
+ */
+#if defined(__GNUC__)
+#define RING_LOAD(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define RING_LOAD(p)		(MemoryBarrier(), *(p))
+#define RING_STORE(p, v)	do { MemoryBarrier(); *(p) = (v); } while (0)
+#endif
+
+/* seqlock payload, may tear but must not be a data race */
+#if defined(__GNUC__)
+#define SEQ_LOAD(p)		__atomic_load_n((p), __ATOMIC_RELAXED)
+#define SEQ_STORE(p, v)		__atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define SEQ_LOAD(p)		(*(volatile uint64_t *)(p))
+#define SEQ_STORE(p, v)		(*(volatile uint64_t *)(p) = (v))
+#endif
+
+/* full barrier, orders a store before a later load */
+#if defined(__GNUC__)
+#define RING_FENCE()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define RING_FENCE()		MemoryBarrier()
+#endif
+
+/* block flags are raised by API calls and collected by the event thread */
+#if defined(__GNUC__)
+#define FLAGS_RAISE(p, v)	__atomic_fetch_or((p), (v), __ATOMIC_RELAXED)
+#define FLAGS_TAKE(p)		__atomic_exchange_n((p), 0, __ATOMIC_ACQ_REL)
+#else
+#define FLAGS_RAISE(p, v)	InterlockedOr((volatile LONG *)(p), (v))
+#define FLAGS_TAKE(p)		InterlockedExchange((volatile LONG *)(p), 0)
+#endif
+
+/* control transfers complete on whichever thread handles libusb events */
+#if defined(__GNUC__)
+#define COUNT_ADD(p, v)		__atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#define ERROR_KEEP(p, v)	do { int _z = 0; \
+	__atomic_compare_exchange_n((p), &_z, (v), 0, __ATOMIC_ACQ_REL, \
+				    __ATOMIC_ACQUIRE); } while (0)
+#else
+#define COUNT_ADD(p, v)		InterlockedAdd((volatile LONG *)(p), (v))
+#define ERROR_KEEP(p, v)	InterlockedCompareExchange((volatile LONG *)(p), (v), 0)
+#endif
+
 #define FIR_LEN 16
 
 /*
@@ -86,6 +143,11 @@ static const int fir_default[FIR_LEN] = {
 	101, 156, 215, 273, 327, 372, 404, 421	/* 12 bit signed */
 };
 
+struct rtlsdr_ctrl_req {
+	struct libusb_transfer *xfer;
+	unsigned char buf[LIBUSB_CONTROL_SETUP_SIZE + 256];
+};
+
 struct rtlsdr_dev {
 	libusb_context *ctx;
 	struct libusb_device_handle *devh;
@@ -93,10 +155,23 @@ struct rtlsdr_dev {
 	uint32_t xfer_buf_len;
 	struct libusb_transfer **xfer;
 	unsigned char **xfer_buf;
+	/* transfer buffer pool, kept across rtlsdr_read_async() calls */
+	uint32_t pool_num;
+	uint32_t pool_len;
+	int use_zerocopy;
+	unsigned char *pool_arena;
+	size_t pool_arena_len;
 	rtlsdr_read_async_cb_t cb;
+	rtlsdr_read_async_ex_cb_t cb_ex;
 	void *cb_ctx;
 	enum rtlsdr_async_status async_status;
 	int async_cancel;
+	uint64_t sample_count; /* I/Q pairs since the start of streaming */
+	uint32_t block_flags; /* pending for the next block */
+	/* sample clock, where the last block ended and when it arrived */
+	uint32_t clock_seq; /* odd while the event thread updates it */
+	uint64_t clock_index;
+	uint64_t clock_us;
 	/* rtl demod context */
 	uint32_t rate; /* Hz */
 	uint32_t rtl_xtal; /* Hz */
@@ -117,9 +192,42 @@ struct rtlsdr_dev {
 	int dev_lost;
 	int driver_active;
 	unsigned int xfer_errors;
+	/* control transaction, see rtlsdr_ctrl_begin() */
+	struct rtlsdr_ctrl_req *ctrl_queue;
+	int ctrl_depth;
+	int ctrl_count;
+	int ctrl_pending; /* atomic, shared with the event thread */
+	int ctrl_done;
+	int ctrl_error;
+	uint64_t ctrl_start; /* us */
+	uint32_t ctrl_transfers;
+	uint32_t ctrl_round_trips;
+	rtlsdr_ctrl_stats_t ctrl_stats;
+	/* file replay */
+	FILE *replay_file;
+	char *replay_name;
+	int replay_flags;
+	uint64_t replay_bytes; /* delivered since replay_start */
+	uint64_t replay_start; /* us */
+	/* pull-style streaming */
+	struct libusb_transfer **stream_ring;
+	rtlsdr_block_info_t *stream_info; /* parallel to stream_ring */
+	uint32_t stream_size; /* ring slots, one more than buffers */
+	uint32_t stream_head; /* filled by the event thread */
+	uint32_t stream_tail; /* released by the consumer */
+	uint32_t stream_next; /* next slot to acquire */
+	int stream_active;
+	int stream_waiting; /* the consumer sleeps on stream_cond */
+	uint32_t stream_overruns;
+	int stream_result;
+	pthread_t stream_thread;
+	pthread_mutex_t stream_lock;
+	pthread_cond_t stream_cond;
 };
 
 void rtlsdr_set_gpio_bit(rtlsdr_dev_t *dev, uint8_t gpio, int val);
+static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev);
+static void _rtlsdr_ctrl_free(rtlsdr_dev_t *dev);
 
 /* generic tuner interface functions, shall be moved to the tuner implementations */
 int e4000_init(void *dev) {
@@ -242,6 +350,15 @@ int r820t_set_gain_mode(void *dev, int manual) {
 	return r82xx_set_gain(&devt->r82xx_p, manual, 0);
 }
 
+/* the replay device accepts every setting, samples come from a file */
+static int replay_init(void *dev) { return 0; }
+static int replay_exit(void *dev) { return 0; }
+static int replay_set_freq(void *dev, uint32_t freq) { return 0; }
+static int replay_set_bw(void *dev, int bw) { return 0; }
+static int replay_set_gain(void *dev, int gain) { return 0; }
+static int replay_set_if_gain(void *dev, int stage, int gain) { return 0; }
+static int replay_set_gain_mode(void *dev, int manual) { return 0; }
+
 /* definition order must match enum rtlsdr_tuner */
 static rtlsdr_tuner_iface_t tuners[] = {
 	{
@@ -279,6 +396,12 @@ static rtlsdr_tuner_iface_t tuners[] = {
 	},
 };
 
+static rtlsdr_tuner_iface_t replay_tuner = {
+	replay_init, replay_exit,
+	replay_set_freq, replay_set_bw, replay_set_gain, replay_set_if_gain,
+	replay_set_gain_mode
+};
+
 typedef struct rtlsdr_dongle {
 	uint16_t vid;
 	uint16_t pid;
@@ -335,6 +458,14 @@ static rtlsdr_dongle_t known_devices[] = {
 #define DEFAULT_BUF_NUMBER	32
 #define DEFAULT_BUF_LENGTH	(16 * 32 * 512)
 
+/* settling time for tuners which cannot report PLL lock */
+#define RETUNE_SETTLE_US	5000
+/* USB completion latency and RTL2832 filter delay after a retune */
+#define RETUNE_GUARD_US		500
+
+/* transfers kept in flight when the stream consumer falls behind */
+#define STREAM_MIN_INFLIGHT	2
+
 #define DEF_RTL_XTAL_FREQ	28800000
 #define MIN_RTL_XTAL_FREQ	(DEF_RTL_XTAL_FREQ - 1000)
 #define MAX_RTL_XTAL_FREQ	(DEF_RTL_XTAL_FREQ + 1000)
@@ -342,6 +473,8 @@ static rtlsdr_dongle_t known_devices[] = {
 #define CTRL_IN		(LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN)
 #define CTRL_OUT	(LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_OUT)
 #define CTRL_TIMEOUT	300
+/* control transfers queued per transaction before it is flushed */
+#define CTRL_QUEUE_LEN	64
 #define BULK_TIMEOUT	0
 
 #define EEPROM_ADDR	0xa0
@@ -383,12 +516,372 @@ enum blocks {
 	IICB			= 6,
 };
 
+static uint64_t rtlsdr_monotonic_us(void)
+{
+#ifdef _WIN32
+	return (uint64_t)GetTickCount64() * 1000;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/*
+ * The sample clock is a seqlock, so that the event thread never blocks
+ * on a retune. Only one thread writes it at any time.
+ */
+static void _rtlsdr_clock_set(rtlsdr_dev_t *dev, uint64_t index, uint64_t us)
+{
+	uint32_t seq = dev->clock_seq;
+
+	RING_STORE(&dev->clock_seq, seq + 1);
+	RING_FENCE();
+	SEQ_STORE(&dev->clock_index, index);
+	SEQ_STORE(&dev->clock_us, us);
+	RING_STORE(&dev->clock_seq, seq + 2);
+}
+
+static void _rtlsdr_clock_get(rtlsdr_dev_t *dev, uint64_t *index, uint64_t *us)
+{
+	uint32_t seq;
+
+	do {
+		seq = RING_LOAD(&dev->clock_seq);
+		*index = SEQ_LOAD(&dev->clock_index);
+		*us = SEQ_LOAD(&dev->clock_us);
+		RING_FENCE();
+	} while ((seq & 1) || seq != RING_LOAD(&dev->clock_seq));
+}
+
+/*
+ * File replay, a virtual device which reads recorded samples
+ */
+
+static const char *replay_env_file(void)
+{
+	const char *name = getenv("RTLSDR_REPLAY_FILE");
+
+	return (name && name[0]) ? name : NULL;
+}
+
+static int replay_env_flags(void)
+{
+	const char *val;
+	int flags = RTLSDR_REPLAY_FAST;
+
+	val = getenv("RTLSDR_REPLAY_PACED");
+	if (val && atoi(val))
+		flags |= RTLSDR_REPLAY_PACED;
+
+	val = getenv("RTLSDR_REPLAY_LOOP");
+	if (val && atoi(val))
+		flags |= RTLSDR_REPLAY_LOOP;
+
+	return flags;
+}
+
+static void replay_strings(const char *name, char *manufact, char *product,
+			   char *serial)
+{
+	const int buf_max = 256;
+
+	if (manufact) {
+		memset(manufact, 0, buf_max);
+		strncpy(manufact, "rtl-sdr", buf_max - 1);
+	}
+
+	if (product) {
+		memset(product, 0, buf_max);
+		strncpy(product, "File replay", buf_max - 1);
+	}
+
+	/* the file name doubles as serial, so -d can match it */
+	if (serial) {
+		memset(serial, 0, buf_max);
+		strncpy(serial, name, buf_max - 1);
+	}
+}
+
+static void replay_reset_clock(rtlsdr_dev_t *dev)
+{
+	dev->replay_bytes = 0;
+	dev->replay_start = rtlsdr_monotonic_us();
+}
+
+static int replay_read(rtlsdr_dev_t *dev, unsigned char *buf, int len)
+{
+	int n = 0, r, rewound = 0;
+	uint64_t due, now;
+
+	while (n < len) {
+		r = (int)fread(buf + n, 1, len - n, dev->replay_file);
+		n += r;
+
+		if (n == len)
+			break;
+
+		/* end of file, an empty file must not loop forever */
+		if (!(dev->replay_flags & RTLSDR_REPLAY_LOOP) ||
+		    ferror(dev->replay_file) || (rewound && !r))
+			break;
+
+		if (fseek(dev->replay_file, 0, SEEK_SET))
+			break;
+
+		rewound = 1;
+	}
+
+	if (!(dev->replay_flags & RTLSDR_REPLAY_PACED) || !dev->rate)
+		return n;
+
+	/* two bytes per sample, sleep until the data is due */
+	dev->replay_bytes += n;
+	due = dev->replay_start + dev->replay_bytes * 500000 / dev->rate;
+	now = rtlsdr_monotonic_us();
+
+	if (due > now) {
+#ifdef _WIN32
+		Sleep((DWORD)((due - now) / 1000));
+#else
+		usleep((useconds_t)(due - now));
+#endif
+	}
+
+	return n;
+}
+
+static void LIBUSB_CALL _libusb_ctrl_callback(struct libusb_transfer *xfer)
+{
+	rtlsdr_dev_t *dev = (rtlsdr_dev_t *)xfer->user_data;
+
+	if (LIBUSB_TRANSFER_COMPLETED != xfer->status)
+		ERROR_KEEP(&dev->ctrl_error,
+			   (LIBUSB_TRANSFER_TIMED_OUT == xfer->status) ?
+			   LIBUSB_ERROR_TIMEOUT : LIBUSB_ERROR_IO);
+	else if (xfer->actual_length + (int)LIBUSB_CONTROL_SETUP_SIZE !=
+		 xfer->length)
+		ERROR_KEEP(&dev->ctrl_error, LIBUSB_ERROR_IO);
+
+	if (COUNT_ADD(&dev->ctrl_pending, -1) == 0)
+		RING_STORE(&dev->ctrl_done, 1);
+}
+
+/*
+ * Submit all queued requests back to back and wait for the last one.
+ * The queue slots are reused afterwards, so every submitted request must
+ * have called back before this returns, whatever went wrong on the way.
+ */
+static int _rtlsdr_ctrl_flush(rtlsdr_dev_t *dev)
+{
+	struct timeval tv = { 1, 0 };
+	int i, r, count, submitted, cancelled = 0;
+
+	count = dev->ctrl_count;
+	if (!count)
+		return 0;
+
+	/* callbacks may run on the event thread before the loop ends */
+	RING_STORE(&dev->ctrl_done, 0);
+	RING_STORE(&dev->ctrl_pending, count);
+
+	for (submitted = 0; submitted < count; ++submitted) {
+		r = libusb_submit_transfer(dev->ctrl_queue[submitted].xfer);
+		if (r < 0) {
+			ERROR_KEEP(&dev->ctrl_error, r);
+			break;
+		}
+	}
+
+	/* requests that never went out will not call back */
+	if (submitted < count &&
+	    COUNT_ADD(&dev->ctrl_pending, submitted - count) == 0)
+		RING_STORE(&dev->ctrl_done, 1);
+
+	dev->ctrl_count = 0;
+	dev->ctrl_round_trips++;
+
+	/* endpoint 0 completes in order, the queue drains front to back */
+	while (RING_LOAD(&dev->ctrl_pending) > 0) {
+#ifdef HAVE_LIBUSB_HANDLE_EVENTS_TIMEOUT_COMPLETED
+		r = libusb_handle_events_timeout_completed(dev->ctx, &tv,
+							   &dev->ctrl_done);
+#else
+		r = libusb_handle_events_timeout(dev->ctx, &tv);
+#endif
+		if (r < 0 && r != LIBUSB_ERROR_INTERRUPTED && !cancelled) {
+			/* cancelled requests still complete through the callback */
+			for (i = 0; i < submitted; ++i)
+				libusb_cancel_transfer(dev->ctrl_queue[i].xfer);
+			ERROR_KEEP(&dev->ctrl_error, r);
+			cancelled = 1;
+		}
+	}
+
+	return RING_LOAD(&dev->ctrl_error);
+}
+
+static int _rtlsdr_ctrl_queue(rtlsdr_dev_t *dev, uint8_t type, uint16_t value,
+			      uint16_t index, const unsigned char *data,
+			      uint16_t len)
+{
+	struct rtlsdr_ctrl_req *req;
+	int r;
+
+	if (dev->ctrl_count == CTRL_QUEUE_LEN) {
+		r = _rtlsdr_ctrl_flush(dev);
+		if (r < 0)
+			return r;
+	}
+
+	req = &dev->ctrl_queue[dev->ctrl_count++];
+	libusb_fill_control_setup(req->buf, type, 0, value, index, len);
+	if (type == CTRL_OUT)
+		memcpy(req->buf + LIBUSB_CONTROL_SETUP_SIZE, data, len);
+	libusb_fill_control_transfer(req->xfer, dev->devh, req->buf,
+				     _libusb_ctrl_callback, dev, CTRL_TIMEOUT);
+	dev->ctrl_transfers++;
+
+	return len;
+}
+
+/* a NULL buffer on CTRL_IN reads and discards, which may be queued too */
+static int rtlsdr_ctrl_transfer(rtlsdr_dev_t *dev, uint8_t type, uint16_t value,
+				uint16_t index, unsigned char *data, uint16_t len)
+{
+	unsigned char scratch[2];
+	int r;
+
+	if (dev->replay_file) {
+		/* there is no hardware behind a replay device */
+		if (type == CTRL_IN && data)
+			memset(data, 0, len);
+		return len;
+	}
+
+	if (dev->ctrl_depth) {
+		if (type == CTRL_OUT || !data)
+			return _rtlsdr_ctrl_queue(dev, type, value, index,
+						  data, len);
+
+		/* the caller needs the result, earlier writes go first */
+		r = _rtlsdr_ctrl_flush(dev);
+		if (r < 0)
+			return r;
+
+		dev->ctrl_transfers++;
+		dev->ctrl_round_trips++;
+	}
+
+	if (!data) {
+		data = scratch;
+		if (len > sizeof(scratch))
+			len = sizeof(scratch);
+	}
+
+	return libusb_control_transfer(dev->devh, type, 0, value, index, data, len, CTRL_TIMEOUT);
+}
+
+int rtlsdr_ctrl_begin(rtlsdr_dev_t *dev)
+{
+	int i;
+
+	if (!dev)
+		return -1;
+
+	if (dev->replay_file)
+		return 0;
+
+	if (!dev->ctrl_queue) {
+		dev->ctrl_queue = calloc(CTRL_QUEUE_LEN,
+					 sizeof(struct rtlsdr_ctrl_req));
+		if (!dev->ctrl_queue)
+			return -ENOMEM;
+
+		for (i = 0; i < CTRL_QUEUE_LEN; ++i) {
+			dev->ctrl_queue[i].xfer = libusb_alloc_transfer(0);
+			if (!dev->ctrl_queue[i].xfer) {
+				/* a later begin must not find a partial queue */
+				_rtlsdr_ctrl_free(dev);
+				return -ENOMEM;
+			}
+		}
+	}
+
+	if (dev->ctrl_depth++)
+		return 0;
+
+	dev->ctrl_count = 0;
+	dev->ctrl_error = 0;
+	dev->ctrl_transfers = 0;
+	dev->ctrl_round_trips = 0;
+	dev->ctrl_start = rtlsdr_monotonic_us();
+
+	return 0;
+}
+
+int rtlsdr_ctrl_commit(rtlsdr_dev_t *dev)
+{
+	uint64_t elapsed;
+	int r;
+
+	if (!dev)
+		return -1;
+
+	if (dev->replay_file)
+		return 0;
+
+	if (dev->ctrl_depth <= 0)
+		return -2;
+
+	if (--dev->ctrl_depth)
+		return 0;
+
+	r = _rtlsdr_ctrl_flush(dev);
+
+	elapsed = rtlsdr_monotonic_us() - dev->ctrl_start;
+	dev->ctrl_stats.transactions++;
+	dev->ctrl_stats.total_us += elapsed;
+	dev->ctrl_stats.last_us = elapsed;
+	dev->ctrl_stats.last_transfers = dev->ctrl_transfers;
+	dev->ctrl_stats.last_round_trips = dev->ctrl_round_trips;
+
+	return r;
+}
+
+int rtlsdr_get_ctrl_stats(rtlsdr_dev_t *dev, rtlsdr_ctrl_stats_t *stats)
+{
+	if (!dev || !stats)
+		return -1;
+
+	*stats = dev->ctrl_stats;
+
+	return 0;
+}
+
+static void _rtlsdr_ctrl_free(rtlsdr_dev_t *dev)
+{
+	int i;
+
+	if (!dev->ctrl_queue)
+		return;
+
+	for (i = 0; i < CTRL_QUEUE_LEN; ++i) {
+		if (dev->ctrl_queue[i].xfer)
+			libusb_free_transfer(dev->ctrl_queue[i].xfer);
+	}
+
+	free(dev->ctrl_queue);
+	dev->ctrl_queue = NULL;
+}
+
 int rtlsdr_read_array(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uint8_t *array, uint8_t len)
 {
 	int r;
 	uint16_t index = (block << 8);
 
-	r = libusb_control_transfer(dev->devh, CTRL_IN, 0, addr, index, array, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_IN, addr, index, array, len);
 #if 0
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -401,7 +894,7 @@ int rtlsdr_write_array(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uint8_t
 	int r;
 	uint16_t index = (block << 8) | 0x10;
 
-	r = libusb_control_transfer(dev->devh, CTRL_OUT, 0, addr, index, array, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_OUT, addr, index, array, len);
 #if 0
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -457,7 +950,7 @@ uint16_t rtlsdr_read_reg(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uint8_
 	uint16_t index = (block << 8);
 	uint16_t reg;
 
-	r = libusb_control_transfer(dev->devh, CTRL_IN, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_IN, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -481,7 +974,7 @@ int rtlsdr_write_reg(rtlsdr_dev_t *dev, uint8_t block, uint16_t addr, uint16_t v
 
 	data[1] = val & 0xff;
 
-	r = libusb_control_transfer(dev->devh, CTRL_OUT, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_OUT, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -498,7 +991,7 @@ uint16_t rtlsdr_demod_read_reg(rtlsdr_dev_t *dev, uint8_t page, uint16_t addr, u
 	uint16_t reg;
 	addr = (addr << 8) | 0x20;
 
-	r = libusb_control_transfer(dev->devh, CTRL_IN, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_IN, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
@@ -522,12 +1015,13 @@ int rtlsdr_demod_write_reg(rtlsdr_dev_t *dev, uint8_t page, uint16_t addr, uint1
 
 	data[1] = val & 0xff;
 
-	r = libusb_control_transfer(dev->devh, CTRL_OUT, 0, addr, index, data, len, CTRL_TIMEOUT);
+	r = rtlsdr_ctrl_transfer(dev, CTRL_OUT, addr, index, data, len);
 
 	if (r < 0)
 		fprintf(stderr, "%s failed with %d\n", __FUNCTION__, r);
 
-	rtlsdr_demod_read_reg(dev, 0x0a, 0x01, 1);
+	/* dummy read of page 0x0a register 0x01, can be queued */
+	rtlsdr_ctrl_transfer(dev, CTRL_IN, (0x01 << 8) | 0x20, 0x0a, NULL, 1);
 
 	return (r == len) ? 0 : -1;
 }
@@ -766,6 +1260,11 @@ int rtlsdr_get_usb_strings(rtlsdr_dev_t *dev, char *manufact, char *product,
 	const int buf_max = 256;
 	int r = 0;
 
+	if (dev && dev->replay_file) {
+		replay_strings(dev->replay_name, manufact, product, serial);
+		return 0;
+	}
+
 	if (!dev || !dev->devh)
 		return -1;
 
@@ -864,11 +1363,14 @@ int rtlsdr_read_eeprom(rtlsdr_dev_t *dev, uint8_t *data, uint8_t offset, uint16_
 
 int rtlsdr_set_center_freq(rtlsdr_dev_t *dev, uint32_t freq)
 {
-	int r = -1;
+	int r = -1, batched;
 
 	if (!dev || !dev->tuner)
 		return -1;
 
+	/* without a queue the writes go out one by one, which is fine */
+	batched = !rtlsdr_ctrl_begin(dev);
+
 	if (dev->direct_sampling) {
 		r = rtlsdr_set_if_freq(dev, freq);
 	} else if (dev->tuner && dev->tuner->set_freq) {
@@ -877,11 +1379,76 @@ int rtlsdr_set_center_freq(rtlsdr_dev_t *dev, uint32_t freq)
 		rtlsdr_set_i2c_repeater(dev, 0);
 	}
 
+	if (batched && rtlsdr_ctrl_commit(dev) < 0 && !r)
+		r = -1;
+
 	if (!r)
 		dev->freq = freq;
 	else
 		dev->freq = 0;
 
+	FLAGS_RAISE(&dev->block_flags, RTLSDR_BLOCK_RETUNED);
+
+	return r;
+}
+
+static int _rtlsdr_tuner_locked(rtlsdr_dev_t *dev)
+{
+	if (dev->replay_file || dev->direct_sampling)
+		return 1;
+
+	switch (dev->tuner_type) {
+	case RTLSDR_TUNER_E4000:
+		/* fails set_freq unless the PLL has locked */
+		return 1;
+	case RTLSDR_TUNER_R820T:
+	case RTLSDR_TUNER_R828D:
+		return dev->r82xx_p.has_lock;
+	default:
+		return 0;
+	}
+}
+
+int rtlsdr_set_center_freq_sync(rtlsdr_dev_t *dev, uint32_t freq,
+				uint64_t *sample_index)
+{
+	uint64_t index, now, clock_us;
+	int r;
+
+	if (!dev)
+		return -1;
+
+	r = rtlsdr_set_center_freq(dev, freq);
+	if (r)
+		return r;
+
+	/* no lock indication, give the tuner time to settle */
+	if (!_rtlsdr_tuner_locked(dev)) {
+#ifdef _WIN32
+		Sleep(RETUNE_SETTLE_US / 1000);
+#else
+		usleep(RETUNE_SETTLE_US);
+#endif
+	}
+
+	/* the stream thread may not have reached RUNNING yet */
+	if (!dev->stream_ring && RTLSDR_INACTIVE == dev->async_status) {
+		/* synchronous reads, drop whatever was sampled until now */
+		r = rtlsdr_reset_buffer(dev);
+		index = dev->sample_count;
+	} else {
+		/* extrapolate the sample clock from the last block */
+		now = rtlsdr_monotonic_us() + RETUNE_GUARD_US;
+
+		_rtlsdr_clock_get(dev, &index, &clock_us);
+		/* recorded data has no settling, the next block is valid */
+		if (!dev->replay_file && now > clock_us)
+			index += (now - clock_us) * dev->rate / 1000000;
+	}
+
+	if (sample_index)
+		*sample_index = index;
+
 	return r;
 }
 
@@ -934,31 +1501,65 @@ enum rtlsdr_tuner rtlsdr_get_tuner_type(rtlsdr_dev_t *dev)
 	return dev->tuner_type;
 }
 
-int rtlsdr_get_tuner_gains(rtlsdr_dev_t *dev, int *gains)
+int rtlsdr_get_tuner_cache_stats(rtlsdr_dev_t *dev, uint32_t *hits,
+				 uint32_t *misses)
 {
-	/* all gain values are expressed in tenths of a dB */
-	const int e4k_gains[] = { -10, 15, 40, 65, 90, 115, 140, 165, 190, 215,
-				  240, 290, 340, 420 };
-	const int fc0012_gains[] = { -99, -40, 71, 179, 192 };
-	const int fc0013_gains[] = { -99, -73, -65, -63, -60, -58, -54, 58, 61,
-				       63, 65, 67, 68, 70, 71, 179, 181, 182,
-				       184, 186, 188, 191, 197 };
-	const int fc2580_gains[] = { 0 /* no gain values */ };
-	const int r82xx_gains[] = { 0, 9, 14, 27, 37, 77, 87, 125, 144, 157,
-				     166, 197, 207, 229, 254, 280, 297, 328,
-				     338, 364, 372, 386, 402, 421, 434, 439,
-				     445, 480, 496 };
-	const int unknown_gains[] = { 0 /* no gain values */ };
-
-	const int *ptr = NULL;
-	int len = 0;
-
 	if (!dev)
 		return -1;
 
 	switch (dev->tuner_type) {
-	case RTLSDR_TUNER_E4000:
-		ptr = e4k_gains; len = sizeof(e4k_gains);
+	case RTLSDR_TUNER_R820T:
+	case RTLSDR_TUNER_R828D:
+		r82xx_get_pll_cache_stats(&dev->r82xx_p, hits, misses);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+int rtlsdr_get_tuner_band(rtlsdr_dev_t *dev, uint32_t freq)
+{
+	if (!dev)
+		return -1;
+
+	/* the tuner is bypassed, nothing band dependent to set up */
+	if (dev->direct_sampling)
+		return 0;
+
+	switch (dev->tuner_type) {
+	case RTLSDR_TUNER_R820T:
+	case RTLSDR_TUNER_R828D:
+		return r82xx_get_band(&dev->r82xx_p, freq);
+	default:
+		return 0;
+	}
+}
+
+int rtlsdr_get_tuner_gains(rtlsdr_dev_t *dev, int *gains)
+{
+	/* all gain values are expressed in tenths of a dB */
+	const int e4k_gains[] = { -10, 15, 40, 65, 90, 115, 140, 165, 190, 215,
+				  240, 290, 340, 420 };
+	const int fc0012_gains[] = { -99, -40, 71, 179, 192 };
+	const int fc0013_gains[] = { -99, -73, -65, -63, -60, -58, -54, 58, 61,
+				       63, 65, 67, 68, 70, 71, 179, 181, 182,
+				       184, 186, 188, 191, 197 };
+	const int fc2580_gains[] = { 0 /* no gain values */ };
+	const int r82xx_gains[] = { 0, 9, 14, 27, 37, 77, 87, 125, 144, 157,
+				     166, 197, 207, 229, 254, 280, 297, 328,
+				     338, 364, 372, 386, 402, 421, 434, 439,
+				     445, 480, 496 };
+	const int unknown_gains[] = { 0 /* no gain values */ };
+
+	const int *ptr = NULL;
+	int len = 0;
+
+	if (!dev)
+		return -1;
+
+	switch (dev->tuner_type) {
+	case RTLSDR_TUNER_E4000:
+		ptr = e4k_gains; len = sizeof(e4k_gains);
 		break;
 	case RTLSDR_TUNER_FC0012:
 		ptr = fc0012_gains; len = sizeof(fc0012_gains);
@@ -990,15 +1591,18 @@ int rtlsdr_get_tuner_gains(rtlsdr_dev_t *dev, int *gains)
 
 int rtlsdr_set_tuner_gain(rtlsdr_dev_t *dev, int gain)
 {
-	int r = 0;
+	int r = 0, batched;
 
 	if (!dev || !dev->tuner)
 		return -1;
 
 	if (dev->tuner->set_gain) {
+		batched = !rtlsdr_ctrl_begin(dev);
 		rtlsdr_set_i2c_repeater(dev, 1);
 		r = dev->tuner->set_gain((void *)dev, gain);
 		rtlsdr_set_i2c_repeater(dev, 0);
+		if (batched && rtlsdr_ctrl_commit(dev) < 0 && !r)
+			r = -1;
 	}
 
 	if (!r)
@@ -1006,6 +1610,8 @@ int rtlsdr_set_tuner_gain(rtlsdr_dev_t *dev, int gain)
 	else
 		dev->gain = 0;
 
+	FLAGS_RAISE(&dev->block_flags, RTLSDR_BLOCK_RETUNED);
+
 	return r;
 }
 
@@ -1051,7 +1657,7 @@ int rtlsdr_set_tuner_gain_mode(rtlsdr_dev_t *dev, int mode)
 
 int rtlsdr_set_sample_rate(rtlsdr_dev_t *dev, uint32_t samp_rate)
 {
-	int r = 0;
+	int r = 0, batched;
 	uint16_t tmp;
 	uint32_t rsamp_ratio, real_rsamp_ratio;
 	double real_rate;
@@ -1075,6 +1681,8 @@ int rtlsdr_set_sample_rate(rtlsdr_dev_t *dev, uint32_t samp_rate)
 	if ( ((double)samp_rate) != real_rate )
 		fprintf(stderr, "Exact sample rate is: %f Hz\n", real_rate);
 
+	batched = !rtlsdr_ctrl_begin(dev);
+
 	if (dev->tuner && dev->tuner->set_bw) {
 		rtlsdr_set_i2c_repeater(dev, 1);
 		dev->tuner->set_bw(dev, (int)real_rate);
@@ -1098,6 +1706,12 @@ int rtlsdr_set_sample_rate(rtlsdr_dev_t *dev, uint32_t samp_rate)
 	if (dev->offs_freq)
 		rtlsdr_set_offset_tuning(dev, 1);
 
+	if (batched && rtlsdr_ctrl_commit(dev) < 0 && !r)
+		r = -1;
+
+	if (dev->replay_file)
+		replay_reset_clock(dev);
+
 	return r;
 }
 
@@ -1299,6 +1913,9 @@ uint32_t rtlsdr_get_device_count(void)
 
 	libusb_exit(ctx);
 
+	if (replay_env_file())
+		device_count++;
+
 	return device_count;
 }
 
@@ -1333,8 +1950,10 @@ const char *rtlsdr_get_device_name(uint32_t index)
 
 	libusb_exit(ctx);
 
-	if (device)
+	if (device && index == device_count - 1)
 		return device->name;
+	else if (replay_env_file() && index == device_count)
+		return "File replay";
 	else
 		return "";
 }
@@ -1352,6 +1971,8 @@ int rtlsdr_get_device_usb_strings(uint32_t index, char *manufact,
 	uint32_t device_count = 0;
 	ssize_t cnt;
 
+	memset(&devt, 0, sizeof(devt));
+
 	libusb_init(&ctx);
 
 	cnt = libusb_get_device_list(ctx, &list);
@@ -1382,6 +2003,11 @@ int rtlsdr_get_device_usb_strings(uint32_t index, char *manufact,
 
 	libusb_exit(ctx);
 
+	if (r == -2 && replay_env_file() && index == device_count) {
+		replay_strings(replay_env_file(), manufact, product, serial);
+		r = 0;
+	}
+
 	return r;
 }
 
@@ -1448,6 +2074,16 @@ int rtlsdr_open(rtlsdr_dev_t **out_dev, uint32_t index)
 	}
 
 	if (!device) {
+		libusb_free_device_list(list, 1);
+
+		/* the replay device comes after all USB devices */
+		if (replay_env_file() && index == device_count) {
+			libusb_exit(dev->ctx);
+			free(dev);
+			return rtlsdr_open_file(out_dev, replay_env_file(),
+						replay_env_flags());
+		}
+
 		r = -1;
 		goto err;
 	}
@@ -1602,6 +2238,52 @@ err:
 	return r;
 }
 
+int rtlsdr_open_file(rtlsdr_dev_t **out_dev, const char *filename, int flags)
+{
+	rtlsdr_dev_t *dev = NULL;
+	FILE *file;
+
+	if (!out_dev || !filename)
+		return -1;
+
+	if (strcmp(filename, "-") == 0)
+		file = stdin;
+	else
+		file = fopen(filename, "rb");
+
+	if (!file) {
+		fprintf(stderr, "Failed to open replay file %s\n", filename);
+		return -1;
+	}
+
+	dev = malloc(sizeof(rtlsdr_dev_t));
+	if (NULL == dev) {
+		if (file != stdin)
+			fclose(file);
+		return -ENOMEM;
+	}
+
+	memset(dev, 0, sizeof(rtlsdr_dev_t));
+	memcpy(dev->fir, fir_default, sizeof(fir_default));
+
+	dev->replay_file = file;
+	dev->replay_name = strdup(filename);
+	dev->replay_flags = flags;
+	replay_reset_clock(dev);
+
+	dev->rtl_xtal = DEF_RTL_XTAL_FREQ;
+	dev->tun_xtal = dev->rtl_xtal;
+	dev->tuner_type = RTLSDR_TUNER_UNKNOWN;
+	dev->tuner = &replay_tuner;
+
+	fprintf(stderr, "Replaying %s (%s)\n", filename,
+		(flags & RTLSDR_REPLAY_PACED) ? "paced" : "full speed");
+
+	*out_dev = dev;
+
+	return 0;
+}
+
 int rtlsdr_close(rtlsdr_dev_t *dev)
 {
 	if (!dev)
@@ -1620,6 +2302,19 @@ int rtlsdr_close(rtlsdr_dev_t *dev)
 		rtlsdr_deinit_baseband(dev);
 	}
 
+	_rtlsdr_free_async_buffers(dev);
+	_rtlsdr_ctrl_free(dev);
+
+	if (dev->replay_file) {
+		if (dev->replay_file != stdin)
+			fclose(dev->replay_file);
+
+		free(dev->replay_name);
+		free(dev);
+
+		return 0;
+	}
+
 	libusb_release_interface(dev->devh, 0);
 
 #ifdef DETACH_KERNEL_DRIVER
@@ -1648,28 +2343,103 @@ int rtlsdr_reset_buffer(rtlsdr_dev_t *dev)
 	rtlsdr_write_reg(dev, USBB, USB_EPA_CTL, 0x1002, 2);
 	rtlsdr_write_reg(dev, USBB, USB_EPA_CTL, 0x0000, 2);
 
+	if (dev->replay_file)
+		replay_reset_clock(dev);
+
 	return 0;
 }
 
 int rtlsdr_read_sync(rtlsdr_dev_t *dev, void *buf, int len, int *n_read)
 {
+	int r;
+
 	if (!dev)
 		return -1;
 
-	return libusb_bulk_transfer(dev->devh, 0x81, buf, len, n_read, BULK_TIMEOUT);
+	if (dev->replay_file) {
+		*n_read = replay_read(dev, buf, len);
+		r = (*n_read > 0) ? 0 : LIBUSB_ERROR_IO;
+	} else {
+		r = libusb_bulk_transfer(dev->devh, 0x81, buf, len, n_read,
+					 BULK_TIMEOUT);
+	}
+
+	if (*n_read > 0)
+		dev->sample_count += *n_read / 2;
+
+	return r;
+}
+
+static uint32_t _rtlsdr_stream_count(rtlsdr_dev_t *dev, uint32_t head,
+				     uint32_t tail)
+{
+	return (head + dev->stream_size - tail) % dev->stream_size;
+}
+
+static void _rtlsdr_block_info(rtlsdr_dev_t *dev, uint32_t len,
+			       rtlsdr_block_info_t *info)
+{
+	info->sample_index = dev->sample_count;
+	info->timestamp_us = rtlsdr_monotonic_us();
+	info->flags = FLAGS_TAKE(&dev->block_flags);
+
+	dev->sample_count += len / 2;
+
+	_rtlsdr_clock_set(dev, dev->sample_count, info->timestamp_us);
+}
+
+static int _rtlsdr_stream_push(rtlsdr_dev_t *dev, struct libusb_transfer *xfer,
+			       const rtlsdr_block_info_t *info)
+{
+	uint32_t head = dev->stream_head;
+	uint32_t tail = RING_LOAD(&dev->stream_tail);
+
+	/* keep the USB pipe busy rather than wait for the consumer */
+	if (_rtlsdr_stream_count(dev, head, tail) + STREAM_MIN_INFLIGHT >=
+	    dev->stream_size) {
+		dev->stream_overruns++;
+		FLAGS_RAISE(&dev->block_flags,
+			    info->flags | RTLSDR_BLOCK_DISCONTINUITY);
+		return -1;
+	}
+
+	dev->stream_ring[head] = xfer;
+	dev->stream_info[head] = *info;
+	RING_STORE(&dev->stream_head, (head + 1) % dev->stream_size);
+
+	/* pairs with the fence in rtlsdr_stream_acquire_ex() */
+	RING_FENCE();
+	if (RING_LOAD(&dev->stream_waiting)) {
+		pthread_mutex_lock(&dev->stream_lock);
+		pthread_cond_broadcast(&dev->stream_cond);
+		pthread_mutex_unlock(&dev->stream_lock);
+	}
+
+	return 0;
 }
 
 static void LIBUSB_CALL _libusb_callback(struct libusb_transfer *xfer)
 {
 	rtlsdr_dev_t *dev = (rtlsdr_dev_t *)xfer->user_data;
+	rtlsdr_block_info_t info;
 
 	if (LIBUSB_TRANSFER_COMPLETED == xfer->status) {
-		if (dev->cb)
+		dev->xfer_errors = 0;
+		_rtlsdr_block_info(dev, xfer->actual_length, &info);
+
+		/* a streamed buffer is resubmitted on release */
+		if (dev->stream_ring && !_rtlsdr_stream_push(dev, xfer, &info))
+			return;
+
+		if (dev->cb_ex)
+			dev->cb_ex(xfer->buffer, xfer->actual_length, &info,
+				   dev->cb_ctx);
+		else if (dev->cb)
 			dev->cb(xfer->buffer, xfer->actual_length, dev->cb_ctx);
 
 		libusb_submit_transfer(xfer); /* resubmit transfer */
-		dev->xfer_errors = 0;
 	} else if (LIBUSB_TRANSFER_CANCELLED != xfer->status) {
+		FLAGS_RAISE(&dev->block_flags, RTLSDR_BLOCK_DISCONTINUITY);
 #ifndef _WIN32
 		if (LIBUSB_TRANSFER_ERROR == xfer->status)
 			dev->xfer_errors++;
@@ -1692,6 +2462,107 @@ int rtlsdr_wait_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx)
 	return rtlsdr_read_async(dev, cb, ctx, 0, 0);
 }
 
+static size_t _rtlsdr_page_size(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	return si.dwPageSize;
+#else
+	long sz = sysconf(_SC_PAGESIZE);
+
+	return (sz > 0) ? (size_t)sz : 4096;
+#endif
+}
+
+#ifdef HAVE_LIBUSB_DEV_MEM
+static int _rtlsdr_alloc_zerocopy(rtlsdr_dev_t *dev)
+{
+	unsigned int i;
+	int r = 0;
+
+	for (i = 0; i < dev->pool_num; ++i) {
+		dev->xfer_buf[i] = libusb_dev_mem_alloc(dev->devh, dev->pool_len);
+		if (!dev->xfer_buf[i]) {
+			r = -1;
+			break;
+		}
+
+		/*
+		 * Kernels with the usbfs mmap() bug hand out memory that is
+		 * not zeroed, and not actually shared with the controller.
+		 */
+		if (dev->xfer_buf[i][0] || memcmp(dev->xfer_buf[i],
+						  dev->xfer_buf[i] + 1,
+						  dev->pool_len - 1)) {
+			fprintf(stderr, "Detected Kernel usbfs mmap() bug, "
+				"falling back to buffers in userspace\n");
+			r = -1;
+			++i;
+			break;
+		}
+	}
+
+	if (!r)
+		return 0;
+
+	while (i--) {
+		if (dev->xfer_buf[i])
+			libusb_dev_mem_free(dev->devh, dev->xfer_buf[i],
+					    dev->pool_len);
+		dev->xfer_buf[i] = NULL;
+	}
+
+	return -1;
+}
+#endif
+
+static int _rtlsdr_alloc_arena(rtlsdr_dev_t *dev)
+{
+	size_t page = _rtlsdr_page_size();
+	size_t stride = (dev->pool_len + page - 1) / page * page;
+	unsigned char *arena = NULL;
+	unsigned int i;
+
+	dev->pool_arena_len = stride * dev->pool_num;
+
+#ifdef _WIN32
+	arena = VirtualAlloc(NULL, dev->pool_arena_len,
+			     MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+#ifdef MAP_HUGETLB
+	/* only succeeds when the admin has reserved huge pages */
+	{
+		size_t huge = 2 * 1024 * 1024;
+		size_t len = (dev->pool_arena_len + huge - 1) / huge * huge;
+
+		arena = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (MAP_FAILED == arena)
+			arena = NULL;
+		else
+			dev->pool_arena_len = len;
+	}
+#endif
+	if (!arena) {
+		arena = mmap(NULL, dev->pool_arena_len, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == arena)
+			arena = NULL;
+	}
+#endif
+
+	if (!arena)
+		return -ENOMEM;
+
+	dev->pool_arena = arena;
+	for (i = 0; i < dev->pool_num; ++i)
+		dev->xfer_buf[i] = arena + i * stride;
+
+	return 0;
+}
+
 static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 {
 	unsigned int i;
@@ -1699,20 +2570,86 @@ static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 	if (!dev)
 		return -1;
 
-	if (!dev->xfer) {
-		dev->xfer = malloc(dev->xfer_buf_num *
-				   sizeof(struct libusb_transfer *));
+	/* reuse the pool as long as the geometry did not change */
+	if (dev->xfer && dev->pool_num == dev->xfer_buf_num &&
+	    dev->pool_len == dev->xfer_buf_len)
+		return 0;
+
+	_rtlsdr_free_async_buffers(dev);
+
+	dev->pool_num = dev->xfer_buf_num;
+	dev->pool_len = dev->xfer_buf_len;
+
+	dev->xfer = calloc(dev->pool_num, sizeof(struct libusb_transfer *));
+	dev->xfer_buf = calloc(dev->pool_num, sizeof(unsigned char *));
+	if (!dev->xfer || !dev->xfer_buf)
+		goto err;
 
-		for(i = 0; i < dev->xfer_buf_num; ++i)
-			dev->xfer[i] = libusb_alloc_transfer(0);
+	for (i = 0; i < dev->pool_num; ++i) {
+		dev->xfer[i] = libusb_alloc_transfer(0);
+		if (!dev->xfer[i])
+			goto err;
+	}
+
+#ifdef HAVE_LIBUSB_DEV_MEM
+	if (!dev->replay_file && !_rtlsdr_alloc_zerocopy(dev)) {
+		dev->use_zerocopy = 1;
+		return 0;
 	}
+#endif
+
+	if (!_rtlsdr_alloc_arena(dev))
+		return 0;
 
-	if (!dev->xfer_buf) {
-		dev->xfer_buf = malloc(dev->xfer_buf_num *
-					   sizeof(unsigned char *));
+err:
+	fprintf(stderr, "Failed to allocate %u transfer buffers!\n",
+		dev->xfer_buf_num);
+	_rtlsdr_free_async_buffers(dev);
+	return -ENOMEM;
+}
 
-		for(i = 0; i < dev->xfer_buf_num; ++i)
-			dev->xfer_buf[i] = malloc(dev->xfer_buf_len);
+static int _rtlsdr_replay_async(rtlsdr_dev_t *dev)
+{
+	rtlsdr_block_info_t info;
+	unsigned int i = 0;
+	int n;
+
+	while (RTLSDR_RUNNING == dev->async_status) {
+		/* a file never overruns, wait for the consumer instead */
+		if (dev->stream_ring) {
+			pthread_mutex_lock(&dev->stream_lock);
+			while (RTLSDR_RUNNING == dev->async_status &&
+			       _rtlsdr_stream_count(dev, dev->stream_head,
+				       RING_LOAD(&dev->stream_tail)) +
+			       STREAM_MIN_INFLIGHT >= dev->stream_size)
+				pthread_cond_wait(&dev->stream_cond,
+						  &dev->stream_lock);
+			pthread_mutex_unlock(&dev->stream_lock);
+
+			if (RTLSDR_RUNNING != dev->async_status)
+				break;
+		}
+
+		n = replay_read(dev, dev->xfer_buf[i], dev->xfer_buf_len);
+		if (n <= 0)
+			break;
+
+		_rtlsdr_block_info(dev, n, &info);
+
+		if (dev->stream_ring) {
+			dev->xfer[i]->buffer = dev->xfer_buf[i];
+			dev->xfer[i]->actual_length = n;
+			_rtlsdr_stream_push(dev, dev->xfer[i], &info);
+		} else if (dev->cb_ex) {
+			dev->cb_ex(dev->xfer_buf[i], n, &info, dev->cb_ctx);
+		} else if (dev->cb) {
+			dev->cb(dev->xfer_buf[i], n, dev->cb_ctx);
+		}
+
+		if ((uint32_t)n < dev->xfer_buf_len)
+			break; /* end of file */
+
+		i = (i + 1) % dev->xfer_buf_num;
 	}
 
 	return 0;
@@ -1726,7 +2663,7 @@ static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev)
 		return -1;
 
 	if (dev->xfer) {
-		for(i = 0; i < dev->xfer_buf_num; ++i) {
+		for(i = 0; i < dev->pool_num; ++i) {
 			if (dev->xfer[i]) {
 				libusb_free_transfer(dev->xfer[i]);
 			}
@@ -1737,20 +2674,37 @@ static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev)
 	}
 
 	if (dev->xfer_buf) {
-		for(i = 0; i < dev->xfer_buf_num; ++i) {
-			if (dev->xfer_buf[i])
-				free(dev->xfer_buf[i]);
+#ifdef HAVE_LIBUSB_DEV_MEM
+		if (dev->use_zerocopy) {
+			for(i = 0; i < dev->pool_num; ++i)
+				libusb_dev_mem_free(dev->devh,
+						    dev->xfer_buf[i],
+						    dev->pool_len);
 		}
-
+#endif
 		free(dev->xfer_buf);
 		dev->xfer_buf = NULL;
 	}
 
+	if (dev->pool_arena) {
+#ifdef _WIN32
+		VirtualFree(dev->pool_arena, 0, MEM_RELEASE);
+#else
+		munmap(dev->pool_arena, dev->pool_arena_len);
+#endif
+		dev->pool_arena = NULL;
+	}
+
+	dev->use_zerocopy = 0;
+	dev->pool_num = 0;
+	dev->pool_len = 0;
+
 	return 0;
 }
 
-int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
-			  uint32_t buf_num, uint32_t buf_len)
+static int _rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb,
+			      rtlsdr_read_async_ex_cb_t cb_ex, void *ctx,
+			      uint32_t buf_num, uint32_t buf_len)
 {
 	unsigned int i;
 	int r = 0;
@@ -1768,8 +2722,14 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 	dev->async_cancel = 0;
 
 	dev->cb = cb;
+	dev->cb_ex = cb_ex;
 	dev->cb_ctx = ctx;
 
+	dev->sample_count = 0;
+	FLAGS_TAKE(&dev->block_flags);
+
+	_rtlsdr_clock_set(dev, 0, rtlsdr_monotonic_us());
+
 	if (buf_num > 0)
 		dev->xfer_buf_num = buf_num;
 	else
@@ -1780,7 +2740,17 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 	else
 		dev->xfer_buf_len = DEFAULT_BUF_LENGTH;
 
-	_rtlsdr_alloc_async_buffers(dev);
+	r = _rtlsdr_alloc_async_buffers(dev);
+	if (r < 0) {
+		dev->async_status = RTLSDR_INACTIVE;
+		return r;
+	}
+
+	if (dev->replay_file) {
+		r = _rtlsdr_replay_async(dev);
+		dev->async_status = RTLSDR_INACTIVE;
+		return r;
+	}
 
 	for(i = 0; i < dev->xfer_buf_num; ++i) {
 		libusb_fill_bulk_transfer(dev->xfer[i],
@@ -1847,13 +2817,23 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 		}
 	}
 
-	_rtlsdr_free_async_buffers(dev);
-
 	dev->async_status = next_status;
 
 	return r;
 }
 
+int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
+			  uint32_t buf_num, uint32_t buf_len)
+{
+	return _rtlsdr_read_async(dev, cb, NULL, ctx, buf_num, buf_len);
+}
+
+int rtlsdr_read_async_ex(rtlsdr_dev_t *dev, rtlsdr_read_async_ex_cb_t cb,
+			 void *ctx, uint32_t buf_num, uint32_t buf_len)
+{
+	return _rtlsdr_read_async(dev, NULL, cb, ctx, buf_num, buf_len);
+}
+
 int rtlsdr_cancel_async(rtlsdr_dev_t *dev)
 {
 	if (!dev)
@@ -1876,6 +2856,239 @@ int rtlsdr_cancel_async(rtlsdr_dev_t *dev)
 	return -2;
 }
 
+static void _rtlsdr_stream_deadline(struct timespec *ts, int timeout_ms)
+{
+#ifdef _WIN32
+	timespec_get(ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_REALTIME, ts);
+#endif
+	ts->tv_sec += timeout_ms / 1000;
+	ts->tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static void *_rtlsdr_stream_thread(void *arg)
+{
+	rtlsdr_dev_t *dev = (rtlsdr_dev_t *)arg;
+	int r;
+
+	r = _rtlsdr_read_async(dev, NULL, NULL, NULL, dev->stream_size - 1,
+			       dev->xfer_buf_len);
+
+	pthread_mutex_lock(&dev->stream_lock);
+	dev->stream_result = r;
+	dev->stream_active = 0;
+	pthread_cond_broadcast(&dev->stream_cond);
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return NULL;
+}
+
+int rtlsdr_stream_start(rtlsdr_dev_t *dev, uint32_t buf_num, uint32_t buf_len)
+{
+	if (!dev)
+		return -1;
+
+	if (RTLSDR_INACTIVE != dev->async_status || dev->stream_ring)
+		return -2;
+
+	if (buf_num == 0)
+		buf_num = DEFAULT_BUF_NUMBER;
+
+	if (buf_num <= STREAM_MIN_INFLIGHT)
+		return -EINVAL;
+
+	if (buf_len > 0 && buf_len % 512 == 0) /* len must be multiple of 512 */
+		dev->xfer_buf_len = buf_len;
+	else
+		dev->xfer_buf_len = DEFAULT_BUF_LENGTH;
+
+	dev->stream_size = buf_num + 1;
+	dev->stream_ring = calloc(dev->stream_size,
+				  sizeof(struct libusb_transfer *));
+	dev->stream_info = calloc(dev->stream_size,
+				  sizeof(rtlsdr_block_info_t));
+	if (!dev->stream_ring || !dev->stream_info) {
+		free(dev->stream_ring);
+		free(dev->stream_info);
+		dev->stream_ring = NULL;
+		dev->stream_info = NULL;
+		return -ENOMEM;
+	}
+
+	dev->stream_head = 0;
+	dev->stream_tail = 0;
+	dev->stream_next = 0;
+	dev->stream_overruns = 0;
+	dev->stream_result = 0;
+	dev->stream_active = 1;
+	dev->stream_waiting = 0;
+	pthread_mutex_init(&dev->stream_lock, NULL);
+
+	/* retunes may come before the event thread starts counting */
+	_rtlsdr_clock_set(dev, 0, rtlsdr_monotonic_us());
+	pthread_cond_init(&dev->stream_cond, NULL);
+
+	if (pthread_create(&dev->stream_thread, NULL, _rtlsdr_stream_thread,
+			   (void *)dev)) {
+		pthread_cond_destroy(&dev->stream_cond);
+		pthread_mutex_destroy(&dev->stream_lock);
+		free(dev->stream_ring);
+		free(dev->stream_info);
+		dev->stream_ring = NULL;
+		dev->stream_info = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int rtlsdr_stream_acquire(rtlsdr_dev_t *dev, unsigned char **buf,
+			  uint32_t *len, int timeout_ms)
+{
+	return rtlsdr_stream_acquire_ex(dev, buf, len, NULL, timeout_ms);
+}
+
+int rtlsdr_stream_acquire_ex(rtlsdr_dev_t *dev, unsigned char **buf,
+			     uint32_t *len, rtlsdr_block_info_t *info,
+			     int timeout_ms)
+{
+	struct libusb_transfer *xfer;
+	struct timespec deadline;
+	int r = 0;
+
+	if (!dev || !buf || !len)
+		return -1;
+
+	if (!dev->stream_ring)
+		return -2;
+
+	if (dev->stream_next == RING_LOAD(&dev->stream_head)) {
+		if (timeout_ms > 0)
+			_rtlsdr_stream_deadline(&deadline, timeout_ms);
+
+		pthread_mutex_lock(&dev->stream_lock);
+		/* announce before the last look, or a wakeup could be missed */
+		RING_STORE(&dev->stream_waiting, 1);
+		RING_FENCE();
+		while (dev->stream_next == RING_LOAD(&dev->stream_head)) {
+			if (!dev->stream_active) {
+				r = -2;
+				break;
+			}
+
+			if (timeout_ms == 0) {
+				r = -ETIMEDOUT;
+				break;
+			}
+
+			if (timeout_ms < 0) {
+				pthread_cond_wait(&dev->stream_cond,
+						  &dev->stream_lock);
+			} else if (pthread_cond_timedwait(&dev->stream_cond,
+							  &dev->stream_lock,
+							  &deadline) == ETIMEDOUT) {
+				if (dev->stream_next ==
+				    RING_LOAD(&dev->stream_head))
+					r = -ETIMEDOUT;
+				break;
+			}
+		}
+		RING_STORE(&dev->stream_waiting, 0);
+		pthread_mutex_unlock(&dev->stream_lock);
+
+		if (r)
+			return r;
+	}
+
+	xfer = dev->stream_ring[dev->stream_next];
+	if (info)
+		*info = dev->stream_info[dev->stream_next];
+	dev->stream_next = (dev->stream_next + 1) % dev->stream_size;
+
+	*buf = xfer->buffer;
+	*len = xfer->actual_length;
+
+	return 0;
+}
+
+int rtlsdr_stream_release(rtlsdr_dev_t *dev)
+{
+	struct libusb_transfer *xfer;
+	uint32_t tail;
+
+	if (!dev)
+		return -1;
+
+	if (!dev->stream_ring)
+		return -2;
+
+	tail = dev->stream_tail;
+	if (tail == dev->stream_next)
+		return -2;
+
+	xfer = dev->stream_ring[tail];
+
+	/* hand the buffer back before making the slot available */
+	if (!dev->replay_file && RTLSDR_RUNNING == dev->async_status)
+		libusb_submit_transfer(xfer);
+
+	RING_STORE(&dev->stream_tail, (tail + 1) % dev->stream_size);
+
+	if (dev->replay_file) {
+		pthread_mutex_lock(&dev->stream_lock);
+		pthread_cond_broadcast(&dev->stream_cond);
+		pthread_mutex_unlock(&dev->stream_lock);
+	}
+
+	return 0;
+}
+
+int rtlsdr_stream_stop(rtlsdr_dev_t *dev)
+{
+	struct timespec deadline;
+
+	if (!dev)
+		return -1;
+
+	if (!dev->stream_ring)
+		return -2;
+
+	/* retry, the event thread might not be running yet */
+	pthread_mutex_lock(&dev->stream_lock);
+	while (dev->stream_active) {
+		rtlsdr_cancel_async(dev);
+		pthread_cond_broadcast(&dev->stream_cond);
+		_rtlsdr_stream_deadline(&deadline, 10);
+		pthread_cond_timedwait(&dev->stream_cond, &dev->stream_lock,
+				       &deadline);
+	}
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	pthread_join(dev->stream_thread, NULL);
+
+	pthread_cond_destroy(&dev->stream_cond);
+	pthread_mutex_destroy(&dev->stream_lock);
+	free(dev->stream_ring);
+	free(dev->stream_info);
+	dev->stream_ring = NULL;
+	dev->stream_info = NULL;
+
+	return dev->stream_result;
+}
+
+uint32_t rtlsdr_stream_get_overruns(rtlsdr_dev_t *dev)
+{
+	if (!dev)
+		return 0;
+
+	return dev->stream_overruns;
+}
+
 uint32_t rtlsdr_get_tuner_clock(void *dev)
 {
 	uint32_t tuner_freq;
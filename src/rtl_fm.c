@@ -74,6 +74,7 @@
 
 #include "rtl-sdr.h"
 #include "convenience/convenience.h"
+#include "convenience/decimate.h"
 
 #define DEFAULT_SAMPLE_RATE		24000
 #define DEFAULT_ASYNC_BUF_NUMBER	32
@@ -82,6 +83,8 @@
 #define MAXIMUM_BUF_LENGTH		(MAXIMUM_OVERSAMPLE * DEFAULT_BUF_LENGTH)
 #define AUTO_GAIN			-100
 #define BUFFER_DUMP			4096
+#define MAXIMUM_DOWNSAMPLE_PASSES	10
+#define COMP_PASSBAND			0.4  /* flat to 80% of the output rate */
 
 #define FREQUENCIES_LIMIT		1000
 
@@ -107,7 +110,7 @@ struct dongle_state
 	int      ppm_error;
 	int      offset_tuning;
 	int      direct_sampling;
-	int      mute;
+	uint64_t valid_index;  /* first sample after the last retune, under demod.rw */
 	struct demod_state *demod_target;
 };
 
@@ -117,11 +120,10 @@ struct demod_state
 	pthread_t thread;
 	int16_t  lowpassed[MAXIMUM_BUF_LENGTH];
 	int      lp_len;
-	int16_t  lp_i_hist[10][6];
-	int16_t  lp_q_hist[10][6];
+	struct decim_fir ds_fir[MAXIMUM_DOWNSAMPLE_PASSES];
+	struct decim_fir comp_fir;
+	int      ds_ready;  /* passes the filters were built for */
 	int16_t  result[MAXIMUM_BUF_LENGTH];
-	int16_t  droop_i_hist[9];
-	int16_t  droop_q_hist[9];
 	int      result_len;
 	int      rate_in;
 	int      rate_out;
@@ -215,7 +217,7 @@ void usage(void)
 		"\t    +values will mute/scan, -values will exit\n"
 		"\t[-F fir_size (default: off)]\n"
 		"\t    enables low-leakage downsample filter\n"
-		"\t    size can be 0 or 9.  0 has bad roll off\n"
+		"\t    size can be 0 or odd up to 129.  0 has bad roll off\n"
 		"\t[-A std/fast/lut/ale choose atan math (default: std)]\n"
 		//"\t[-C clip_path (default: off)\n"
 		//"\t (create time stamped raw clips, requires squelch)\n"
@@ -256,23 +258,6 @@ static void sighandler(int signum)
 #define safe_cond_signal(n, m) pthread_mutex_lock(m); pthread_cond_signal(n); pthread_mutex_unlock(m)
 #define safe_cond_wait(n, m) pthread_mutex_lock(m); pthread_cond_wait(n, m); pthread_mutex_unlock(m)
 
-/* {length, coef, coef, coef}  and scaled by 2^15
-   for now, only length 9, optimal way to get +85% bandwidth */
-#define CIC_TABLE_MAX 10
-int cic_9_tables[][10] = {
-	{0,},
-	{9, -156,  -97, 2798, -15489, 61019, -15489, 2798,  -97, -156},
-	{9, -128, -568, 5593, -24125, 74126, -24125, 5593, -568, -128},
-	{9, -129, -639, 6187, -26281, 77511, -26281, 6187, -639, -129},
-	{9, -122, -612, 6082, -26353, 77818, -26353, 6082, -612, -122},
-	{9, -120, -602, 6015, -26269, 77757, -26269, 6015, -602, -120},
-	{9, -120, -582, 5951, -26128, 77542, -26128, 5951, -582, -120},
-	{9, -119, -580, 5931, -26094, 77505, -26094, 5931, -580, -119},
-	{9, -119, -578, 5921, -26077, 77484, -26077, 5921, -578, -119},
-	{9, -119, -577, 5917, -26067, 77473, -26067, 5917, -577, -119},
-	{9, -199, -362, 5303, -25505, 77489, -25505, 5303, -362, -199},
-};
-
 #ifdef _MSC_VER
 double log2(double n)
 {
@@ -361,62 +346,6 @@ void low_pass_real(struct demod_state *s)
 	s->result_len = i2;
 }
 
-void fifth_order(int16_t *data, int length, int16_t *hist)
-/* for half of interleaved data */
-{
-	int i;
-	int16_t a, b, c, d, e, f;
-	a = hist[1];
-	b = hist[2];
-	c = hist[3];
-	d = hist[4];
-	e = hist[5];
-	f = data[0];
-	/* a downsample should improve resolution, so don't fully shift */
-	data[0] = (a + (b+e)*5 + (c+d)*10 + f) >> 4;
-	for (i=4; i<length; i+=4) {
-		a = c;
-		b = d;
-		c = e;
-		d = f;
-		e = data[i-2];
-		f = data[i];
-		data[i/2] = (a + (b+e)*5 + (c+d)*10 + f) >> 4;
-	}
-	/* archive */
-	hist[0] = a;
-	hist[1] = b;
-	hist[2] = c;
-	hist[3] = d;
-	hist[4] = e;
-	hist[5] = f;
-}
-
-void generic_fir(int16_t *data, int length, int *fir, int16_t *hist)
-/* Okay, not at all generic.  Assumes length 9, fix that eventually. */
-{
-	int d, f, temp, sum;
-	for (d=0; d<length; d+=2) {
-		temp = data[d];
-		sum = 0;
-		sum += (hist[0] + hist[8]) * fir[1];
-		sum += (hist[1] + hist[7]) * fir[2];
-		sum += (hist[2] + hist[6]) * fir[3];
-		sum += (hist[3] + hist[5]) * fir[4];
-		sum +=            hist[4]  * fir[5];
-		data[d] = sum >> 15 ;
-		hist[0] = hist[1];
-		hist[1] = hist[2];
-		hist[2] = hist[3];
-		hist[3] = hist[4];
-		hist[4] = hist[5];
-		hist[5] = hist[6];
-		hist[6] = hist[7];
-		hist[7] = hist[8];
-		hist[8] = temp;
-	}
-}
-
 /* define our own complex math ops
    because ARMv5 has no hardware float */
 
@@ -751,25 +680,54 @@ void arbitrary_resample(int16_t *buf1, int16_t *buf2, int len1, int len2)
 	}
 }
 
+static int downsample_setup(struct demod_state *d)
+/* binomial decimate by two passes, then the droop compensation */
+{
+	int i, len;
+	double stage[DECIM_MAX_TAPS], h[DECIM_MAX_TAPS];
+	for (i=0; i<MAXIMUM_DOWNSAMPLE_PASSES; i++) {
+		decim_fir_free(&d->ds_fir[i]);}
+	decim_fir_free(&d->comp_fir);
+	d->ds_ready = 0;
+	len = decim_design_cic(stage, 5, 2);
+	/* a downsample should improve resolution, so don't fully shift */
+	for (i=0; i<len; i++) {
+		h[i] = 2.0 * stage[i];}
+	for (i=0; i<d->downsample_passes; i++) {
+		if (decim_fir_init(&d->ds_fir[i], h, len, 2) < 0) {
+			return -1;}
+	}
+	if (d->comp_fir_size > 1) {
+		if (decim_design_comp(h, d->comp_fir_size, stage, len,
+		    d->downsample_passes, COMP_PASSBAND) < 0) {
+			return -1;}
+		if (decim_fir_init(&d->comp_fir, h, d->comp_fir_size, 1) < 0) {
+			return -1;}
+	}
+	d->ds_ready = d->downsample_passes;
+	return 0;
+}
+
 void full_demod(struct demod_state *d)
 {
 	uint8_t dump[BUFFER_DUMP];
-	int i, ds, ds_p, freq_next, n_read;
+	int i, n, ds, ds_p, freq_next, n_read;
 	int sr = 0;
 	ds_p = d->downsample_passes;
+	if (ds_p && ds_p != d->ds_ready && downsample_setup(d) < 0) {
+		fprintf(stderr, "Failed to set up the downsample filters.\n");
+		d->exit_flag = 1;
+		d->lp_len = 0;
+		ds_p = 0;
+	}
 	if (ds_p) {
+		n = d->lp_len / 2;
 		for (i=0; i < ds_p; i++) {
-			fifth_order(d->lowpassed,   (d->lp_len >> i), d->lp_i_hist[i]);
-			fifth_order(d->lowpassed+1, (d->lp_len >> i) - 1, d->lp_q_hist[i]);
-		}
-		d->lp_len = d->lp_len >> ds_p;
+			n = decim_fir_int16(&d->ds_fir[i], d->lowpassed, n, d->lowpassed);}
 		/* droop compensation */
-		if (d->comp_fir_size == 9 && ds_p <= CIC_TABLE_MAX) {
-			generic_fir(d->lowpassed, d->lp_len,
-				cic_9_tables[ds_p], d->droop_i_hist);
-			generic_fir(d->lowpassed+1, d->lp_len-1,
-				cic_9_tables[ds_p], d->droop_q_hist);
-		}
+		if (d->comp_fir.taps) {
+			n = decim_fir_int16(&d->comp_fir, d->lowpassed, n, d->lowpassed);}
+		d->lp_len = 2 * n;
 	} else {
 		low_pass(d);
 	}
@@ -802,9 +760,11 @@ void full_demod(struct demod_state *d)
 	}
 }
 
-static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
+static void rtlsdr_callback(unsigned char *buf, uint32_t len,
+	const rtlsdr_block_info_t *info, void *ctx)
 {
 	int i;
+	uint64_t mute, valid;
 	struct dongle_state *s = ctx;
 	struct demod_state *d = s->demod_target;
 
@@ -812,10 +772,16 @@ static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 		return;}
 	if (!ctx) {
 		return;}
-	if (s->mute) {
-		for (i=0; i<s->mute; i++) {
-			buf[i] = 127;}
-		s->mute = 0;
+	/* 64 bits written by the controller thread, may tear on 32 bit */
+	pthread_rwlock_rdlock(&d->rw);
+	valid = s->valid_index;
+	pthread_rwlock_unlock(&d->rw);
+	/* silence samples taken while the tuner was settling */
+	if (info->sample_index < valid) {
+		mute = 2 * (valid - info->sample_index);
+		if (mute > len) {
+			mute = len;}
+		memset(buf, 127, (size_t)mute);
 	}
 	if (!s->offset_tuning) {
 		rotate_90(buf, len);}
@@ -831,8 +797,10 @@ static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 static void *dongle_thread_fn(void *arg)
 {
 	struct dongle_state *s = arg;
-	rtlsdr_read_async(s->dev, rtlsdr_callback, s,
+	rtlsdr_read_async_ex(s->dev, rtlsdr_callback, s,
 		DEFAULT_ASYNC_BUF_NUMBER, s->buf_len);
+	/* end of a replayed recording or a lost device */
+	do_exit = 1;
 	return 0;
 }
 
@@ -886,6 +854,8 @@ static void optimal_settings(int freq, int rate)
 	dm->downsample = (1000000 / dm->rate_in) + 1;
 	if (dm->downsample_passes) {
 		dm->downsample_passes = (int)log2(dm->downsample) + 1;
+		if (dm->downsample_passes > MAXIMUM_DOWNSAMPLE_PASSES) {
+			dm->downsample_passes = MAXIMUM_DOWNSAMPLE_PASSES;}
 		dm->downsample = 1 << dm->downsample_passes;
 	}
 	capture_freq = freq;
@@ -907,6 +877,7 @@ static void *controller_thread_fn(void *arg)
 	// thoughts for multiple dongles
 	// might be no good using a controller thread if retune/rate blocks
 	int i, r;
+	uint64_t valid;
 	struct controller_state *s = arg;
 
 	if (s->wb_mode) {
@@ -939,8 +910,12 @@ static void *controller_thread_fn(void *arg)
 		/* hacky hopping */
 		s->freq_now = (s->freq_now + 1) % s->freq_len;
 		optimal_settings(s->freqs[s->freq_now], demod.rate_in);
-		rtlsdr_set_center_freq(dongle.dev, dongle.freq);
-		dongle.mute = BUFFER_DUMP;
+		/* only this thread writes it, an unlocked read is fine */
+		valid = dongle.valid_index;
+		rtlsdr_set_center_freq_sync(dongle.dev, dongle.freq, &valid);
+		pthread_rwlock_wrlock(&demod.rw);
+		dongle.valid_index = valid;
+		pthread_rwlock_unlock(&demod.rw);
 	}
 	return 0;
 }
@@ -969,7 +944,7 @@ void dongle_init(struct dongle_state *s)
 {
 	s->rate = DEFAULT_SAMPLE_RATE;
 	s->gain = AUTO_GAIN; // tenths of a dB
-	s->mute = 0;
+	s->valid_index = 0;
 	s->direct_sampling = 0;
 	s->offset_tuning = 0;
 	s->demod_target = &demod;
@@ -985,6 +960,9 @@ void demod_init(struct demod_state *s)
 	s->squelch_hits = 11;
 	s->downsample_passes = 0;
 	s->comp_fir_size = 0;
+	memset(s->ds_fir, 0, sizeof(s->ds_fir));
+	memset(&s->comp_fir, 0, sizeof(s->comp_fir));
+	s->ds_ready = 0;
 	s->prev_index = 0;
 	s->post_downsample = 1;  // once this works, default = 4
 	s->custom_atan = 0;
@@ -1005,6 +983,10 @@ void demod_init(struct demod_state *s)
 
 void demod_cleanup(struct demod_state *s)
 {
+	int i;
+	for (i=0; i<MAXIMUM_DOWNSAMPLE_PASSES; i++) {
+		decim_fir_free(&s->ds_fir[i]);}
+	decim_fir_free(&s->comp_fir);
 	pthread_rwlock_destroy(&s->rw);
 	pthread_cond_destroy(&s->ready);
 	pthread_mutex_destroy(&s->ready_m);
@@ -1139,6 +1121,9 @@ int main(int argc, char **argv)
 		case 'F':
 			demod.downsample_passes = 1;  /* truthy placeholder */
 			demod.comp_fir_size = atoi(optarg);
+			if (demod.comp_fir_size && (!(demod.comp_fir_size & 1) || demod.comp_fir_size > 129)) {
+				fprintf(stderr, "FIR size must be 0 or odd up to 129\n");
+				exit(1);}
 			break;
 		case 'A':
 			if (strcmp("std",  optarg) == 0) {
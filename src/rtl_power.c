@@ -27,13 +27,8 @@
  * time, low, high, step, db, db, db ...
  * db optional?  raw output might be better for noise correction
  * todo:
- *	threading
  *	randomized hopping
- *	noise correction
- *	continuous IIR
  *	general astronomy usefulness
- *	multiple dongles
- *	multiple FFT workers
  *	check edge cropping for off-by-one and rounding errors
  *	1.8MS/s for hiding xtal harmonics
  */
@@ -65,26 +60,57 @@
 
 #include "rtl-sdr.h"
 #include "convenience/convenience.h"
+#include "convenience/fft.h"
+#include "convenience/power_bin.h"
+#include "convenience/hop_plan.h"
+#include "convenience/decimate.h"
+#include "convenience/noise_profile.h"
+#include "convenience/sweep_session.h"
+#include "convenience/bin_stats.h"
+#include "convenience/hop_timing.h"
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
 #define DEFAULT_BUF_LENGTH		(1 * 16384)
 #define AUTO_GAIN			-100
-#define BUFFER_DUMP			(1<<12)
 
 #define MAXIMUM_RATE			2800000
 #define MINIMUM_RATE			1000000
 
+/* small blocks waste fewer samples after a retune */
+#define STREAM_BUF_NUM			32
+#define STREAM_BUF_LENGTH		(1 * 16384)
+
+#define MAX_INTERVALS			8
+#define MAX_DONGLES			8
+
 static volatile int do_exit = 0;
-static rtlsdr_dev_t *dev = NULL;
-FILE *file;
 
 int16_t* Sinewave;
 double* power_table;
 int N_WAVE, LOG2_N_WAVE;
 int next_power;
-int16_t *fft_buf;
-int *window_coefs;
+int bin_format = -1;  /* enum power_bin_format, -1 for csv */
+
+struct event
+/* neighbouring bins over the baseline, open until they go quiet */
+{
+	int lo, hi;  /* logged bins, inclusive */
+	double peak;
+	time_t start;
+	time_t last;
+	int seen;  /* matched by the current report */
+};
+
+struct event_track
+/* one per hop and interval */
+{
+	double *base;  /* running baseline in dB, per logged bin */
+	struct event *open;
+	int count;
+	int primed;
+};
 
 struct tuning_state
 /* one per tuning range */
@@ -92,29 +118,128 @@ struct tuning_state
 	int freq;
 	int rate;
 	int bin_e;
-	long *avg;  /* length == 2^bin_e */
+	double *avg;  /* length == 2^bin_e, captures since the last fold */
 	int samples;
+	double *integ;  /* one 2^bin_e row per interval */
+	double integ_samples[MAX_INTERVALS];
 	int downsample;
 	int downsample_passes;  /* for the recursive filter */
 	double crop;
-	//pthread_rwlock_t avg_lock;
-	//pthread_mutex_t avg_mutex;
-	/* having the iq buffer here is wasteful, but will avoid contention */
-	uint8_t *buf8;
+	int keep;  /* bins each side of DC that survive the crop */
+	int offset;  /* zoom tunes the dongle this far below freq */
+	/* workers merge into avg once per capture, not per fft */
+	pthread_mutex_t avg_mutex;
 	int buf_len;
+	time_t capture_time;  /* wall clock of the last capture */
+	double *cal;  /* -N, every capture of the run */
+	double cal_samples;
+	/* -n, in fft order, applied to the reported means */
+	double *corr_gain;
+	double *corr_floor;
+	double corr_min;  /* subtracted bins bottom out here */
+	struct event_track *events;  /* -T, one per interval */
+	struct bin_stats *stats;  /* -Q, kept bins since the last report */
 	//int *comp_fir;
-	//pthread_rwlock_t buf_lock;
-	//pthread_mutex_t buf_mutex;
 };
 
-/* 3000 is enough for 3GHz b/w worst case */
-#define MAX_TUNES	3000
-struct tuning_state tunes[MAX_TUNES];
-int tune_count = 0;
+struct capture_state
+/* the usb stream runs for the whole scan, hops cut samples out of it */
+{
+	unsigned char *blk;  /* held stream block, NULL if none */
+	uint32_t blk_len;
+	uint32_t blk_pos;
+	rtlsdr_block_info_t info;
+	uint64_t valid;  /* first settled sample of the current tune */
+	/* occupancy, in microseconds */
+	uint64_t start_us;
+	uint64_t retune_us;
+	uint64_t capture_us;
+	uint64_t stall_us;
+	uint64_t discarded;
+	uint64_t settled_us;  /* -H, when the current hop copied its first sample */
+};
+
+struct integration
+/* one per -i interval, all fed from the same captures */
+{
+	int seconds;  /* also the iir time constant */
+	time_t next_tick;
+	time_t next_snapshot;  /* -T */
+	FILE *file;
+};
+
+struct report_row
+/* one hop of one report */
+{
+	double *dbm;  /* bin_count + 1 */
+	int hz_low;
+	int hz_high;
+	double hz_step;
+	double samples;
+	int bin_count;
+	time_t time;
+};
+
+struct integration intervals[MAX_INTERVALS];
+int interval_count = 0;
+int smoothing = 0;  /* 1 for iir */
+uint64_t fold_us;
+
+struct sweep_state
+/* the next sweep picks up where a report cut the last one */
+{
+	int hop;  /* next hops[] entry to capture */
+	uint64_t start_us;
+};
+
+int sweep_split = 0;  /* sweeps outlast the interval, set for good */
+
+struct power_run;
+
+struct dongle
+/* one device and its share of the hops */
+{
+	struct sweep_session *session;  /* one hop per tunes[] entry */
+	struct power_run *run;
+	int index;
+	int *hops;  /* scan order, records stay in tunes[] order */
+	int hop_count;
+	struct capture_state capture;
+	struct sweep_state sweep;
+	pthread_t thread;
+	int may_split;
+	int result;
+};
+
+struct dongle dongles[MAX_DONGLES];
+int dongle_count = 0;
 
 int boxcar = 1;
 int comp_fir_size = 0;
+int zoom = 0;
 int peak_hold = 0;
+char *noise_save_file = NULL;
+char *noise_load_file = NULL;
+int noise_subtract = 0;
+
+#define NOISE_RESIDUAL	0.01  /* 20dB under the median floor */
+
+double event_margin = 0.0;  /* dB, 0 logs full rows */
+int snapshot_seconds = 0;
+char *stats_file_name = NULL;
+FILE *stats_file = NULL;
+double stats_quantiles[BIN_STATS_MAX_QUANTILES];
+int stats_quantile_count = 0;
+char *timing_file_name = NULL;
+FILE *timing_file = NULL;
+int timing_per_hop = 0;
+int *timing_hz = NULL;
+/* the report loop logs here, dongles and workers in their own tables */
+struct hop_timing report_timing;
+struct hop_timing interval_timing;
+struct hop_timing run_timing;
+#define EVENT_BASE_REPORTS	16  /* time constant of the baseline */
+#define EVENT_BASE_SLOWDOWN	8  /* bins in an event adapt this much slower */
 
 void usage(void)
 {
@@ -125,12 +250,17 @@ void usage(void)
 		"\t (bin size is a maximum, smaller more convenient bins\n"
 		"\t  will be used.  valid range 1Hz - 2.8MHz)\n"
 		"\t[-i integration_interval (default: 10 seconds)]\n"
-		"\t (buggy if a full sweep takes longer than the interval)\n"
+		"\t (longer sweeps are split across intervals, each hop\n"
+		"\t  then logs its own capture time and sample count)\n"
+		"\t (a list like 1,10,1m integrates several at once,\n"
+		"\t  give one filename per interval)\n"
 		"\t[-1 enables single-shot mode (default: off)]\n"
 		"\t[-e exit_timer (default: off/0)]\n"
-		//"\t[-s avg/iir smoothing (default: avg)]\n"
-		//"\t[-t threads (default: 1)]\n"
+		"\t[-s avg/iir smoothing (default: avg)]\n"
+		"\t (iir never resets, the interval is its time constant)\n"
+		"\t[-t fft_threads (default: 1)]\n"
 		"\t[-d device_index (default: 0)]\n"
+		"\t (a list like 0,1,2 splits every sweep across the devices)\n"
 		"\t[-g tuner_gain (default: automatic)]\n"
 		"\t[-p ppm_error (default: 0)]\n"
 		"\tfilename (a '-' dumps samples to stdout)\n"
@@ -139,17 +269,46 @@ void usage(void)
 		"Experimental options:\n"
 		"\t[-w window (default: rectangle)]\n"
 		"\t (hamming, blackman, blackman-harris, hann-poisson, bartlett, youssef)\n"
+		"\t[-E fft_engine (default: float)]\n"
+		"\t (float, float-scalar, fixed)\n"
 		// kaiser
 		"\t[-c crop_percent (default: 0%%, recommended: 20%%-50%%)]\n"
 		"\t (discards data at the edges, 100%% discards everything)\n"
 		"\t (has no effect for bins larger than 1MHz)\n"
 		"\t[-F fir_size (default: disabled)]\n"
 		"\t (enables low-leakage downsample filter,\n"
-		"\t  fir_size can be 0 or 9.  0 has bad roll off,\n"
+		"\t  fir_size can be 0 or odd up to 129.  0 has bad roll off,\n"
 		"\t  try with '-c 50%%')\n"
+		"\t[-z enables the zoom FFT for spans under 700kHz (default: off)]\n"
+		"\t (tunes beside the span and decimates with halfband\n"
+		"\t  filters, no DC spike and far less aliasing than -F,\n"
+		"\t  always uses the float engine, try with '-c 20%%')\n"
 		"\t[-P enables peak hold (default: off)]\n"
+		"\t[-B binary_format (default: off, csv output)]\n"
+		"\t (float32 or int16 centi-dB, rtl_power_csv converts back)\n"
 		"\t[-D direct_sampling_mode, 0 (default/off), 1 (I), 2 (Q), 3 (no-mod)]\n"
 		"\t[-O enable offset tuning (default: off)]\n"
+		"\t[-N noise_file (default: off)]\n"
+		"\t (measures the per-bin noise floor and saves it on exit,\n"
+		"\t  terminate the antenna input, use the same settings as later)\n"
+		"\t[-n noise_file (default: off)]\n"
+		"\t (divides the measured response out of every hop,\n"
+		"\t  flattening roll off, the DC spike and xtal spurs)\n"
+		"\t[-S subtract the measured floor instead of dividing (default: off)]\n"
+		"\t[-T margin_dB[,snapshot_interval] (default: off)]\n"
+		"\t (logs only events, runs of bins over a running baseline,\n"
+		"\t  as: date, time, Hz low, Hz high, peak dB, seconds\n"
+		"\t  with full rows every snapshot_interval, csv only)\n"
+		"\t[-Q stats_file[,percentile,...] (default: off)]\n"
+		"\t (min, max, mean, std and percentiles of every bin over\n"
+		"\t  the single frames, at each report of the first interval,\n"
+		"\t  as: date, time, Hz low, Hz high, Hz step, samples, stat, dbm, ...\n"
+		"\t  percentiles default to 50,90)\n"
+		"\t[-H timing_file[,hops] (default: off)]\n"
+		"\t (times tune, settle, stall, read, convert, fft, merge and\n"
+		"\t  format, a json line of histograms at each report of the\n"
+		"\t  first interval and a table on stderr at exit,\n"
+		"\t  'hops' adds every hop to both)\n"
 		"\n"
 		"CSV FFT output columns:\n"
 		"\tdate, time, Hz low, Hz high, Hz step, samples, dbm, dbm, ...\n\n"
@@ -203,21 +362,74 @@ static void sighandler(int signum)
 #define safe_cond_signal(n, m) pthread_mutex_lock(m); pthread_cond_signal(n); pthread_mutex_unlock(m)
 #define safe_cond_wait(n, m) pthread_mutex_lock(m); pthread_cond_wait(n, m); pthread_mutex_unlock(m)
 
-/* {length, coef, coef, coef}  and scaled by 2^15
-   for now, only length 9, optimal way to get +85% bandwidth */
-#define CIC_TABLE_MAX 10
-int cic_9_tables[][10] = {
-	{0,},
-	{9, -156,  -97, 2798, -15489, 61019, -15489, 2798,  -97, -156},
-	{9, -128, -568, 5593, -24125, 74126, -24125, 5593, -568, -128},
-	{9, -129, -639, 6187, -26281, 77511, -26281, 6187, -639, -129},
-	{9, -122, -612, 6082, -26353, 77818, -26353, 6082, -612, -122},
-	{9, -120, -602, 6015, -26269, 77757, -26269, 6015, -602, -120},
-	{9, -120, -582, 5951, -26128, 77542, -26128, 5951, -582, -120},
-	{9, -119, -580, 5931, -26094, 77505, -26094, 5931, -580, -119},
-	{9, -119, -578, 5921, -26077, 77484, -26077, 5921, -578, -119},
-	{9, -119, -577, 5917, -26067, 77473, -26067, 5917, -577, -119},
-	{9, -199, -362, 5303, -25505, 77489, -25505, 5303, -362, -199},
+#define ZOOM_MAX_STAGES	11
+#define ZOOM_BLOCK	4096  /* complex samples per pass through the stages */
+#define CHAIN_MAX	16
+#define COMP_PASSBAND	0.4  /* flat to 80% of the decimated rate */
+
+struct chain_stage
+/* one filter of the downsample chain, every worker builds its own */
+{
+	int taps;
+	int factor;
+	double *h;
+};
+
+struct fft_worker
+/* one per thread, scratch space is never shared */
+{
+	struct power_run *run;
+	pthread_t thread;
+	uint64_t busy_us;
+	int16_t *fft_buf;
+	float *fft_float;  /* one frame */
+	double *acc;
+	float *zoom_block;  /* one block on its way down the stages */
+	float *zoom_frame;  /* collects a frame */
+	struct decim_fir chain[CHAIN_MAX];
+	double *frames;  /* -Q, the kept bins of every frame of a capture */
+	struct hop_timing timing;  /* -H */
+};
+
+struct capture_slot
+{
+	uint8_t *buf8;
+	int tune;
+};
+
+struct fft_pool
+/* the capture thread fills slots, the workers fft and return them */
+{
+	struct fft_worker *workers;
+	int worker_count;
+	struct capture_slot *slots;
+	int slot_count;
+	int *free_slots;
+	int free_count;
+	int *queue;  /* ring of filled slots, slot_count long */
+	int head;
+	int queued;
+	int exit;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t done;
+};
+
+struct power_run
+/* one scan plan and its buffers, every dongle and worker points here
+ * the per bin rows of a tune are in the session that scans it */
+{
+	struct tuning_state *tunes;
+	int tune_count;
+	struct chain_stage chain[CHAIN_MAX];
+	int chain_len;
+	int zoom_stages;
+	int *window_coefs;
+	float *window_float;
+	struct fft_plan *plan;  /* NULL selects fix_fft */
+	double *dbm_buf;  /* one report row */
+	void *bin_buf;
+	struct fft_pool pool;
 };
 
 #ifdef _MSC_VER
@@ -396,11 +608,10 @@ double bartlett(int i, int length)
 	return w;
 }
 
-void rms_power(struct tuning_state *ts)
+void rms_power(struct tuning_state *ts, uint8_t *buf)
 /* for bins between 1MHz and 2MHz */
 {
 	int i, s;
-	uint8_t *buf = ts->buf8;
 	int buf_len = ts->buf_len;
 	long p, t;
 	int ln, lp;
@@ -417,15 +628,83 @@ void rms_power(struct tuning_state *ts)
 	err = t * 2 * dc - dc * dc * buf_len;
 	p -= (long)round(err);
 
+	pthread_mutex_lock(&ts->avg_mutex);
 	if (!peak_hold) {
-		ts->avg[0] += p;
+		ts->avg[0] += (double)p;
 	} else {
-		ts->avg[0] = MAX(ts->avg[0], p);
+		ts->avg[0] = MAX(ts->avg[0], (double)p);
 	}
 	ts->samples += 1;
+	pthread_mutex_unlock(&ts->avg_mutex);
+}
+
+static void chain_add(struct power_run *run, const double *h, int taps, int factor)
+{
+	struct chain_stage *c = &run->chain[run->chain_len];
+	c->h = malloc(taps * sizeof(double));
+	if (!c->h) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	memcpy(c->h, h, taps * sizeof(double));
+	c->taps = taps;
+	c->factor = factor;
+	run->chain_len++;
 }
 
-void frequency_range(char *arg, double crop)
+static int chain_warmup(struct power_run *run)
+/* raw samples the chain eats before its first output */
+{
+	int i, rate = 1, warmup = 0;
+	for (i=0; i<run->chain_len; i++) {
+		warmup += (run->chain[i].taps - 1) * rate;
+		rate *= run->chain[i].factor;
+	}
+	return warmup;
+}
+
+int zoom_design(struct power_run *run, int stages)
+/* each stage only has to keep out what folds onto the final band,
+ * so the early ones are short and the last one is sharp
+ * returns the raw samples the chain eats before its first output */
+{
+	int s, taps;
+	double r, h[DECIM_MAX_TAPS];
+	for (s=0; s<stages; s++) {
+		/* stage input rate over the final rate */
+		r = (double)(1 << (stages - s));
+		taps = 47;
+		if (r > 2.0) {
+			taps = (int)ceil(5.5 / (0.5 - 1.0/r));}
+		taps = decim_design_halfband(h, taps);
+		chain_add(run, h, taps, 2);
+	}
+	return chain_warmup(run);
+}
+
+int downsample_design(struct power_run *run, int passes)
+/* binomial decimate by two passes, then the droop compensation
+ * returns the warm up like zoom_design() */
+{
+	int i, len;
+	double stage[DECIM_MAX_TAPS], h[DECIM_MAX_TAPS];
+	len = decim_design_cic(stage, 5, 2);
+	/* a downsample should improve resolution, so don't fully shift */
+	for (i=0; i<len; i++) {
+		h[i] = 2.0 * stage[i];}
+	for (i=0; i<passes; i++) {
+		chain_add(run, h, len, 2);}
+	if (comp_fir_size > 1) {
+		if (decim_design_comp(h, comp_fir_size, stage, len, passes, COMP_PASSBAND) < 0) {
+			fprintf(stderr, "Error: no droop compensation for %i passes.\n", passes);
+			exit(1);
+		}
+		chain_add(run, h, comp_fir_size, 1);
+	}
+	return chain_warmup(run);
+}
+
+void frequency_range(struct power_run *run, char *arg, double crop)
 /* flesh out the tunes[] for scanning */
 // do we want the fewest ranges (easy) or the fewest bins (harder)?
 {
@@ -454,17 +733,26 @@ void frequency_range(char *arg, double crop)
 		bw_used = (int)((double)(bw_seen) / (1.0 - crop));
 		if (bw_used > MAXIMUM_RATE) {
 			continue;}
-		tune_count = i;
+		run->tune_count = i;
 		break;
 	}
 	/* unless small bandwidth */
 	if (bw_used < MINIMUM_RATE) {
-		tune_count = 1;
+		run->tune_count = 1;
 		downsample = MAXIMUM_RATE / bw_used;
 		bw_used = bw_used * downsample;
 	}
-	if (!boxcar && downsample > 1) {
-		downsample_passes = (int)log2(downsample);
+	if (zoom && downsample >= 4 && max_size < MINIMUM_RATE) {
+		/* room for the span between DC and the band edge */
+		run->zoom_stages = MIN((int)log2(downsample), ZOOM_MAX_STAGES);
+		downsample = 1 << run->zoom_stages;
+		bw_used = (int)((double)(bw_seen * downsample) / (1.0 - crop));
+	} else if (zoom) {
+		fprintf(stderr, "Zoom FFT needs a span under %ikHz, using the plain FFT.\n",
+			MAXIMUM_RATE / 4000);
+	}
+	if (!boxcar && downsample > 1 && !run->zoom_stages) {
+		downsample_passes = MIN((int)log2(downsample), CHAIN_MAX - 1);
 		downsample = 1 << downsample_passes;
 		bw_used = (int)((double)(bw_seen * downsample) / (1.0 - crop));
 	}
@@ -480,94 +768,244 @@ void frequency_range(char *arg, double crop)
 	if (max_size >= MINIMUM_RATE) {
 		bw_seen = max_size;
 		bw_used = max_size;
-		tune_count = (upper - lower) / bw_seen;
+		run->tune_count = (upper - lower) / bw_seen;
 		bin_e = 0;
 		crop = 0;
 	}
-	if (tune_count > MAX_TUNES) {
-		fprintf(stderr, "Error: bandwidth too wide.\n");
-		exit(1);
-	}
 	buf_len = 2 * (1<<bin_e) * downsample;
+	/* filters only start once their first window is full */
+	if (run->zoom_stages) {
+		buf_len += 2 * zoom_design(run, run->zoom_stages);}
+	if (downsample_passes) {
+		buf_len += 2 * downsample_design(run, downsample_passes);}
 	if (buf_len < DEFAULT_BUF_LENGTH) {
 		buf_len = DEFAULT_BUF_LENGTH;
 	}
-	/* build the array */
-	for (i=0; i<tune_count; i++) {
-		ts = &tunes[i];
+	/* build the array, the bins wait for tunes_carve() */
+	run->tunes = calloc(run->tune_count, sizeof(struct tuning_state));
+	if (!run->tunes) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	for (i=0; i<run->tune_count; i++) {
+		ts = &run->tunes[i];
 		ts->freq = lower + i*bw_seen + bw_seen/2;
 		ts->rate = bw_used;
 		ts->bin_e = bin_e;
 		ts->samples = 0;
 		ts->crop = crop;
+		/* what tune_dbm() reads, bin 1 stands in for DC */
+		ts->keep = (1<<bin_e)/2 - (int)((double)(1<<bin_e) * crop * 0.5);
+		ts->keep = MIN(MAX(ts->keep, 2), (1<<bin_e)/2);
+		ts->offset = run->zoom_stages ? bw_used / 4 : 0;
 		ts->downsample = downsample;
 		ts->downsample_passes = downsample_passes;
-		ts->avg = (long*)malloc((1<<bin_e) * sizeof(long));
-		if (!ts->avg) {
-			fprintf(stderr, "Error: malloc.\n");
-			exit(1);
-		}
-		for (j=0; j<(1<<bin_e); j++) {
-			ts->avg[j] = 0L;
-		}
-		ts->buf8 = (uint8_t*)malloc(buf_len * sizeof(uint8_t));
-		if (!ts->buf8) {
-			fprintf(stderr, "Error: malloc.\n");
-			exit(1);
+		for (j=0; j<interval_count; j++) {
+			ts->integ_samples[j] = 0.0;
 		}
+		pthread_mutex_init(&ts->avg_mutex, NULL);
 		ts->buf_len = buf_len;
 	}
 	/* report */
-	fprintf(stderr, "Number of frequency hops: %i\n", tune_count);
+	fprintf(stderr, "Number of frequency hops: %i\n", run->tune_count);
 	fprintf(stderr, "Dongle bandwidth: %iHz\n", bw_used);
 	fprintf(stderr, "Downsampling by: %ix\n", downsample);
+	if (run->zoom_stages) {
+		fprintf(stderr, "Zoom FFT: %i halfband stages, tuned %iHz below the span\n",
+			run->zoom_stages, run->tunes[0].offset);}
 	fprintf(stderr, "Cropping by: %0.2f%%\n", crop*100);
-	fprintf(stderr, "Total FFT bins: %i\n", tune_count * (1<<bin_e));
+	fprintf(stderr, "Total FFT bins: %i\n", run->tune_count * (1<<bin_e));
 	fprintf(stderr, "Logged FFT bins: %i\n", \
-	  (int)((double)(tune_count * (1<<bin_e)) * (1.0-crop)));
+	  (int)((double)(run->tune_count * (1<<bin_e)) * (1.0-crop)));
 	fprintf(stderr, "FFT bin size: %0.2fHz\n", bin_size);
 	fprintf(stderr, "Buffer size: %i bytes (%0.2fms)\n", buf_len, 1000 * 0.5 * (float)buf_len / (float)bw_used);
 }
 
-void retune(rtlsdr_dev_t *d, int freq)
+static void hop_key_fill(struct dongle *dg, int i, int gain, int direct_sampling,
+			 struct hop_key *key)
 {
-	uint8_t dump[BUFFER_DUMP];
-	int n_read;
-	rtlsdr_set_center_freq(d, (uint32_t)freq);
-	/* wait for settling and flush buffer */
-	usleep(5000);
-	rtlsdr_read_sync(d, &dump, BUFFER_DUMP, &n_read);
-	if (n_read != BUFFER_DUMP) {
-		fprintf(stderr, "Error: bad retune.\n");}
+	struct tuning_state *ts = &dg->run->tunes[i];
+	key->freq = (uint32_t)(ts->freq - ts->offset);
+	key->rate = (uint32_t)ts->rate;
+	key->gain = gain;
+	key->direct_sampling = direct_sampling;
+	key->band = rtlsdr_get_tuner_band(dg->session->dev, key->freq);
 }
 
-void fifth_order(int16_t *data, int length)
-/* for half of interleaved data */
+static double order_hops(struct dongle *dg, int *subset, int count, int gain,
+			 int direct_sampling, struct hop_cost *cost)
+/* orders subset[] in place by the model timed on dg, returns its sweep cost */
 {
-	int i;
-	int a, b, c, d, e, f;
-	a = data[0];
-	b = data[2];
-	c = data[4];
-	d = data[6];
-	e = data[8];
-	f = data[10];
-	/* a downsample should improve resolution, so don't fully shift */
-	/* ease in instead of being stateful */
-	data[0] = ((a+b)*10 + (c+d)*5 + d + f) >> 4;
-	data[2] = ((b+c)*10 + (a+d)*5 + e + f) >> 4;
-	data[4] = (a + (b+e)*5 + (c+d)*10 + f) >> 4;
-	for (i=12; i<length; i+=4) {
-		a = c;
-		b = d;
-		c = e;
-		d = f;
-		e = data[i-2];
-		f = data[i];
-		data[i/2] = (a + (b+e)*5 + (c+d)*10 + f) >> 4;
+	struct hop_key *keys;
+	int i, changes = 0, *order;
+	double sweep_us;
+	keys = calloc(count, sizeof(struct hop_key));
+	order = malloc(count * sizeof(int));
+	if (!keys || !order) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	for (i=0; i<count; i++) {
+		hop_key_fill(dg, subset[i], gain, direct_sampling, &keys[i]);}
+	/* one rate and gain in the plan, measuring only moves the frequency */
+	hop_cost_measure(dg->session->dev, keys, count, cost);
+	sweep_us = hop_plan_order(keys, count, cost, order);
+	for (i=0; i<count; i++) {
+		if (keys[order[i]].band != keys[order[(i+1) % count]].band) {
+			changes++;}
+	}
+	for (i=0; i<count; i++) {
+		order[i] = subset[order[i]];}
+	memcpy(subset, order, count * sizeof(int));
+	if (count > 1) {
+		fprintf(stderr, "Hop plan: %i band changes per sweep, about %.1fms of retuning\n",
+			changes, sweep_us / 1000.0);}
+	free(keys);
+	free(order);
+	return sweep_us;
+}
+
+void plan_hops(struct power_run *run, int gain, int direct_sampling)
+/* orders all hops by the first device, cuts the tour into stretches of
+ * equal modelled time, then every device orders its own stretch */
+{
+	struct hop_key a, b;
+	struct hop_cost cost;
+	int i, d, start, *all;
+	int tune_count = run->tune_count;
+	double capture_us, total, done, *step;
+	struct dongle *dg;
+	all = malloc(tune_count * sizeof(int));
+	step = malloc(tune_count * sizeof(double));
+	if (!all || !step) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	for (i=0; i<tune_count; i++) {
+		all[i] = i;}
+	if (dongle_count > 1) {
+		fprintf(stderr, "Whole plan on device %i:\n", dongles[0].index);}
+	order_hops(&dongles[0], all, tune_count, gain, direct_sampling, &cost);
+	if (dongle_count == 1) {
+		dongles[0].hops = all;
+		dongles[0].hop_count = tune_count;
+		free(step);
+		return;
+	}
+	/* every hop costs its capture and the retune into it */
+	capture_us = 1e6 * (double)(run->tunes[0].buf_len / 2) / (double)run->tunes[0].rate;
+	total = 0.0;
+	for (i=0; i<tune_count; i++) {
+		hop_key_fill(&dongles[0], all[(i + tune_count - 1) % tune_count],
+			     gain, direct_sampling, &a);
+		hop_key_fill(&dongles[0], all[i], gain, direct_sampling, &b);
+		step[i] = capture_us + hop_transition_cost(&cost, &a, &b);
+		total += step[i];
+	}
+	start = 0;
+	done = 0.0;
+	for (d=0; d<dongle_count; d++) {
+		dg = &dongles[d];
+		dg->hops = all + start;
+		dg->hop_count = 0;
+		/* leave at least one hop for each device still to come */
+		while (start + dg->hop_count < tune_count - (dongle_count - 1 - d)
+		       && (dg->hop_count == 0 || d == dongle_count - 1
+			   || done + step[start + dg->hop_count] / 2 < total * (d + 1) / dongle_count)) {
+			done += step[start + dg->hop_count];
+			dg->hop_count++;
+		}
+		start += dg->hop_count;
+	}
+	for (d=0; d<dongle_count; d++) {
+		dg = &dongles[d];
+		fprintf(stderr, "Device %i takes %i hops:\n", dg->index, dg->hop_count);
+		order_hops(dg, dg->hops, dg->hop_count, gain, direct_sampling, &cost);
+	}
+	free(step);
+}
+
+void tunes_carve(struct power_run *run)
+/* call after plan_hops(), the avg and integ rows of a tune
+ * come from the arena of the session that scans it */
+{
+	int d, h, len;
+	size_t row;
+	struct dongle *dg;
+	struct tuning_state *ts;
+	len = 1 << run->tunes[0].bin_e;
+	row = (size_t)(1 + interval_count) * len * sizeof(double);
+	for (d=0; d<dongle_count; d++) {
+		dg = &dongles[d];
+		if (sweep_session_arena(dg->session, (size_t)dg->hop_count * (row + SWEEP_ARENA_ALIGN)) < 0) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		for (h=0; h<dg->hop_count; h++) {
+			ts = &run->tunes[dg->hops[h]];
+			ts->avg = sweep_session_carve(dg->session, row);
+			if (!ts->avg) {
+				fprintf(stderr, "Error: malloc.\n");
+				exit(1);
+			}
+			ts->integ = ts->avg + len;
+		}
 	}
 }
 
+int capture_fill(struct dongle *dg, uint8_t *dst, int len)
+/* copy len bytes of settled samples out of the stream */
+{
+	int r, fill = 0;
+	uint32_t n;
+	uint64_t index;
+	rtlsdr_dev_t *dev = dg->session->dev;
+	struct capture_state *c = &dg->capture;
+	while (fill < len) {
+		if (!c->blk) {
+			r = rtlsdr_stream_acquire_ex(dev, &c->blk, &c->blk_len, &c->info, 1000);
+			if (r == -ETIMEDOUT && do_exit < 2) {
+				continue;}
+			if (r < 0) {
+				c->blk = NULL;
+				return r;
+			}
+			c->blk_pos = 0;
+			/* never fft across a gap */
+			if (c->info.flags & RTLSDR_BLOCK_DISCONTINUITY) {
+				c->discarded += fill / 2;
+				fill = 0;
+			}
+		}
+		index = c->info.sample_index + c->blk_pos / 2;
+		if (index < c->valid) {
+			n = (uint32_t)MIN((c->valid - index) * 2, c->blk_len - c->blk_pos);
+			c->discarded += n / 2;
+		} else {
+			if (timing_file && !c->settled_us) {
+				c->settled_us = hop_timing_now();}
+			n = MIN((uint32_t)(len - fill), c->blk_len - c->blk_pos);
+			memcpy(dst + fill, c->blk + c->blk_pos, n);
+			fill += n;
+		}
+		c->blk_pos += n;
+		if (c->blk_pos >= c->blk_len) {
+			rtlsdr_stream_release(dev);
+			c->blk = NULL;
+		}
+	}
+	return 0;
+}
+
+int capture_start(struct dongle *dg)
+{
+	memset(&dg->capture, 0, sizeof(dg->capture));
+	dg->capture.start_us = hop_timing_now();
+	dg->sweep.hop = 0;
+	dg->sweep.start_us = dg->capture.start_us;
+	return rtlsdr_stream_start(dg->session->dev, STREAM_BUF_NUM, STREAM_BUF_LENGTH);
+}
+
 void remove_dc(int16_t *data, int length)
 /* works on interleaved data */
 {
@@ -585,173 +1023,1147 @@ void remove_dc(int16_t *data, int length)
 	}
 }
 
-void generic_fir(int16_t *data, int length, int *fir)
-/* Okay, not at all generic.  Assumes length 9, fix that eventually. */
+long real_conj(int16_t real, int16_t imag)
+/* real(n * conj(n)) */
+{
+	return ((long)real*(long)real + (long)imag*(long)imag);
+}
+
+static void worker_time(struct fft_worker *wk, struct tuning_state *ts, int stage, uint64_t *t)
+/* -H, logs the time since *t and restarts it */
+{
+	uint64_t now;
+	if (!timing_file) {
+		return;}
+	now = hop_timing_now();
+	hop_timing_add(&wk->timing, (int)(ts - wk->run->tunes), stage, now - *t);
+	*t = now;
+}
+
+void merge_acc(struct tuning_state *ts, double *acc, int samples,
+	       double *frames, int frame_count)
+/* one short critical section per capture */
 {
-	int d, f, temp, sum;
-	int hist[9] = {0,};
-	/* cheat on the beginning, let it go unfiltered */
-	for (d=0; d<18; d+=2) {
-		hist[d/2] = data[d];
+	int j, bin_len, keep;
+	bin_len = 1 << ts->bin_e;
+	keep = ts->keep;
+	pthread_mutex_lock(&ts->avg_mutex);
+	if (!peak_hold) {
+		for (j=0; j<bin_len; j++) {
+			if (j == keep) {
+				j = bin_len - keep;}
+			ts->avg[j] += acc[j];
+		}
+	} else {
+		for (j=0; j<bin_len; j++) {
+			if (j == keep) {
+				j = bin_len - keep;}
+			ts->avg[j] = MAX(acc[j], ts->avg[j]);
+		}
 	}
-	for (d=18; d<length; d+=2) {
-		temp = data[d];
-		sum = 0;
-		sum += (hist[0] + hist[8]) * fir[1];
-		sum += (hist[1] + hist[7]) * fir[2];
-		sum += (hist[2] + hist[6]) * fir[3];
-		sum += (hist[3] + hist[5]) * fir[4];
-		sum +=            hist[4]  * fir[5];
-		data[d] = (int16_t)(sum >> 15) ;
-		hist[0] = hist[1];
-		hist[1] = hist[2];
-		hist[2] = hist[3];
-		hist[3] = hist[4];
-		hist[4] = hist[5];
-		hist[5] = hist[6];
-		hist[6] = hist[7];
-		hist[7] = hist[8];
-		hist[8] = temp;
+	ts->samples += samples;
+	if (frames && ts->stats) {
+		bin_stats_push(ts->stats, frames, frame_count);}
+	pthread_mutex_unlock(&ts->avg_mutex);
+}
+
+static void stats_frame_float(double *row, const float *ff, int bin_len, int keep, double scale)
+/* kept bins of one frame, as power per raw sample */
+{
+	int j;
+	for (j=0; j<bin_len; j++) {
+		if (j == keep) {
+			j = bin_len - keep;}
+		*row++ = ((double)ff[j*2] * ff[j*2] + (double)ff[j*2+1] * ff[j*2+1]) * scale;
 	}
 }
 
-void downsample_iq(int16_t *data, int length)
+static void stats_frame_fixed(double *row, const int16_t *buf, int bin_len, int keep, double scale)
 {
-	fifth_order(data, length);
-	//remove_dc(data, length);
-	fifth_order(data+1, length-1);
-	//remove_dc(data+1, length-1);
+	int j;
+	for (j=0; j<bin_len; j++) {
+		if (j == keep) {
+			j = bin_len - keep;}
+		*row++ = (double)real_conj(buf[j*2], buf[j*2+1]) * scale;
+	}
 }
 
-long real_conj(int16_t real, int16_t imag)
-/* real(n * conj(n)) */
+void zoom_tune(struct tuning_state *ts, uint8_t *buf8, struct fft_worker *wk)
+/* rotate the span down from fs/4, halve the rate once per stage,
+ * then fft the narrow stream frame by frame */
 {
-	return ((long)real*(long)real + (long)imag*(long)imag);
+	int i, j, s, n, pos, len, fill, bin_len, keep, frames;
+	float re, im;
+	struct power_run *run = wk->run;
+	float *out = wk->zoom_block;
+	float *frame = wk->zoom_frame;
+	float *ff = wk->fft_float;
+	double *acc = wk->acc;
+	double scale, pw;
+	uint64_t t = timing_file ? hop_timing_now() : 0;
+	bin_len = 1 << ts->bin_e;
+	keep = ts->keep;
+	len = ts->buf_len / 2;
+	for (s=0; s<run->chain_len; s++) {
+		decim_fir_reset(&wk->chain[s]);}
+	memset(acc, 0, bin_len * sizeof(double));
+	fill = 0;
+	frames = 0;
+	/* unity gain filters, samples counts raw samples */
+	scale = (double)ts->downsample / ((double)bin_len * (double)bin_len);
+	for (pos=0; pos<len; pos+=ZOOM_BLOCK) {
+		n = MIN(ZOOM_BLOCK, len - pos);
+		for (i=0; i<n; i++) {
+			re = (float)buf8[2*(pos+i)]   - 127.5f;
+			im = (float)buf8[2*(pos+i)+1] - 127.5f;
+			/* times e^(-i*pi*n/2) */
+			switch ((pos+i) & 3) {
+			case 0:
+				out[2*i] = re;  out[2*i+1] = im;  break;
+			case 1:
+				out[2*i] = im;  out[2*i+1] = -re; break;
+			case 2:
+				out[2*i] = -re; out[2*i+1] = -im; break;
+			default:
+				out[2*i] = -im; out[2*i+1] = re;  break;
+			}
+		}
+		for (s=0; s<run->chain_len; s++) {
+			n = decim_fir_float(&wk->chain[s], out, n, out);}
+		memcpy(frame + 2*fill, out, 2 * n * sizeof(float));
+		fill += n;
+		while (fill >= bin_len) {
+			frames++;
+			for (j=0; j<2*bin_len; j+=2) {
+				ff[j]   = frame[j]   * run->window_float[j/2];
+				ff[j+1] = frame[j+1] * run->window_float[j/2];
+			}
+			fft_execute_band(run->plan, ff, keep);
+			for (j=0; j<bin_len; j++) {
+				if (j == keep) {
+					j = bin_len - keep;}
+				pw = ((double)ff[j*2] * ff[j*2] + (double)ff[j*2+1] * ff[j*2+1]) * scale;
+				acc[j] = peak_hold ? MAX(pw, acc[j]) : acc[j] + pw;
+			}
+			if (wk->frames) {
+				stats_frame_float(wk->frames + (size_t)(frames-1) * 2 * keep, ff,
+						  bin_len, keep, scale / (double)ts->downsample);}
+			fill -= bin_len;
+			memmove(frame, frame + 2*bin_len, 2 * fill * sizeof(float));
+		}
+	}
+	/* the mixer and the stages run inside the frame loop, all of it is fft */
+	worker_time(wk, ts, HOP_TIMING_FFT, &t);
+	merge_acc(ts, acc, ts->downsample * frames, wk->frames, frames);
+	worker_time(wk, ts, HOP_TIMING_MERGE, &t);
 }
 
-void scanner(void)
+void fft_tune(struct tuning_state *ts, uint8_t *buf8, struct fft_worker *wk)
+/* bins lost to the crop are neither summed nor, for the float fft,
+ * computed where that saves butterflies */
 {
-	int i, j, j2, f, n_read, offset, bin_e, bin_len, buf_len, ds, ds_p;
+	int j, j2, n, offset, bin_e, bin_len, buf_len, out_len, ds, ds_p, frames, keep;
 	int32_t w;
-	struct tuning_state *ts;
-	bin_e = tunes[0].bin_e;
+	struct power_run *run = wk->run;
+	int16_t *fft_buf = wk->fft_buf;
+	float *ff = wk->fft_float;
+	double *acc = wk->acc;
+	double scale, pw;
+	uint64_t t;
+	bin_e = ts->bin_e;
 	bin_len = 1 << bin_e;
-	buf_len = tunes[0].buf_len;
-	for (i=0; i<tune_count; i++) {
-		if (do_exit >= 2)
-			{return;}
-		ts = &tunes[i];
-		f = (int)rtlsdr_get_center_freq(dev);
-		if (f != ts->freq) {
-			retune(dev, ts->freq);}
-		rtlsdr_read_sync(dev, ts->buf8, buf_len, &n_read);
-		if (n_read != buf_len) {
-			fprintf(stderr, "Error: dropped samples.\n");}
-		/* rms */
-		if (bin_len == 1) {
-			rms_power(ts);
-			continue;
+	buf_len = ts->buf_len;
+	keep = ts->keep;
+	t = timing_file ? hop_timing_now() : 0;
+	/* rms */
+	if (bin_len == 1) {
+		rms_power(ts, buf8);
+		worker_time(wk, ts, HOP_TIMING_FFT, &t);
+		return;
+	}
+	if (run->zoom_stages) {
+		zoom_tune(ts, buf8, wk);
+		return;
+	}
+	/* prep for fft */
+	for (j=0; j<buf_len; j++) {
+		fft_buf[j] = (int16_t)buf8[j] - 127;
+	}
+	ds = ts->downsample;
+	ds_p = ts->downsample_passes;
+	out_len = buf_len / ds;
+	if (boxcar && ds > 1) {
+		j=2, j2=0;
+		while (j < buf_len) {
+			fft_buf[j2]   += fft_buf[j];
+			fft_buf[j2+1] += fft_buf[j+1];
+			fft_buf[j] = 0;
+			fft_buf[j+1] = 0;
+			j += 2;
+			if (j % (ds*2) == 0) {
+				j2 += 2;}
 		}
-		/* prep for fft */
-		for (j=0; j<buf_len; j++) {
-			fft_buf[j] = (int16_t)ts->buf8[j] - 127;
-		}
-		ds = ts->downsample;
-		ds_p = ts->downsample_passes;
-		if (boxcar && ds > 1) {
-			j=2, j2=0;
-			while (j < buf_len) {
-				fft_buf[j2]   += fft_buf[j];
-				fft_buf[j2+1] += fft_buf[j+1];
-				fft_buf[j] = 0;
-				fft_buf[j+1] = 0;
-				j += 2;
-				if (j % (ds*2) == 0) {
-					j2 += 2;}
-			}
-		} else if (ds_p) {  /* recursive */
-			for (j=0; j < ds_p; j++) {
-				downsample_iq(fft_buf, buf_len >> j);
+	} else if (ds_p) {  /* recursive, then the droop compensation */
+		n = buf_len / 2;
+		for (j=0; j<run->chain_len; j++) {
+			decim_fir_reset(&wk->chain[j]);
+			n = decim_fir_int16(&wk->chain[j], fft_buf, n, fft_buf);
+		}
+		/* whole frames only */
+		out_len = 2 * (n >> bin_e << bin_e);
+	}
+	remove_dc(fft_buf, out_len);
+	remove_dc(fft_buf+1, out_len - 1);
+	worker_time(wk, ts, HOP_TIMING_CONVERT, &t);
+	/* window function and fft, summed privately */
+	memset(acc, 0, bin_len * sizeof(double));
+	frames = 0;
+	/* same scale as fix_fft, which halves on every stage */
+	scale = 1.0 / ((double)bin_len * (double)bin_len);
+	for (offset=0; offset<out_len; offset+=(2*bin_len)) {
+		frames++;
+		if (run->plan) {
+			for (j=0; j<bin_len; j++) {
+				ff[j*2]   = (float)fft_buf[offset+j*2]   * run->window_float[j];
+				ff[j*2+1] = (float)fft_buf[offset+j*2+1] * run->window_float[j];
 			}
-			/* droop compensation */
-			if (comp_fir_size == 9 && ds_p <= CIC_TABLE_MAX) {
-				generic_fir(fft_buf, buf_len >> j, cic_9_tables[ds_p]);
-				generic_fir(fft_buf+1, (buf_len >> j)-1, cic_9_tables[ds_p]);
+			fft_execute_band(run->plan, ff, keep);
+			for (j=0; j<bin_len; j++) {
+				if (j == keep) {
+					j = bin_len - keep;}
+				pw = ((double)ff[j*2] * ff[j*2] + (double)ff[j*2+1] * ff[j*2+1]) * scale;
+				acc[j] = peak_hold ? MAX(pw, acc[j]) : acc[j] + pw;
 			}
+			if (wk->frames) {
+				stats_frame_float(wk->frames + (size_t)(frames-1) * 2 * keep, ff,
+						  bin_len, keep, scale / (double)ds);}
+			continue;
 		}
-		remove_dc(fft_buf, buf_len / ds);
-		remove_dc(fft_buf+1, (buf_len / ds) - 1);
-		/* window function and fft */
-		for (offset=0; offset<(buf_len/ds); offset+=(2*bin_len)) {
-			// todo, let rect skip this
+		// todo, let rect skip this
+		for (j=0; j<bin_len; j++) {
+			w =  (int32_t)fft_buf[offset+j*2];
+			w *= (int32_t)(run->window_coefs[j]);
+			//w /= (int32_t)(ds);
+			fft_buf[offset+j*2]   = (int16_t)w;
+			w =  (int32_t)fft_buf[offset+j*2+1];
+			w *= (int32_t)(run->window_coefs[j]);
+			//w /= (int32_t)(ds);
+			fft_buf[offset+j*2+1] = (int16_t)w;
+		}
+		fix_fft(fft_buf+offset, bin_e);
+		if (!peak_hold) {
 			for (j=0; j<bin_len; j++) {
-				w =  (int32_t)fft_buf[offset+j*2];
-				w *= (int32_t)(window_coefs[j]);
-				//w /= (int32_t)(ds);
-				fft_buf[offset+j*2]   = (int16_t)w;
-				w =  (int32_t)fft_buf[offset+j*2+1];
-				w *= (int32_t)(window_coefs[j]);
-				//w /= (int32_t)(ds);
-				fft_buf[offset+j*2+1] = (int16_t)w;
+				if (j == keep) {
+					j = bin_len - keep;}
+				acc[j] += real_conj(fft_buf[offset+j*2], fft_buf[offset+j*2+1]);
 			}
-			fix_fft(fft_buf+offset, bin_e);
-			if (!peak_hold) {
-				for (j=0; j<bin_len; j++) {
-					ts->avg[j] += real_conj(fft_buf[offset+j*2], fft_buf[offset+j*2+1]);
-				}
-			} else {
-				for (j=0; j<bin_len; j++) {
-					ts->avg[j] = MAX(real_conj(fft_buf[offset+j*2], fft_buf[offset+j*2+1]), ts->avg[j]);
-				}
+		} else {
+			for (j=0; j<bin_len; j++) {
+				if (j == keep) {
+					j = bin_len - keep;}
+				acc[j] = MAX(real_conj(fft_buf[offset+j*2], fft_buf[offset+j*2+1]), acc[j]);
 			}
-			ts->samples += ds;
 		}
+		if (wk->frames) {
+			stats_frame_fixed(wk->frames + (size_t)(frames-1) * 2 * keep, fft_buf+offset,
+					  bin_len, keep, 1.0 / (double)ds);}
 	}
+	worker_time(wk, ts, HOP_TIMING_FFT, &t);
+	merge_acc(ts, acc, ds * frames, wk->frames, frames);
+	worker_time(wk, ts, HOP_TIMING_MERGE, &t);
 }
 
-void csv_dbm(struct tuning_state *ts)
+static void *fft_worker_fn(void *arg)
 {
-	int i, len, ds, i1, i2, bw2, bin_count;
-	long tmp;
-	double dbm;
+	struct fft_worker *wk = arg;
+	struct fft_pool *pool = &wk->run->pool;
+	struct capture_slot *slot;
+	uint64_t t;
+	int n;
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->queued && !pool->exit) {
+			pthread_cond_wait(&pool->ready, &pool->lock);}
+		if (!pool->queued) {
+			break;}
+		n = pool->queue[pool->head];
+		pool->head = (pool->head + 1) % pool->slot_count;
+		pool->queued--;
+		pthread_mutex_unlock(&pool->lock);
+		slot = &pool->slots[n];
+		t = hop_timing_now();
+		fft_tune(&wk->run->tunes[slot->tune], slot->buf8, wk);
+		wk->busy_us += hop_timing_now() - t;
+		pthread_mutex_lock(&pool->lock);
+		pool->free_slots[pool->free_count++] = n;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+void fft_pool_start(struct power_run *run, int threads)
+{
+	int i, k, buf_len, bin_len;
+	struct fft_worker *wk;
+	struct fft_pool *pool = &run->pool;
+	buf_len = run->tunes[0].buf_len;
+	bin_len = 1 << run->tunes[0].bin_e;
+	if (threads < 1) {
+		threads = 1;}
+	pool->worker_count = threads;
+	/* enough for every worker to be busy while the next one fills */
+	pool->slot_count = 2 * threads + dongle_count;
+	pool->workers = calloc(threads, sizeof(struct fft_worker));
+	pool->slots = calloc(pool->slot_count, sizeof(struct capture_slot));
+	pool->free_slots = malloc(pool->slot_count * sizeof(int));
+	pool->queue = malloc(pool->slot_count * sizeof(int));
+	if (!pool->workers || !pool->slots || !pool->free_slots || !pool->queue) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	for (i=0; i<pool->slot_count; i++) {
+		pool->slots[i].buf8 = malloc(buf_len * sizeof(uint8_t));
+		if (!pool->slots[i].buf8) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		pool->free_slots[i] = i;
+	}
+	pool->free_count = pool->slot_count;
+	pool->head = pool->queued = pool->exit = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->ready, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (i=0; i<threads; i++) {
+		wk = &pool->workers[i];
+		wk->run = run;
+		/* zoom never widens the raw capture to int16 */
+		if (!run->zoom_stages) {
+			wk->fft_buf = malloc(buf_len * sizeof(int16_t));}
+		wk->fft_float = malloc(2 * bin_len * sizeof(float));
+		wk->acc = malloc(bin_len * sizeof(double));
+		if (run->zoom_stages) {
+			wk->zoom_block = malloc(2 * ZOOM_BLOCK * sizeof(float));
+			wk->zoom_frame = malloc(2 * (bin_len + ZOOM_BLOCK) * sizeof(float));
+		}
+		if (timing_file && hop_timing_init(&wk->timing, run->tune_count) < 0) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		if (stats_file) {
+			/* zoom makes fewer frames than this */
+			wk->frames = malloc(((size_t)buf_len / (2 * bin_len) + 1) * 2 * run->tunes[0].keep * sizeof(double));
+			if (!wk->frames) {
+				fprintf(stderr, "Error: malloc.\n");
+				exit(1);
+			}
+		}
+		for (k=0; k<run->chain_len; k++) {
+			if (decim_fir_init(&wk->chain[k], run->chain[k].h, run->chain[k].taps,
+					   run->chain[k].factor) < 0) {
+				fprintf(stderr, "Error: malloc.\n");
+				exit(1);
+			}
+		}
+		if ((!wk->fft_buf && !run->zoom_stages) || !wk->fft_float || !wk->acc
+		    || (run->zoom_stages && (!wk->zoom_block || !wk->zoom_frame))) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		pthread_create(&pool->workers[i].thread, NULL, fft_worker_fn, &pool->workers[i]);
+	}
+}
+
+void fft_pool_drain(struct power_run *run)
+/* wait until every capture has been merged into its tune */
+{
+	struct fft_pool *pool = &run->pool;
+	pthread_mutex_lock(&pool->lock);
+	while (pool->free_count < pool->slot_count) {
+		pthread_cond_wait(&pool->done, &pool->lock);}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void fft_pool_stop(struct power_run *run)
+{
+	int i, k;
+	struct fft_pool *pool = &run->pool;
+	pthread_mutex_lock(&pool->lock);
+	pool->exit = 1;
+	pthread_cond_broadcast(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+	for (i=0; i<pool->worker_count; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+		free(pool->workers[i].fft_buf);
+		free(pool->workers[i].fft_float);
+		free(pool->workers[i].acc);
+		free(pool->workers[i].zoom_block);
+		free(pool->workers[i].zoom_frame);
+		free(pool->workers[i].frames);
+		hop_timing_free(&pool->workers[i].timing);
+		for (k=0; k<run->chain_len; k++) {
+			decim_fir_free(&pool->workers[i].chain[k]);}
+	}
+	for (i=0; i<pool->slot_count; i++) {
+		free(pool->slots[i].buf8);}
+	free(pool->workers);
+	free(pool->slots);
+	free(pool->free_slots);
+	free(pool->queue);
+	pthread_cond_destroy(&pool->ready);
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+int report_due(time_t now)
+{
+	int k;
+	for (k=0; k<interval_count; k++) {
+		if (now >= intervals[k].next_tick) {
+			return 1;}
+	}
+	return 0;
+}
+
+int shortest_interval(void)
+{
+	int k, s = intervals[0].seconds;
+	for (k=1; k<interval_count; k++) {
+		s = MIN(s, intervals[k].seconds);}
+	return s;
+}
+
+int scanner(struct dongle *dg, int may_split)
+/* capture only, the fft workers do the rest
+ * returns at the end of the sweep, or at a due report once the
+ * sweep has run longer than an interval, the next call resumes */
+{
+	int i, n, r, buf_len;
+	uint64_t t0, t1, t2;
+	struct tuning_state *ts;
+	struct capture_slot *slot;
+	struct fft_pool *pool = &dg->run->pool;
+	struct sweep_state *sweep = &dg->sweep;
+	struct capture_state *capture = &dg->capture;
+	buf_len = dg->run->tunes[0].buf_len;
+	while (sweep->hop < dg->hop_count) {
+		if (do_exit >= 2)
+			{return 0;}
+		i = dg->hops[sweep->hop++];
+		ts = &dg->run->tunes[i];
+		t0 = hop_timing_now();
+		/* waits for PLL lock, capture_fill() skips the stale samples */
+		if (sweep_session_apply(dg->session, i, &capture->valid) < 0) {
+			fprintf(stderr, "Error: bad retune.\n");}
+		/* only blocks when every worker is behind */
+		t1 = hop_timing_now();
+		capture->retune_us += t1 - t0;
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->free_count) {
+			pthread_cond_wait(&pool->done, &pool->lock);}
+		n = pool->free_slots[--pool->free_count];
+		pthread_mutex_unlock(&pool->lock);
+		t0 = hop_timing_now();
+		capture->stall_us += t0 - t1;
+		slot = &pool->slots[n];
+		slot->tune = i;
+		capture->settled_us = 0;
+		r = capture_fill(dg, slot->buf8, buf_len);
+		t2 = hop_timing_now();
+		capture->capture_us += t2 - t0;
+		if (timing_file && r >= 0) {
+			/* the session logged the retune itself */
+			hop_timing_add(dg->session->timing, i, HOP_TIMING_STALL, t0 - t1);
+			hop_timing_add(dg->session->timing, i, HOP_TIMING_SETTLE, capture->settled_us - t0);
+			hop_timing_add(dg->session->timing, i, HOP_TIMING_READ, t2 - capture->settled_us);
+		}
+		pthread_mutex_lock(&pool->lock);
+		if (r < 0) {
+			pool->free_slots[pool->free_count++] = n;
+			pthread_mutex_unlock(&pool->lock);
+			return do_exit >= 2 ? 0 : r;
+		}
+		pool->queue[(pool->head + pool->queued) % pool->slot_count] = n;
+		pool->queued++;
+		pthread_cond_signal(&pool->ready);
+		pthread_mutex_unlock(&pool->lock);
+		ts->capture_time = time(NULL);
+		/* round robin, the hops after this one go first next time */
+		if (may_split && sweep->hop < dg->hop_count && report_due(ts->capture_time)
+		    && hop_timing_now() - sweep->start_us >= (uint64_t)shortest_interval() * 1000000) {
+			sweep_split = 1;
+			return 0;
+		}
+	}
+	sweep->hop = 0;
+	sweep->start_us = hop_timing_now();
+	return 0;
+}
+
+static void *dongle_thread_fn(void *arg)
+{
+	struct dongle *dg = arg;
+	dg->result = scanner(dg, dg->may_split);
+	return 0;
+}
+
+int scan_all(int may_split)
+/* one sweep on every device at once, so a report covers the same
+ * stretch of time everywhere */
+{
+	int d, r = 0;
+	if (dongle_count == 1) {
+		return scanner(&dongles[0], may_split);}
+	for (d=0; d<dongle_count; d++) {
+		dongles[d].may_split = may_split;
+		pthread_create(&dongles[d].thread, NULL, dongle_thread_fn, &dongles[d]);
+	}
+	for (d=0; d<dongle_count; d++) {
+		pthread_join(dongles[d].thread, NULL);
+		if (dongles[d].result < 0) {
+			r = dongles[d].result;}
+	}
+	return r;
+}
+
+void occupancy_report(struct power_run *run)
+/* call with the pool drained */
+{
+	int i, d;
+	double wall, busy = 0.0;
+	struct capture_state *c;
+	struct fft_pool *pool = &run->pool;
+	for (i=0; i<pool->worker_count; i++) {
+		busy += (double)pool->workers[i].busy_us;}
+	for (d=0; d<dongle_count; d++) {
+		c = &dongles[d].capture;
+		wall = (double)(hop_timing_now() - c->start_us);
+		if (wall <= 0.0) {
+			continue;}
+		if (dongle_count > 1) {
+			fprintf(stderr, "Device %i: ", dongles[d].index);}
+		fprintf(stderr, "Pipeline occupancy over %.1fs: retune %.1f%%, capture %.1f%%, "
+			"stalled on fft %.1f%%, %i fft workers %.1f%% busy\n", wall / 1e6,
+			100.0 * (double)c->retune_us / wall,
+			100.0 * (double)c->capture_us / wall,
+			100.0 * (double)c->stall_us / wall,
+			pool->worker_count, 100.0 * busy / (wall * pool->worker_count));
+		fprintf(stderr, "Settling samples discarded: %llu, stream overruns: %u\n",
+			(unsigned long long)c->discarded, rtlsdr_stream_get_overruns(dongles[d].session->dev));
+	}
+}
+
+void integrate(struct tuning_state *ts, double dt)
+/* folds the fresh captures into every interval
+ * iir decays the old sums first, avg is the plain boxcar */
+{
+	int i, k, len;
+	double decay;
+	double *sum;
+	len = 1 << ts->bin_e;
+	pthread_mutex_lock(&ts->avg_mutex);
+	for (k=0; k<interval_count; k++) {
+		decay = 1.0;
+		if (smoothing) {
+			decay = exp(-dt / (double)intervals[k].seconds);}
+		sum = ts->integ + k * len;
+		if (!peak_hold) {
+			for (i=0; i<len; i++) {
+				sum[i] = sum[i] * decay + ts->avg[i];}
+		} else {
+			for (i=0; i<len; i++) {
+				sum[i] = MAX(sum[i] * decay, ts->avg[i]);}
+		}
+		ts->integ_samples[k] = ts->integ_samples[k] * decay + (double)ts->samples;
+	}
+	if (ts->cal) {
+		for (i=0; i<len; i++) {
+			ts->cal[i] += ts->avg[i];}
+		ts->cal_samples += (double)ts->samples;
+	}
+	for (i=0; i<len; i++) {
+		ts->avg[i] = 0.0;
+	}
+	ts->samples = 0;
+	pthread_mutex_unlock(&ts->avg_mutex);
+}
+
+void integrate_all(struct power_run *run)
+{
+	int i;
+	uint64_t now = hop_timing_now();
+	for (i=0; i<run->tune_count; i++) {
+		integrate(&run->tunes[i], (double)(now - fold_us) / 1e6);
+	}
+	fold_us = now;
+}
+
+static double bin_correct(struct tuning_state *ts, double p, int j)
+/* -n, for a power per Hz of bin j */
+{
+	if (!ts->corr_gain) {
+		return p;}
+	p = p * ts->corr_gain[j] - ts->corr_floor[j];
+	return MAX(p, ts->corr_min);
+}
+
+static double bin_power(struct tuning_state *ts, double *sum, int j, double samples)
+/* mean power per Hz of one bin, corrected by -n */
+{
+	double p;
+	p = sum[j] / (double)ts->rate;
+	p /= samples;
+	return bin_correct(ts, p, j);
+}
+
+void tune_axis(struct tuning_state *ts, struct report_row *row)
+{
+	int len, bin_count, bw2;
 	len = 1 << ts->bin_e;
-	ds = ts->downsample;
-	/* fix FFT stuff quirks */
-	if (ts->bin_e > 0) {
-		/* nuke DC component (not effective for all windows) */
-		ts->avg[0] = ts->avg[1];
-		/* FFT is translated by 180 degrees */
-		for (i=0; i<len/2; i++) {
-			tmp = ts->avg[i];
-			ts->avg[i] = ts->avg[i+len/2];
-			ts->avg[i+len/2] = tmp;
-		}
-	}
-	/* Hz low, Hz high, Hz step, samples, dbm, dbm, ... */
 	bin_count = (int)((double)len * (1.0 - ts->crop));
-	bw2 = (int)(((double)ts->rate * (double)bin_count) / (len * 2 * ds));
-	fprintf(file, "%i, %i, %.2f, %i, ", ts->freq - bw2, ts->freq + bw2,
-		(double)ts->rate / (double)(len*ds), ts->samples);
+	bw2 = (int)(((double)ts->rate * (double)bin_count) / (len * 2 * ts->downsample));
+	row->hz_low = ts->freq - bw2;
+	row->hz_high = ts->freq + bw2;
+	row->hz_step = (double)ts->rate / (double)(len * ts->downsample);
+}
+
+void tune_dbm(struct tuning_state *ts, int k, struct report_row *row)
+/* converts the cropped bins of interval k into row->dbm, avg resets it
+ * row->dbm[row->bin_count] is the extra last csv column */
+{
+	int i, j, len, i1, i2, half;
+	double dbm, samples;
+	double *sum;
+	len = 1 << ts->bin_e;
+	sum = ts->integ + k * len;
+	samples = ts->integ_samples[k];
+	row->samples = samples;
+	/* fix FFT stuff quirks without touching the sums:
+	 * the FFT is translated by 180 degrees and the DC
+	 * component is nuked (not effective for all windows)
+	 * unless a noise profile corrects it properly */
+	half = ts->bin_e > 0 ? len/2 : 0;
+	tune_axis(ts, row);
 	// something seems off with the dbm math
 	i1 = 0 + (int)((double)len * ts->crop * 0.5);
 	i2 = (len-1) - (int)((double)len * ts->crop * 0.5);
+	j = 0;
 	for (i=i1; i<=i2; i++) {
-		dbm  = (double)ts->avg[i];
-		dbm /= (double)ts->rate;
-		dbm /= (double)ts->samples;
-		dbm  = 10 * log10(dbm);
-		fprintf(file, "%.2f, ", dbm);
-	}
-	dbm = (double)ts->avg[i2] / ((double)ts->rate * (double)ts->samples);
-	if (ts->bin_e == 0) {
-		dbm = ((double)ts->avg[0] / \
-		((double)ts->rate * (double)ts->samples));}
-	dbm  = 10 * log10(dbm);
-	fprintf(file, "%.2f\n", dbm);
-	for (i=0; i<len; i++) {
-		ts->avg[i] = 0L;
+		j = (i + half) % len;
+		if (half && j == 0 && !ts->corr_gain) {
+			j = 1;}
+		dbm = bin_power(ts, sum, j, samples);
+		row->dbm[i-i1] = 10 * log10(dbm);
+	}
+	dbm = bin_power(ts, sum, j, samples);
+	row->dbm[i2-i1+1] = 10 * log10(dbm);
+	if (!smoothing) {
+		for (i=0; i<len; i++) {
+			sum[i] = 0.0;
+		}
+		ts->integ_samples[k] = 0.0;
+	}
+	row->bin_count = i2 - i1 + 1;
+}
+
+void csv_dbm(FILE *file, struct report_row *row)
+{
+	int i, n = row->bin_count;
+	char t_str[50];
+	struct tm *cal_time;
+	cal_time = localtime(&row->time);
+	strftime(t_str, 50, "%Y-%m-%d, %H:%M:%S", cal_time);
+	/* date, time, Hz low, Hz high, Hz step, samples, dbm, dbm, ... */
+	fprintf(file, "%s, %i, %i, %.2f, %i, ", t_str, row->hz_low, row->hz_high,
+		row->hz_step, (int)round(row->samples));
+	for (i=0; i<n; i++) {
+		fprintf(file, "%.2f, ", row->dbm[i]);
+	}
+	fprintf(file, "%.2f\n", row->dbm[n]);
+}
+
+void bin_dbm(FILE *file, struct report_row *row, void *bin_buf)
+/* same data as csv_dbm(), as one power_bin_record
+ * bin_buf holds a float per bin and 8 bytes of padding */
+{
+	struct power_bin_record rec;
+	int i, size, n = row->bin_count;
+	double v;
+	float *f32 = (float*)bin_buf;
+	int16_t *i16 = (int16_t*)bin_buf;
+	memset(&rec, 0, sizeof(rec));
+	rec.samples = (int32_t)round(row->samples);
+	rec.hz_step = row->hz_step;
+	size = n * (bin_format == POWER_BIN_FLOAT32 ? sizeof(float) : sizeof(int16_t));
+	size = (size + 7) & ~7;
+	memset(bin_buf, 0, size);
+	for (i=0; i<n; i++) {
+		if (bin_format == POWER_BIN_FLOAT32) {
+			f32[i] = (float)row->dbm[i];
+			continue;
+		}
+		v = round(row->dbm[i] * 100.0);
+		if (!(v > (double)POWER_BIN_NO_POWER)) {  /* also nan */
+			i16[i] = POWER_BIN_NO_POWER;
+		} else if (v > (double)INT16_MAX) {
+			i16[i] = INT16_MAX;
+		} else {
+			i16[i] = (int16_t)v;}
+	}
+	rec.magic = POWER_BIN_MAGIC;
+	rec.version = POWER_BIN_VERSION;
+	rec.format = (uint16_t)bin_format;
+	rec.record_len = (uint32_t)(sizeof(rec) + size);
+	rec.bin_count = (uint32_t)n;
+	rec.time = (int64_t)row->time;
+	rec.hz_low = row->hz_low;
+	rec.hz_high = row->hz_high;
+	fwrite(&rec, sizeof(rec), 1, file);
+	fwrite(bin_buf, size, 1, file);
+}
+
+void events_start(struct power_run *run)
+{
+	int i, k, len;
+	struct event_track *tr;
+	len = 1 << run->tunes[0].bin_e;
+	for (i=0; i<run->tune_count; i++) {
+		run->tunes[i].events = calloc(interval_count, sizeof(struct event_track));
+		if (!run->tunes[i].events) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		for (k=0; k<interval_count; k++) {
+			tr = &run->tunes[i].events[k];
+			/* runs in one report are apart, so at most half the bins each */
+			tr->base = malloc(len * sizeof(double));
+			tr->open = malloc((len + 2) * sizeof(struct event));
+			if (!tr->base || !tr->open) {
+				fprintf(stderr, "Error: malloc.\n");
+				exit(1);
+			}
+		}
+	}
+}
+
+static void event_emit(FILE *file, struct report_row *row, struct event *ev, int seconds)
+/* the event started one interval before the report that first saw it */
+{
+	char t_str[50];
+	time_t t = ev->start - seconds;
+	struct tm *cal_time;
+	cal_time = localtime(&t);
+	strftime(t_str, 50, "%Y-%m-%d, %H:%M:%S", cal_time);
+	fprintf(file, "%s, %i, %i, %.2f, %i\n", t_str,
+		row->hz_low + (int)round(ev->lo * row->hz_step),
+		row->hz_low + (int)round((ev->hi + 1) * row->hz_step),
+		ev->peak, (int)(ev->last - ev->start) + seconds);
+}
+
+void event_dbm(FILE *file, struct tuning_state *ts, int k, struct report_row *row)
+/* grows the open events by this report's runs, logs the ones that ended */
+{
+	int i, m, lo, hi, n = row->bin_count;
+	double peak, a;
+	struct event *ev, *e;
+	struct event_track *tr = &ts->events[k];
+	if (!tr->primed) {
+		for (i=0; i<n; i++) {
+			tr->base[i] = row->dbm[i];}
+		tr->primed = 1;
+		return;
+	}
+	for (m=0; m<tr->count; m++) {
+		tr->open[m].seen = 0;}
+	i = 0;
+	while (i < n) {
+		if (!(row->dbm[i] > tr->base[i] + event_margin)) {
+			i++;
+			continue;
+		}
+		lo = i;
+		peak = row->dbm[i];
+		while (i < n && row->dbm[i] > tr->base[i] + event_margin) {
+			peak = MAX(peak, row->dbm[i]);
+			i++;
+		}
+		hi = i - 1;
+		/* a run joins every open event it touches, a drift of one bin included */
+		e = NULL;
+		for (m=0; m<tr->count; m++) {
+			ev = &tr->open[m];
+			if (ev->hi < lo - 1 || ev->lo > hi + 1) {
+				continue;}
+			if (!e) {
+				e = ev;
+				continue;
+			}
+			e->lo = MIN(e->lo, ev->lo);
+			e->hi = MAX(e->hi, ev->hi);
+			e->peak = MAX(e->peak, ev->peak);
+			e->start = MIN(e->start, ev->start);
+			/* e is earlier in the list, the last one can't be it */
+			*ev = tr->open[--tr->count];
+			m--;
+		}
+		if (!e) {
+			e = &tr->open[tr->count++];
+			e->lo = lo;
+			e->hi = hi;
+			e->peak = peak;
+			e->start = row->time;
+		}
+		e->lo = MIN(e->lo, lo);
+		e->hi = MAX(e->hi, hi);
+		e->peak = MAX(e->peak, peak);
+		e->last = row->time;
+		e->seen = 1;
+	}
+	for (m=0; m<tr->count; m++) {
+		if (tr->open[m].seen) {
+			continue;}
+		event_emit(file, row, &tr->open[m], intervals[k].seconds);
+		tr->open[m] = tr->open[--tr->count];
+		m--;
+	}
+	for (i=0; i<n; i++) {
+		a = 1.0 / EVENT_BASE_REPORTS;
+		if (row->dbm[i] > tr->base[i] + event_margin) {
+			a /= EVENT_BASE_SLOWDOWN;}
+		/* no power stays out of the baseline */
+		if (isfinite(row->dbm[i])) {
+			tr->base[i] += a * (row->dbm[i] - tr->base[i]);}
+	}
+}
+
+void events_flush(struct power_run *run)
+/* logs what is still open on exit */
+{
+	int i, k, m;
+	struct event_track *tr;
+	struct report_row row;
+	for (k=0; k<interval_count; k++) {
+		for (i=0; i<run->tune_count; i++) {
+			tr = &run->tunes[i].events[k];
+			if (!tr->count) {
+				continue;}
+			/* only the frequency axis is needed */
+			tune_axis(&run->tunes[i], &row);
+			for (m=0; m<tr->count; m++) {
+				event_emit(intervals[k].file, &row, &tr->open[m], intervals[k].seconds);}
+			tr->count = 0;
+		}
+		fflush(intervals[k].file);
+	}
+}
+
+void stats_start(struct power_run *run)
+{
+	int i;
+	struct tuning_state *ts;
+	if (run->tunes[0].bin_e == 0) {
+		fprintf(stderr, "Error: -Q needs FFT bins, not bins over 1MHz.\n");
+		exit(1);
+	}
+	if (!stats_quantile_count) {
+		stats_quantiles[0] = 0.5;
+		stats_quantiles[1] = 0.9;
+		stats_quantile_count = 2;
+	}
+	for (i=0; i<run->tune_count; i++) {
+		ts = &run->tunes[i];
+		ts->stats = malloc(sizeof(struct bin_stats));
+		if (!ts->stats || bin_stats_init(ts->stats, 2 * ts->keep,
+		    stats_quantiles, stats_quantile_count) < 0) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+	}
+	if (strcmp(stats_file_name, "-") == 0) {
+		stats_file = stdout;
+	} else {
+		stats_file = fopen(stats_file_name, "w");}
+	if (!stats_file) {
+		fprintf(stderr, "Failed to open %s\n", stats_file_name);
+		exit(1);
+	}
+}
+
+static void stats_row(struct tuning_state *ts, struct report_row *row, const char *name, int stat)
+/* stat is -1 min, -2 max, -3 mean, -4 std or a quantile index */
+{
+	int i, j, c, len, i1, i2, half;
+	double v, p;
+	char t_str[50];
+	struct tm *cal_time;
+	struct bin_stats *bs = ts->stats;
+	len = 1 << ts->bin_e;
+	half = len / 2;
+	cal_time = localtime(&row->time);
+	strftime(t_str, 50, "%Y-%m-%d, %H:%M:%S", cal_time);
+	fprintf(stats_file, "%s, %i, %i, %.2f, %i, %s", t_str, row->hz_low, row->hz_high,
+		row->hz_step, (int)(bs->count * ts->downsample), name);
+	/* the bins and order of tune_dbm() */
+	i1 = 0 + (int)((double)len * ts->crop * 0.5);
+	i2 = (len-1) - (int)((double)len * ts->crop * 0.5);
+	for (i=i1; i<=i2; i++) {
+		j = (i + half) % len;
+		if (j == 0 && !ts->corr_gain) {
+			j = 1;}
+		c = j < ts->keep ? j : j - len + 2 * ts->keep;
+		switch (stat) {
+		case -1:
+			v = bs->min[c];  break;
+		case -2:
+			v = bs->max[c];  break;
+		case -3:
+			v = bs->mean[c]; break;
+		case -4:
+			v = sqrt(bin_stats_variance(bs, c)); break;
+		default:
+			v = bin_stats_quantile(bs, stat, c); break;
+		}
+		p = v / (double)ts->rate;
+		/* a spread has no floor to take off */
+		if (stat == -4) {
+			p *= ts->corr_gain ? ts->corr_gain[j] : 1.0;
+		} else {
+			p = bin_correct(ts, p, j);}
+		fprintf(stats_file, ", %.2f", 10 * log10(p));
+	}
+	fprintf(stats_file, "\n");
+}
+
+void stats_dbm(struct tuning_state *ts, struct report_row *row)
+/* one row per statistic, then start over */
+{
+	int k;
+	char name[16];
+	if (!ts->stats->count) {
+		return;}
+	stats_row(ts, row, "min", -1);
+	stats_row(ts, row, "max", -2);
+	stats_row(ts, row, "mean", -3);
+	stats_row(ts, row, "std", -4);
+	for (k=0; k<ts->stats->quantile_count; k++) {
+		sprintf(name, "p%g", 100.0 * ts->stats->quant[k].p);
+		stats_row(ts, row, name, k);
+	}
+	bin_stats_reset(ts->stats);
+}
+
+void timing_start(struct power_run *run)
+{
+	int i, d;
+	int tune_count = run->tune_count;
+	timing_hz = malloc(tune_count * sizeof(int));
+	if (!timing_hz || hop_timing_init(&report_timing, tune_count) < 0
+	    || hop_timing_init(&interval_timing, tune_count) < 0
+	    || hop_timing_init(&run_timing, tune_count) < 0) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	for (i=0; i<tune_count; i++) {
+		timing_hz[i] = run->tunes[i].freq;}
+	for (d=0; d<dongle_count; d++) {
+		if (sweep_session_timing(dongles[d].session) < 0) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+	}
+	if (strcmp(timing_file_name, "-") == 0) {
+		timing_file = stdout;
+	} else {
+		timing_file = fopen(timing_file_name, "w");}
+	if (!timing_file) {
+		fprintf(stderr, "Failed to open %s\n", timing_file_name);
+		exit(1);
+	}
+}
+
+void timing_collect(struct power_run *run)
+/* call with the pool drained and no scanner running
+ * moves every table into interval_timing */
+{
+	int i, d;
+	struct fft_pool *pool = &run->pool;
+	for (d=0; d<dongle_count; d++) {
+		hop_timing_merge(&interval_timing, dongles[d].session->timing);
+		hop_timing_reset(dongles[d].session->timing);
+	}
+	for (i=0; i<pool->worker_count; i++) {
+		hop_timing_merge(&interval_timing, &pool->workers[i].timing);
+		hop_timing_reset(&pool->workers[i].timing);
+	}
+	hop_timing_merge(&interval_timing, &report_timing);
+	hop_timing_reset(&report_timing);
+}
+
+void timing_report(struct power_run *run, time_t now)
+{
+	timing_collect(run);
+	hop_timing_json(&interval_timing, timing_file, now, timing_hz, timing_per_hop);
+	fflush(timing_file);
+	hop_timing_merge(&run_timing, &interval_timing);
+	hop_timing_reset(&interval_timing);
+}
+
+void noise_start(struct power_run *run)
+/* -N sums every capture of the run next to the intervals */
+{
+	int i;
+	struct tuning_state *ts;
+	for (i=0; i<run->tune_count; i++) {
+		ts = &run->tunes[i];
+		ts->cal = calloc(1 << ts->bin_e, sizeof(double));
+		if (!ts->cal) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		ts->cal_samples = 0.0;
+	}
+}
+
+void noise_save(struct power_run *run, int gain)
+{
+	int i, j, len;
+	int tune_count = run->tune_count;
+	struct tuning_state *ts, *tunes = run->tunes;
+	struct noise_profile prof;
+	len = 1 << tunes[0].bin_e;
+	for (i=0; i<tune_count; i++) {
+		if (tunes[i].cal_samples == 0.0) {
+			fprintf(stderr, "Noise profile not saved, hop %i was never captured.\n", i);
+			return;
+		}
+	}
+	if (noise_profile_alloc(&prof, tune_count, len) < 0) {
+		fprintf(stderr, "Error: malloc.\n");
+		return;
+	}
+	prof.head.rate = (uint32_t)tunes[0].rate;
+	prof.head.downsample = tunes[0].downsample;
+	prof.head.gain = gain;
+	for (i=0; i<tune_count; i++) {
+		ts = &tunes[i];
+		prof.freq[i] = ts->freq;
+		for (j=0; j<len; j++) {
+			prof.floor[i*len + j] = (float)(ts->cal[j] / ((double)ts->rate * ts->cal_samples));}
+	}
+	if (noise_profile_save(noise_save_file, &prof) < 0) {
+		fprintf(stderr, "Failed to write %s\n", noise_save_file);
+	} else {
+		fprintf(stderr, "Noise profile of %i hops saved to %s\n", tune_count, noise_save_file);}
+	noise_profile_free(&prof);
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+	float x = *(const float*)a, y = *(const float*)b;
+	return (x > y) - (x < y);
+}
+
+void noise_load(struct power_run *run, int gain)
+/* precomputes what tune_dbm() applies, nothing changes per capture */
+{
+	int i, j, len, kept;
+	int tune_count = run->tune_count;
+	float *sorted, *fl;
+	double ref;
+	struct tuning_state *ts, *tunes = run->tunes;
+	struct noise_profile prof;
+	len = 1 << tunes[0].bin_e;
+	if (noise_profile_load(noise_load_file, &prof) < 0) {
+		fprintf(stderr, "Failed to read a noise profile from %s\n", noise_load_file);
+		exit(1);
+	}
+	if (prof.head.hop_count != (uint32_t)tune_count
+	    || prof.head.bin_count != (uint32_t)len
+	    || prof.head.rate != (uint32_t)tunes[0].rate
+	    || prof.head.downsample != tunes[0].downsample) {
+		fprintf(stderr, "Noise profile %s was measured for a different scan.\n", noise_load_file);
+		exit(1);
+	}
+	for (i=0; i<tune_count; i++) {
+		if (prof.freq[i] != tunes[i].freq) {
+			fprintf(stderr, "Noise profile %s was measured for a different scan.\n", noise_load_file);
+			exit(1);
+		}
+	}
+	if (prof.head.gain != gain) {
+		fprintf(stderr, "Warning: noise profile measured at a different gain.\n");}
+	sorted = malloc(len * sizeof(float));
+	if (!sorted) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	for (i=0; i<tune_count; i++) {
+		ts = &tunes[i];
+		fl = prof.floor + i*len;
+		ts->corr_gain = malloc(len * sizeof(double));
+		ts->corr_floor = malloc(len * sizeof(double));
+		if (!ts->corr_gain || !ts->corr_floor) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		/* the median of the logged bins keeps the level, spurs don't move it */
+		kept = 0;
+		for (j=0; j<len; j++) {
+			if (len > 1 && j >= ts->keep && j < len - ts->keep) {
+				continue;}
+			sorted[kept++] = fl[j];
+		}
+		qsort(sorted, kept, sizeof(float), cmp_float);
+		ref = sorted[kept/2];
+		ts->corr_min = noise_subtract ? ref * NOISE_RESIDUAL : 0.0;
+		for (j=0; j<len; j++) {
+			ts->corr_gain[j] = 1.0;
+			ts->corr_floor[j] = 0.0;
+			if (noise_subtract) {
+				ts->corr_floor[j] = fl[j];
+			} else if (fl[j] > 0.0f) {
+				ts->corr_gain[j] = ref / fl[j];}
+		}
+	}
+	free(sorted);
+	noise_profile_free(&prof);
+	fprintf(stderr, "Noise profile: %s by %s\n", noise_subtract ? "subtracting" : "dividing",
+		noise_load_file);
+}
+
+static void dongle_setup(struct dongle *dg, int gain, int ppm_error, int custom_ppm,
+			 int direct_sampling, int offset_tuning)
+/* one session hop per tune, the first one configures the dongle */
+{
+	int i;
+	struct sweep_hop *hop, *first;
+	struct tuning_state *tunes = dg->run->tunes;
+	for (i=0; i<dg->run->tune_count; i++) {
+		if (sweep_session_add_hop(dg->session) < 0) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		hop = sweep_session_hop(dg->session, i);
+		hop->freq = tunes[i].freq - tunes[i].offset;
+		hop->rate = tunes[i].rate;
+		hop->gain = gain;
+		hop->direct_sampling = direct_sampling;
+		hop->offset_tuning = offset_tuning;
+		hop->ppm_error = ppm_error;
+		hop->custom_ppm = custom_ppm;
+		/* captures go to the fft pool, the arena only keeps tunes_carve() */
+		hop->buf_len = 0;
+	}
+	if (sweep_session_apply(dg->session, 0, NULL) < 0) {
+		fprintf(stderr, "Error: bad retune.\n");}
+	/* the other hops only move the frequency */
+	first = sweep_session_hop(dg->session, 0);
+	for (i=1; i<dg->run->tune_count; i++) {
+		hop = sweep_session_hop(dg->session, i);
+		hop->gain = first->gain;
+		hop->ppm_error = first->ppm_error;
 	}
-	ts->samples = 0;
 }
 
 int main(int argc, char **argv)
@@ -760,38 +2172,49 @@ int main(int argc, char **argv)
 	struct sigaction sigact;
 #endif
 	char *filename = NULL;
-	int i, length, n_read, r, opt, wb_mode = 0;
+	char *tok;
+	int i, k, d, longest, length, n_read, r = 0, opt, wb_mode = 0;
 	int f_set = 0;
 	int gain = AUTO_GAIN; // tenths of a dB
 	uint8_t *buffer;
-	int dev_index = 0;
 	int dev_given = 0;
+	struct dongle *dg;
 	int ppm_error = 0;
 	int custom_ppm = 0;
-	int interval = 10;
 	int fft_threads = 1;
-	int smoothing = 0;
+	int float_fft = 1;
 	int single = 0;
 	int direct_sampling = 0;
 	int offset_tuning = 0;
+	uint32_t cache_hits, cache_misses;
 	double crop = 0.0;
 	char *freq_optarg;
-	time_t next_tick;
 	time_t time_now;
+	time_t hop_time;
+	uint64_t t0;
 	time_t exit_time = 0;
-	char t_str[50];
-	struct tm *cal_time;
+	struct report_row row;
+	struct power_run run;
+	struct tuning_state *tunes;
+	int snapshot;
 	double (*window_fn)(int, int) = rectangle;
 	freq_optarg = "";
 
-	while ((opt = getopt(argc, argv, "f:i:s:t:d:g:p:e:w:c:F:1PD:Oh")) != -1) {
+	while ((opt = getopt(argc, argv, "f:i:s:t:d:g:p:e:w:E:c:F:z1PB:D:ON:n:ST:Q:H:h")) != -1) {
 		switch (opt) {
 		case 'f': // lower:upper:bin_size
 			freq_optarg = strdup(optarg);
 			f_set = 1;
 			break;
 		case 'd':
-			dev_index = verbose_device_search(optarg);
+			dongle_count = 0;
+			for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+				if (dongle_count == MAX_DONGLES) {
+					fprintf(stderr, "Error: at most %i devices.\n", MAX_DONGLES);
+					exit(1);
+				}
+				dongles[dongle_count++].index = verbose_device_search(tok);
+			}
 			dev_given = 1;
 			break;
 		case 'g':
@@ -801,7 +2224,14 @@ int main(int argc, char **argv)
 			crop = atofp(optarg);
 			break;
 		case 'i':
-			interval = (int)round(atoft(optarg));
+			interval_count = 0;
+			for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+				if (interval_count == MAX_INTERVALS) {
+					fprintf(stderr, "Error: at most %i intervals.\n", MAX_INTERVALS);
+					exit(1);
+				}
+				intervals[interval_count++].seconds = (int)round(atoft(tok));
+			}
 			break;
 		case 'e':
 			exit_time = (time_t)((int)round(atoft(optarg)));
@@ -830,6 +2260,16 @@ int main(int argc, char **argv)
 			if (strcmp("bartlett",  optarg) == 0) {
 				window_fn = bartlett;}
 			break;
+		case 'E':
+			if (strcmp("fixed",  optarg) == 0) {
+				float_fft = 0;}
+			if (strcmp("float",  optarg) == 0) {
+				float_fft = 1;}
+			if (strcmp("float-scalar",  optarg) == 0) {
+				float_fft = 1;
+				fft_set_simd(0);
+				decim_set_simd(0);}
+			break;
 		case 't':
 			fft_threads = atoi(optarg);
 			break;
@@ -843,6 +2283,12 @@ int main(int argc, char **argv)
 		case 'P':
 			peak_hold = 1;
 			break;
+		case 'B':
+			if (strcmp("float32",  optarg) == 0) {
+				bin_format = POWER_BIN_FLOAT32;}
+			if (strcmp("int16",  optarg) == 0) {
+				bin_format = POWER_BIN_CENTI_DB;}
+			break;
 		case 'D':
 			direct_sampling = atoi(optarg);
 			break;
@@ -852,6 +2298,59 @@ int main(int argc, char **argv)
 		case 'F':
 			boxcar = 0;
 			comp_fir_size = atoi(optarg);
+			if (comp_fir_size && (!(comp_fir_size & 1) || comp_fir_size > 129)) {
+				fprintf(stderr, "FIR size must be 0 or odd up to 129\n");
+				exit(1);}
+			break;
+		case 'z':
+			zoom = 1;
+			break;
+		case 'N':
+			noise_save_file = optarg;
+			break;
+		case 'n':
+			noise_load_file = optarg;
+			break;
+		case 'S':
+			noise_subtract = 1;
+			break;
+		case 'T':
+			tok = strtok(optarg, ",");
+			event_margin = atof(tok);
+			tok = strtok(NULL, ",");
+			if (tok) {
+				snapshot_seconds = (int)round(atoft(tok));}
+			if (event_margin <= 0.0) {
+				fprintf(stderr, "Event margin must be above 0 dB.\n");
+				exit(1);
+			}
+			break;
+		case 'Q':
+			stats_file_name = strtok(optarg, ",");
+			stats_quantile_count = 0;
+			for (tok = strtok(NULL, ","); tok; tok = strtok(NULL, ",")) {
+				if (stats_quantile_count == BIN_STATS_MAX_QUANTILES) {
+					fprintf(stderr, "Error: at most %i percentiles.\n", BIN_STATS_MAX_QUANTILES);
+					exit(1);
+				}
+				stats_quantiles[stats_quantile_count] = atof(tok) / 100.0;
+				if (!(stats_quantiles[stats_quantile_count] >= 0.0
+				      && stats_quantiles[stats_quantile_count] <= 1.0)) {
+					fprintf(stderr, "Percentiles run from 0 to 100.\n");
+					exit(1);
+				}
+				stats_quantile_count++;
+			}
+			break;
+		case 'H':
+			timing_file_name = strtok(optarg, ",");
+			tok = strtok(NULL, ",");
+			if (tok && strcmp(tok, "hops") == 0) {
+				timing_per_hop = 1;
+			} else if (tok) {
+				fprintf(stderr, "Unknown -H option %s.\n", tok);
+				exit(1);
+			}
 			break;
 		case 'h':
 		default:
@@ -870,34 +2369,85 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	frequency_range(freq_optarg, crop);
-
-	if (tune_count == 0) {
-		usage();}
+	if (noise_save_file && peak_hold) {
+		fprintf(stderr, "Measuring the noise floor needs averaging, not -P.\n");
+		exit(1);
+	}
 
-	if (argc <= optind) {
-		filename = "-";
-	} else {
-		filename = argv[optind];
+	if (event_margin > 0.0 && bin_format >= 0) {
+		fprintf(stderr, "Events are csv, -T does not mix with -B.\n");
+		exit(1);
 	}
 
-	if (interval < 1) {
-		interval = 1;}
+	if (noise_subtract && !noise_load_file) {
+		fprintf(stderr, "-S needs a noise profile from -n.\n");
+		exit(1);
+	}
 
-	fprintf(stderr, "Reporting every %i seconds\n", interval);
+	if (!interval_count) {
+		intervals[0].seconds = 10;
+		interval_count = 1;
+	}
 
-	if (!dev_given) {
-		dev_index = verbose_device_search("0");
+	longest = 0;
+	for (k=0; k<interval_count; k++) {
+		if (intervals[k].seconds < 1) {
+			intervals[k].seconds = 1;}
+		if (intervals[k].seconds > intervals[longest].seconds) {
+			longest = k;}
 	}
 
-	if (dev_index < 0) {
+	if (interval_count > 1 && argc - optind < interval_count) {
+		fprintf(stderr, "Give one filename per interval.\n");
 		exit(1);
 	}
 
-	r = rtlsdr_open(&dev, (uint32_t)dev_index);
-	if (r < 0) {
-		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dev_index);
-		exit(1);
+	memset(&run, 0, sizeof(run));
+	frequency_range(&run, freq_optarg, crop);
+	tunes = run.tunes;
+
+	if (run.tune_count == 0) {
+		usage();}
+
+	for (k=0; k<interval_count; k++) {
+		fprintf(stderr, "Reporting every %i seconds%s\n", intervals[k].seconds,
+			smoothing ? " (iir)" : "");
+	}
+
+	if (!dev_given || !dongle_count) {
+		dongle_count = 1;
+		dongles[0].index = verbose_device_search("0");
+	}
+
+	/* every device needs a hop of its own */
+	if (dongle_count > run.tune_count) {
+		fprintf(stderr, "Warning: only %i hops, using the first %i devices.\n",
+			run.tune_count, run.tune_count);
+		dongle_count = run.tune_count;
+	}
+
+	for (d=0; d<dongle_count; d++) {
+		dg = &dongles[d];
+		if (dg->index < 0) {
+			exit(1);
+		}
+		for (i=0; i<d; i++) {
+			if (dongles[i].index == dg->index) {
+				fprintf(stderr, "Error: device #%d given twice.\n", dg->index);
+				exit(1);
+			}
+		}
+		dg->run = &run;
+		dg->session = sweep_session_new();
+		if (!dg->session) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		r = sweep_session_open(dg->session, dg->index);
+		if (r < 0) {
+			fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dg->index);
+			exit(1);
+		}
 	}
 #ifndef _WIN32
 	sigact.sa_handler = sighandler;
@@ -911,93 +2461,213 @@ int main(int argc, char **argv)
 	SetConsoleCtrlHandler( (PHANDLER_ROUTINE) sighandler, TRUE );
 #endif
 
-	if (direct_sampling) {
-		verbose_direct_sampling(dev, direct_sampling);
-	}
-
-	if (offset_tuning) {
-		verbose_offset_tuning(dev);
-	}
-
-	/* Set the tuner gain */
-	if (gain == AUTO_GAIN) {
-		verbose_auto_gain(dev);
-	} else {
-		gain = nearest_gain(dev, gain);
-		verbose_gain_set(dev, gain);
-	}
+	for (d=0; d<dongle_count; d++) {
+		dg = &dongles[d];
+		if (dongle_count > 1) {
+			fprintf(stderr, "Device #%d:\n", dg->index);}
 
-	if (!custom_ppm) {
-		verbose_ppm_eeprom(dev, &ppm_error);
+		dongle_setup(dg, gain, ppm_error, custom_ppm, direct_sampling, offset_tuning);
 	}
-	verbose_ppm_set(dev, ppm_error);
-
-	if (strcmp(filename, "-") == 0) { /* Write log to stdout */
-		file = stdout;
+	/* the nearest step of the first device */
+	gain = dongles[0].session->hops[0].gain;
+
+	if (noise_save_file) {
+		noise_start(&run);}
+	if (noise_load_file) {
+		noise_load(&run, gain);}
+	if (event_margin > 0.0) {
+		events_start(&run);}
+	if (stats_file_name) {
+		stats_start(&run);}
+	if (timing_file_name) {
+		timing_start(&run);}
+
+	for (k=0; k<interval_count; k++) {
+		filename = "-";
+		if (argc > optind + k) {
+			filename = argv[optind + k];}
+		if (strcmp(filename, "-") == 0) { /* Write log to stdout */
+			intervals[k].file = stdout;
 #ifdef _WIN32
-		// Is this necessary?  Output is ascii.
-		_setmode(_fileno(file), _O_BINARY);
+			// needed for -B, harmless for csv
+			_setmode(_fileno(stdout), _O_BINARY);
 #endif
-	} else {
-		file = fopen(filename, "wb");
-		if (!file) {
-			fprintf(stderr, "Failed to open %s\n", filename);
-			exit(1);
+		} else {
+			intervals[k].file = fopen(filename, "wb");
+			if (!intervals[k].file) {
+				fprintf(stderr, "Failed to open %s\n", filename);
+				exit(1);
+			}
 		}
 	}
 
-	/* Reset endpoint before we start reading from it (mandatory) */
-	verbose_reset_buffer(dev);
-
-	/* actually do stuff */
-	rtlsdr_set_sample_rate(dev, (uint32_t)tunes[0].rate);
+	plan_hops(&run, gain, direct_sampling);
+	tunes_carve(&run);
 	sine_table(tunes[0].bin_e);
-	next_tick = time(NULL) + interval;
+	for (k=0; k<interval_count; k++) {
+		intervals[k].next_tick = time(NULL) + intervals[k].seconds;
+		intervals[k].next_snapshot = time(NULL);
+	}
 	if (exit_time) {
 		exit_time = time(NULL) + exit_time;}
-	fft_buf = malloc(tunes[0].buf_len * sizeof(int16_t));
 	length = 1 << tunes[0].bin_e;
-	window_coefs = malloc(length * sizeof(int));
+	run.window_coefs = malloc(length * sizeof(int));
+	for (i=0; i<length; i++) {
+		run.window_coefs[i] = (int)(256*window_fn(i, length));
+	}
+	run.window_float = malloc(length * sizeof(float));
+	run.dbm_buf = malloc((length + 1) * sizeof(double));
+	run.bin_buf = malloc(length * sizeof(float) + 8);
 	for (i=0; i<length; i++) {
-		window_coefs[i] = (int)(256*window_fn(i, length));
+		run.window_float[i] = (float)(256*window_fn(i, length));
+	}
+	row.dbm = run.dbm_buf;
+	if ((float_fft || run.zoom_stages) && tunes[0].bin_e > 0) {
+		run.plan = fft_plan_get(tunes[0].bin_e);
+		if (!run.plan) {
+			fprintf(stderr, "Error: could not plan a %i point FFT.\n", length);
+			exit(1);
+		}
+		fprintf(stderr, "FFT engine: float (%s)\n", fft_simd_name());
+	} else if (tunes[0].bin_e > 0) {
+		fprintf(stderr, "FFT engine: fixed point\n");
 	}
+	fft_pool_start(&run, fft_threads);
+	for (d=0; d<dongle_count; d++) {
+		r = capture_start(&dongles[d]);
+		if (r < 0) {
+			fprintf(stderr, "Failed to start the sample stream on device #%d.\n",
+				dongles[d].index);
+			exit(1);
+		}
+	}
+	fold_us = hop_timing_now();
+	for (d=0; d<dongle_count; d++) {
+		dongles[d].sweep.start_us = fold_us;}
 	while (!do_exit) {
-		scanner();
+		/* a single shot always gets a full sweep */
+		r = scan_all(!single);
+		if (r < 0) {
+			break;}
 		time_now = time(NULL);
-		if (time_now < next_tick) {
-			continue;}
+		if (!report_due(time_now)) {
+			/* iir decays by time, keep it current every sweep */
+			if (smoothing) {
+				integrate_all(&run);}
+			continue;
+		}
+		fft_pool_drain(&run);
+		integrate_all(&run);
 		// time, Hz low, Hz high, Hz step, samples, dbm, dbm, ...
-		cal_time = localtime(&time_now);
-		strftime(t_str, 50, "%Y-%m-%d, %H:%M:%S", cal_time);
-		for (i=0; i<tune_count; i++) {
-			fprintf(file, "%s, ", t_str);
-			csv_dbm(&tunes[i]);
-		}
-		fflush(file);
-		while (time(NULL) >= next_tick) {
-			next_tick += interval;}
-		if (single) {
-			do_exit = 1;}
+		for (k=0; k<interval_count; k++) {
+			if (time_now < intervals[k].next_tick) {
+				continue;}
+			/* events replace the rows, but for the odd snapshot */
+			snapshot = 1;
+			if (event_margin > 0.0) {
+				snapshot = snapshot_seconds && time_now >= intervals[k].next_snapshot;}
+			if (snapshot && event_margin > 0.0) {
+				while (time_now >= intervals[k].next_snapshot) {
+					intervals[k].next_snapshot += snapshot_seconds;}
+			}
+			for (i=0; i<run.tune_count; i++) {
+				/* split sweeps leave some hops for the next interval */
+				if (tunes[i].integ_samples[k] == 0.0) {
+					continue;}
+				t0 = timing_file ? hop_timing_now() : 0;
+				hop_time = sweep_split ? tunes[i].capture_time : time_now;
+				tune_dbm(&tunes[i], k, &row);
+				row.time = hop_time;
+				if (k == 0 && stats_file) {
+					stats_dbm(&tunes[i], &row);}
+				if (event_margin > 0.0) {
+					event_dbm(intervals[k].file, &tunes[i], k, &row);}
+				if (snapshot && bin_format >= 0) {
+					bin_dbm(intervals[k].file, &row, run.bin_buf);
+				} else if (snapshot) {
+					csv_dbm(intervals[k].file, &row);}
+				if (timing_file) {
+					hop_timing_add(&report_timing, i, HOP_TIMING_FORMAT, hop_timing_now() - t0);}
+			}
+			fflush(intervals[k].file);
+			if (k == 0 && stats_file) {
+				fflush(stats_file);}
+			if (k == 0 && timing_file) {
+				timing_report(&run, time_now);}
+			while (time(NULL) >= intervals[k].next_tick) {
+				intervals[k].next_tick += intervals[k].seconds;}
+			if (single && k == longest) {
+				do_exit = 1;}
+		}
 		if (exit_time && time(NULL) >= exit_time) {
 			do_exit = 1;}
 	}
 
 	/* clean up */
+	fft_pool_drain(&run);
+	if (event_margin > 0.0) {
+		events_flush(&run);}
+	if (noise_save_file) {
+		integrate_all(&run);
+		noise_save(&run, gain);
+	}
+	for (d=0; d<dongle_count; d++) {
+		rtlsdr_stream_stop(dongles[d].session->dev);}
+	occupancy_report(&run);
+	if (timing_file) {
+		timing_collect(&run);
+		hop_timing_merge(&run_timing, &interval_timing);
+		hop_timing_print(&run_timing, stderr, timing_hz, timing_per_hop);
+	}
+	fft_pool_stop(&run);
 
 	if (do_exit) {
 		fprintf(stderr, "\nUser cancel, exiting...\n");}
 	else {
 		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);}
 
-	if (file != stdout) {
-		fclose(file);}
+	for (d=0; d<dongle_count; d++) {
+		if (rtlsdr_get_tuner_cache_stats(dongles[d].session->dev, &cache_hits, &cache_misses)) {
+			continue;}
+		if (dongle_count > 1) {
+			fprintf(stderr, "Device %i: ", dongles[d].index);}
+		fprintf(stderr, "PLL cache: %u hits, %u misses\n",
+			cache_hits, cache_misses);
+	}
+
+	for (k=0; k<interval_count; k++) {
+		if (intervals[k].file != stdout) {
+			fclose(intervals[k].file);}
+	}
+	if (stats_file && stats_file != stdout) {
+		fclose(stats_file);}
+	if (timing_file && timing_file != stdout) {
+		fclose(timing_file);}
+	if (timing_file) {
+		hop_timing_free(&report_timing);
+		hop_timing_free(&interval_timing);
+		hop_timing_free(&run_timing);
+		free(timing_hz);
+	}
+	for (i=0; i<run.tune_count && stats_file; i++) {
+		bin_stats_free(tunes[i].stats);
+		free(tunes[i].stats);
+	}
 
-	rtlsdr_close(dev);
-	free(fft_buf);
-	free(window_coefs);
+	/* the bins of every tune go with the sessions */
+	for (d=0; d<dongle_count; d++) {
+		sweep_session_free(dongles[d].session);}
+	free(dongles[0].hops);
+	free(run.tunes);
+	for (i=0; i<run.chain_len; i++) {
+		free(run.chain[i].h);}
+	free(run.window_coefs);
+	free(run.window_float);
+	free(run.dbm_buf);
+	free(run.bin_buf);
+	fft_plans_free();
 	//for (i=0; i<tune_count; i++) {
 	//	free(tunes[i].avg);
-	//	free(tunes[i].buf8);
 	//}
 	return r >= 0 ? r : -r;
 }
@@ -0,0 +1,219 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * rtl_power_csv: turns rtl_power -B output back into rtl_power csv
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include "getopt/getopt.h"
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+#include <math.h>
+
+#include "convenience/power_bin.h"
+
+FILE *in_file;
+FILE *out_file;
+
+void usage(void)
+{
+	fprintf(stderr,
+		"rtl_power_csv, converts binary rtl_power logs to csv\n\n"
+		"Use:\trtl_power_csv [-options] [infile [outfile]]\n"
+		"\t[-s start_time (unix seconds, default: first record)]\n"
+		"\t[-e end_time (unix seconds, default: last record)]\n"
+		"\tinfile (a '-' reads stdin, seeking needs a file)\n"
+		"\toutfile (a '-' or omitting it writes to stdout)\n\n"
+		"Example:\n"
+		"\trtl_power -f 88M:108M:125k -B int16 fm.bin\n"
+		"\trtl_power_csv fm.bin fm.csv\n");
+	exit(1);
+}
+
+int read_record(struct power_bin_record *rec, void **bins, size_t *bins_len)
+/* 1 on success, 0 at the end, -1 on damage */
+{
+	size_t len;
+	if (fread(rec, sizeof(*rec), 1, in_file) != 1) {
+		return 0;}
+	if (rec->magic != POWER_BIN_MAGIC) {
+		if (rec->magic == 0x52545057) {
+			fprintf(stderr, "Error: written with the other byte order.\n");
+		} else {
+			fprintf(stderr, "Error: not an rtl_power binary record.\n");}
+		return -1;
+	}
+	if (rec->version != POWER_BIN_VERSION || rec->record_len < sizeof(*rec)) {
+		fprintf(stderr, "Error: unsupported record version %u.\n", rec->version);
+		return -1;
+	}
+	len = rec->record_len - sizeof(*rec);
+	if ((size_t)rec->bin_count * (rec->format == POWER_BIN_FLOAT32 ? 4 : 2) > len) {
+		fprintf(stderr, "Error: record too short for its bins.\n");
+		return -1;
+	}
+	if (len > *bins_len) {
+		*bins = realloc(*bins, len);
+		if (!*bins) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		*bins_len = len;
+	}
+	if (fread(*bins, 1, len, in_file) != len) {
+		fprintf(stderr, "Error: truncated record.\n");
+		return -1;
+	}
+	return 1;
+}
+
+void seek_time(int64_t start)
+/* bisect to the first record at or after start, records are equal sized */
+{
+	struct power_bin_record rec;
+	int64_t lo, hi, mid, count;
+	if (fread(&rec, sizeof(rec), 1, in_file) != 1 || rec.magic != POWER_BIN_MAGIC
+	    || rec.record_len < sizeof(rec)) {
+		fseeko(in_file, 0, SEEK_SET);
+		return;
+	}
+	fseeko(in_file, 0, SEEK_END);
+	count = (int64_t)ftello(in_file) / rec.record_len;
+	lo = 0;
+	hi = count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		fseeko(in_file, mid * rec.record_len, SEEK_SET);
+		if (fread(&rec, sizeof(rec), 1, in_file) != 1 || rec.magic != POWER_BIN_MAGIC) {
+			/* mixed record sizes, scan from the top instead */
+			lo = 0;
+			break;
+		}
+		if (rec.time < start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;}
+	}
+	fseeko(in_file, lo * rec.record_len, SEEK_SET);
+}
+
+int main(int argc, char **argv)
+{
+	struct power_bin_record rec;
+	void *bins = NULL;
+	size_t bins_len = 0;
+	int opt, r;
+	uint32_t i;
+	int64_t start = INT64_MIN;
+	int64_t end = INT64_MAX;
+	double v;
+	char t_str[50];
+	time_t t;
+	struct tm *cal_time;
+	float *f32;
+	int16_t *i16;
+
+	while ((opt = getopt(argc, argv, "s:e:h")) != -1) {
+		switch (opt) {
+		case 's':
+			start = (int64_t)atoll(optarg);
+			break;
+		case 'e':
+			end = (int64_t)atoll(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			break;
+		}
+	}
+
+	in_file = stdin;
+	if (argc > optind && strcmp(argv[optind], "-") != 0) {
+		in_file = fopen(argv[optind], "rb");
+		if (!in_file) {
+			fprintf(stderr, "Failed to open %s\n", argv[optind]);
+			exit(1);
+		}
+	}
+#ifdef _WIN32
+	if (in_file == stdin) {
+		_setmode(_fileno(stdin), _O_BINARY);}
+#endif
+	out_file = stdout;
+	if (argc > optind + 1 && strcmp(argv[optind+1], "-") != 0) {
+		out_file = fopen(argv[optind+1], "w");
+		if (!out_file) {
+			fprintf(stderr, "Failed to open %s\n", argv[optind+1]);
+			exit(1);
+		}
+	}
+
+	if (start != INT64_MIN && in_file != stdin) {
+		seek_time(start);}
+
+	while ((r = read_record(&rec, &bins, &bins_len)) > 0) {
+		if (rec.time < start) {
+			continue;}
+		if (rec.time > end) {
+			break;}
+		t = (time_t)rec.time;
+		cal_time = localtime(&t);
+		strftime(t_str, 50, "%Y-%m-%d, %H:%M:%S", cal_time);
+		fprintf(out_file, "%s, %i, %i, %.2f, %i, ", t_str,
+			rec.hz_low, rec.hz_high, rec.hz_step, rec.samples);
+		f32 = (float*)bins;
+		i16 = (int16_t*)bins;
+		v = 0.0;
+		for (i=0; i<rec.bin_count; i++) {
+			if (rec.format == POWER_BIN_FLOAT32) {
+				v = (double)f32[i];
+			} else if (i16[i] == POWER_BIN_NO_POWER) {
+				v = -INFINITY;
+			} else {
+				v = (double)i16[i] / 100.0;}
+			fprintf(out_file, "%.2f, ", v);
+		}
+		/* rtl_power repeats the last bin */
+		fprintf(out_file, "%.2f\n", v);
+	}
+
+	if (in_file != stdin) {
+		fclose(in_file);}
+	if (out_file != stdout) {
+		fclose(out_file);}
+	free(bins);
+	return r < 0 ? 1 : 0;
+}
+
+// vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
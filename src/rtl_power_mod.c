@@ -65,44 +65,17 @@
 
 #include "rtl-sdr.h"
 #include "convenience/convenience.h"
+#include "convenience/sweep_session.h"
+#include "convenience/hop_timing.h"
+#include "convenience/iq_stats.h"
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 
-#define DEFAULT_num_samplesGTH		(1 * 16384)
-#define AUTO_GAIN			-100
-#define BUFFER_DUMP			(1<<12)
-
 #define MAXIMUM_RATE			2800000
 #define MINIMUM_RATE			1000000
 
-struct tuning_state
-/* one per tuning range */
-{
-	int freq;  //Tuner frequency
-	int rate;  //Sample Rate
-	int num_samples;  //Number of samples
-	int gain;  //AUTO_GAIN; // tenths of a dB
-	
-	int direct_sampling;
-	int offset_tuning;
-	double crop;
-	int ppm_error;
-	int custom_ppm;
-	
-	int bin_e;
-	long *avg;  /* length == 2^bin_e */
-	int samples;
-	int downsample;
-	int downsample_passes;  /* for the recursive filter */
-
-};
-
-/* 3000 is enough for 3GHz b/w worst case */
-#define MAX_TUNES	3000
-struct tuning_state tunes[MAX_TUNES];
-static rtlsdr_dev_t *dev = NULL;
-
-int tune_count = 0;
+/* the calls without a session argument share this one */
+static struct sweep_session *default_session = NULL;
 
 int boxcar = 1;
 int comp_fir_size = 0;
@@ -168,45 +141,97 @@ double log2(double n)
 #endif
 
 
-void rms_power(int ts_index, uint8_t *buf, double *rms_pow_val, double *rms_pow_dc_val)
-/* for bins between 1MHz and 2MHz */
+static struct sweep_session *legacy_session(void)
 {
-	struct tuning_state *ts = &tunes[ts_index];
+	if (!default_session) {
+		default_session = sweep_session_new();}
+	if (!default_session) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	return default_session;
+}
+
+static struct sweep_hop *session_hop(struct sweep_session *s, int index)
+/* hops come into being as they are used, like the old table */
+{
+	struct sweep_hop *hop;
+	while (index >= s->hop_count) {
+		if (sweep_session_add_hop(s) < 0) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+	}
+	hop = sweep_session_hop(s, index);
+	if (!hop) {
+		fprintf(stderr, "Error: bad hop %i.\n", index);
+		exit(1);
+	}
+	return hop;
+}
 
-	int i, s1, s2;
-	//uint8_t *buf = ts->buf8;
-	int num_samples = ts->num_samples;
-	double rms_sum, dc_sum, s1_2, s2_2, dc_offset_sum;
-	double rms, dc, dc_offset;
+struct sweep_session *session_new(void)
+{
+	return sweep_session_new();
+}
 
-	rms_sum = 0;
-	dc_sum = 0;
-	dc_offset_sum = 0;
+void session_free(struct sweep_session *s)
+{
+	sweep_session_free(s);
+}
 
-	for (i=0; i<num_samples; i=i+1) {
-		dc_offset_sum = dc_offset_sum + (int)buf[i] - 127;
+int session_open(struct sweep_session *s, int dev_index)
+{
+	char index_str[16];
+	sprintf(index_str, "%i", dev_index);
+	dev_index = verbose_device_search(index_str);
+	if (dev_index < 0) {
+		return -1;}
+	if (sweep_session_open(s, dev_index) < 0) {
+		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dev_index);
+		return -1;
 	}
-	dc_offset = dc_offset_sum / num_samples;
-	
-	for (i=0; i<num_samples; i=i+2) {
+	return 0;
+}
 
-		s1 = (int)buf[i] - 127 - dc_offset;
-		s2 = (int)buf[i+1] - 127 - dc_offset;
-		s1_2 = s1 * s1;
-		s2_2 = s2 * s2;
+void session_close(struct sweep_session *s)
+{
+	sweep_session_close(s);
+}
 
-		dc_sum += sqrt(s1_2 + s2_2);
-		rms_sum += s1_2 + s2_2;
-		//fprintf(file, "%.2f\n", dc_sum);
-		//fprintf(file, "%.2f\n", rms_sum);
+void session_iq_stats(struct sweep_session *s, int index, uint8_t *buf,
+		      double *dc_i, double *dc_q, double *rms, double *mean_mag, double *peak)
+/* levels in ADC steps, see iq_stats.h */
+{
+	struct iq_stats st;
+	uint64_t t0 = s->timing ? hop_timing_now() : 0;
+
+	iq_stats_measure(buf, session_hop(s, index)->buf_len, &st);
+	*dc_i = st.dc_i;
+	*dc_q = st.dc_q;
+	*rms = st.rms;
+	*mean_mag = st.mean_mag;
+	*peak = st.peak;
+
+	if (s->timing) {
+		hop_timing_add(s->timing, index, HOP_TIMING_FFT, hop_timing_now() - t0);}
+}
 
-	}
+void session_rms_power(struct sweep_session *s, int index, uint8_t *buf,
+		       double *rms_pow_val, double *rms_pow_dc_val)
+/* for bins between 1MHz and 2MHz */
+{
+	double dc_i, dc_q, rms, mag, peak, dc;
 
-	rms = sqrt(rms_sum/ (num_samples/2));
-	dc = dc_sum / (num_samples/2);
+	session_iq_stats(s, index, buf, &dc_i, &dc_q, &rms, &mag, &peak);
+	/* as always, one dc over I and Q together comes off both, and
+	 * "without DC" takes the magnitudes about it, a second pass */
+	dc = (dc_i + dc_q) / 2;
+	rms = sqrt(rms*rms + (dc_i-dc)*(dc_i-dc) + (dc_q-dc)*(dc_q-dc));
+	mag = iq_stats_mean_mag(buf, session_hop(s, index)->buf_len, dc, dc);
 
-	*rms_pow_val = 20*log10(rms/181);
-	*rms_pow_dc_val = 20*log10((rms-dc)/181);  //256/sqrt(2)
+	*rms_pow_val = rms > 0.0 ? 20*log10(rms/181) : -73;
+	*rms_pow_dc_val = rms > mag ? 20*log10((rms-mag)/181) : -73;  //256/sqrt(2)
 
 	if(*rms_pow_val < -73)
 	{
@@ -219,157 +244,104 @@ void rms_power(int ts_index, uint8_t *buf, double *rms_pow_val, double *rms_pow_
 	}
 }
 
-void read_data(int index, uint8_t *buf8)
+void session_read_data(struct sweep_session *s, int index, uint8_t *buf8)
 {
-	int n_read;
-	struct tuning_state *ts;
-	ts = &tunes[index];
+	struct sweep_hop *hop = session_hop(s, index);
 
-	verbose_reset_buffer(dev);
+	verbose_reset_buffer(s->dev);
 	
 	//Get data
-	rtlsdr_read_sync(dev, buf8, ts->num_samples, &n_read);
-
-	if (n_read != ts->num_samples) {
+	if (sweep_session_read(s, index, buf8) != hop->buf_len) {
 		fprintf(stderr, "Error: dropped samples.\n");}
 
 }
 
-void initialize_tuner_values(int index)
+int session_add_tune(struct sweep_session *s)
 {
-	struct tuning_state *ts;
-	int j;
-
-	ts = &tunes[index];
-
-	//Tuner Properties
-	ts->freq = 1e9;
-	ts->rate = 2.048e6;
-	ts->num_samples = DEFAULT_num_samplesGTH;
-	ts->gain = AUTO_GAIN;  //254
-	ts->direct_sampling = 0;
-	ts->offset_tuning = 0;
-	ts->crop = 0.0;
-	ts->ppm_error = 0;
-	ts->custom_ppm = 0;
-	
-	//FFT Properties
-	ts->bin_e = 10;
-	ts->samples = 0;
-	ts->crop = 0;
-	ts->downsample = 1;//downsample;
-	ts->downsample_passes = 0;//downsample_passes;
-	
-	ts->avg = (long*)malloc((1<<ts->bin_e) * sizeof(long));
-	if (!ts->avg) {
+	int index = sweep_session_add_hop(s);
+	if (index < 0) {
 		fprintf(stderr, "Error: malloc.\n");
 		exit(1);
 	}
-	for (j=0; j<(1<<ts->bin_e); j++) {
-		ts->avg[j] = 0L;
-	}
+	return index;
 }
 
-void find_and_open_dev(void)
+void session_set_tuner(struct sweep_session *s, int index)
+/* only changes what differs from the previous hop */
 {
-	int dev_index, r = 0;
-
-	dev_index = verbose_device_search("0");
-
-	if (dev_index < 0) {
-		exit(1);
-	}
-
-	r = rtlsdr_open(&dev, (uint32_t)dev_index);
-	if (r < 0) {
-		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dev_index);
-		exit(1);
-	}
+	session_hop(s, index);
+	if (sweep_session_apply(s, index, NULL) < 0) {
+		fprintf(stderr, "Error: bad retune.\n");}
 }
 
-void close_dev(void)
+double session_plan_hops(struct sweep_session *s)
+/* orders all tunes of the session for session_get_hop()
+ * returns the modelled retune time of one sweep in microseconds */
 {
-	rtlsdr_close(dev);
+	return sweep_session_plan(s);
 }
 
-void set_tuner(int index)
+int session_get_hop(struct sweep_session *s, int n)
+/* the tune to visit n-th, n itself without a plan */
 {
-	uint8_t dump[BUFFER_DUMP];
-	int n_read;
-	struct tuning_state *ts;
-	ts = &tunes[index];
-	
-	if (ts->direct_sampling) {
-		verbose_direct_sampling(dev, ts->direct_sampling);
-	}
-
-	if (ts->offset_tuning) {
-		verbose_offset_tuning(dev);
-	}
-
-	/* Set the tuner gain */
-	if (ts->gain == AUTO_GAIN) {
-		verbose_auto_gain(dev);
-	} else {
-		ts->gain = nearest_gain(dev, ts->gain);
-		verbose_gain_set(dev, ts->gain);
-	}
-
-	if (!ts->custom_ppm) {
-		verbose_ppm_eeprom(dev, &ts->ppm_error);
-	}
-	verbose_ppm_set(dev, ts->ppm_error);
-
-	/* Reset endpoint before we start reading from it (mandatory) */
-	verbose_reset_buffer(dev);
-	
-	/* actually do stuff */
-	rtlsdr_set_sample_rate(dev, (uint32_t)ts->rate);
-	
-	rtlsdr_set_center_freq(dev, (uint32_t)ts->freq);
-	/* wait for settling and flush buffer */
-	usleep(5000);
-	rtlsdr_read_sync(dev, &dump, BUFFER_DUMP, &n_read);
-	if (n_read != BUFFER_DUMP) {
-		fprintf(stderr, "Error: bad retune.\n");}
-
+	return sweep_session_get_hop(s, n);
 }
 
-void set_value(int index, char param, double value)
+void session_set_value(struct sweep_session *s, int index, char param, double value)
 {
-	struct tuning_state *ts;
-	ts = &tunes[index];
+	struct sweep_hop *hop = session_hop(s, index);
 
 	switch (param) {
 	case 'f': // lower:upper:bin_size
-		ts->freq = (int)value;
+		hop->freq = (int)value;
 		break;
 	case 'r':
-		ts->rate = (int)value;
+		hop->rate = (int)value;
 		break;
 	case 'b': 
-		ts->num_samples = pow(2,(int)value);
+		hop->buf_len = pow(2,(int)value);
 		break;
 	case 'g': 
-		ts->gain = (int)value;
+		hop->gain = (int)value;
 		break;
 	default:
 		break;
 	}
 }
 
-uint32_t get_value(char param)
+int session_timing_start(struct sweep_session *s)
+/* times set_tuner, read_data and rms_power of every tune so far
+ * starts over when called again */
+{
+	return sweep_session_timing(s);
+}
+
+void session_timing_report(struct sweep_session *s, int json)
+/* histograms per stage and tune, a table on stderr or one json line on stdout */
+{
+	if (!s->timing) {
+		return;}
+	if (json) {
+		hop_timing_json(s->timing, stdout, time(NULL), NULL, 1);
+		fflush(stdout);
+	} else {
+		hop_timing_print(s->timing, stderr, NULL, 1);}
+}
+
+uint32_t session_get_value(struct sweep_session *s, char param)
 {
 	uint32_t value = 0;
+	if (!s->dev) {
+		return 0;}
 	switch (param) {
 	case 'f': // lower:upper:bin_size
-		value = rtlsdr_get_center_freq(dev);
+		value = rtlsdr_get_center_freq(s->dev);
 		break;
 	case 'r':
-		value = rtlsdr_get_sample_rate(dev);
+		value = rtlsdr_get_sample_rate(s->dev);
 		break;
 	case 'g': 
-		value = rtlsdr_get_tuner_gain(dev);
+		value = rtlsdr_get_tuner_gain(s->dev);
 		break;
 	default:
 		break;
@@ -377,6 +349,81 @@ uint32_t get_value(char param)
 	return value;
 }
 
+/* the single session api, kept for existing scripts */
+
+void rms_power(int ts_index, uint8_t *buf, double *rms_pow_val, double *rms_pow_dc_val)
+{
+	session_rms_power(legacy_session(), ts_index, buf, rms_pow_val, rms_pow_dc_val);
+}
+
+void read_data(int index, uint8_t *buf8)
+{
+	session_read_data(legacy_session(), index, buf8);
+}
+
+void initialize_tuner_values(int index)
+/* back to the defaults */
+{
+	sweep_hop_defaults(session_hop(legacy_session(), index));
+}
+
+void find_and_open_dev(void)
+{
+	if (session_open(legacy_session(), 0) < 0) {
+		exit(1);}
+}
+
+void close_dev(void)
+{
+	session_close(legacy_session());
+}
+
+void set_tuner(int index)
+{
+	session_set_tuner(legacy_session(), index);
+}
+
+double plan_hops(int count)
+/* orders tunes 0 to count-1 for get_hop()
+ * returns the modelled retune time of one sweep in microseconds */
+{
+	struct sweep_session *s = legacy_session();
+	int all = s->hop_count;
+	double sweep_us;
+	if (count < 1 || count > all) {
+		return -1.0;}
+	/* tunes past count stay out of the plan */
+	s->hop_count = count;
+	sweep_us = session_plan_hops(s);
+	s->hop_count = all;
+	return sweep_us;
+}
+
+int get_hop(int n)
+{
+	return session_get_hop(legacy_session(), n);
+}
+
+void set_value(int index, char param, double value)
+{
+	session_set_value(legacy_session(), index, param, value);
+}
+
+uint32_t get_value(char param)
+{
+	return session_get_value(legacy_session(), param);
+}
+
+int timing_start(void)
+{
+	return session_timing_start(legacy_session());
+}
+
+void timing_report(int json)
+{
+	session_timing_report(legacy_session(), json);
+}
+
 int main(int argc, char **argv)
 {
 	char *filename = NULL;
@@ -385,39 +432,42 @@ int main(int argc, char **argv)
 	double rms_pow_val, rms_pow_dc_val;
 	int r = 0;
 	int index = 0;
+	int timing = 0;
 	FILE *file;
-	uint8_t *buf8;
+	struct sweep_session *session;
+	struct sweep_hop *hop;
 
 	time_t time_now;
 	char t_str[50];
 	struct tm *cal_time;
-	
-	struct tuning_state *ts;
 
 	file = stdout;
 	
-	ts = &tunes[index];
-
 	//Set initial state for tuner
-	initialize_tuner_values(index);
+	session = session_new();
+	if (!session) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
+	index = session_add_tune(session);
 
 	//Change tuner values based on input options
-	while ((opt = getopt(argc, argv, "f:r:b:g:")) != -1) {
+	while ((opt = getopt(argc, argv, "f:r:b:g:H")) != -1) {
 		switch (opt) {
 		case 'f': // lower:upper:bin_size
-			//ts->freq = atof(optarg);
-			set_value(index, 'f', atof(optarg));
+			session_set_value(session, index, 'f', atof(optarg));
 			break;
 		case 'r':
-			//ts->rate = atof(optarg);
-			set_value(index, 'r', atof(optarg));
+			session_set_value(session, index, 'r', atof(optarg));
 			break;
 		case 'b': 
-			//ts->num_samples = pow(2,atoi(optarg));
-			set_value(index, 'b', atoi(optarg));
+			session_set_value(session, index, 'b', atoi(optarg));
 			break;
 		case 'g':
-			set_value(index, 'g', atof(optarg)*10);
+			session_set_value(session, index, 'g', atof(optarg)*10);
+			break;
+		case 'H':
+			timing = 1;
 			break;
 		default:
 			break;
@@ -430,21 +480,27 @@ int main(int argc, char **argv)
 		filename = argv[optind];
 	}
 	
-	find_and_open_dev();
+	if (session_open(session, 0) < 0) {
+		exit(1);}
+
+	if (timing && session_timing_start(session) < 0) {
+		fprintf(stderr, "Error: malloc.\n");
+		exit(1);
+	}
 
 	//Configure Tuner settings, if necessary
-	set_tuner(index);
+	session_set_tuner(session, index);
 
 	//Get data from tuner
-	buf8 = (uint8_t*)malloc(ts->num_samples * sizeof(uint8_t));
-	if (!buf8) {
+	if (sweep_session_arena(session, 0) < 0) {
 		fprintf(stderr, "Error: malloc.\n");
 		exit(1);
 	}
-	read_data(index, buf8);
+	hop = sweep_session_hop(session, index);
+	session_read_data(session, index, hop->buf);
 	
 	/* rms */
-	rms_power(index, buf8, &rms_pow_val, &rms_pow_dc_val);
+	session_rms_power(session, index, hop->buf, &rms_pow_val, &rms_pow_dc_val);
 	
 	//Print Time
 	time_now = time(NULL);
@@ -452,27 +508,28 @@ int main(int argc, char **argv)
 	strftime(t_str, 50, "%Y-%m-%d, %H:%M:%S", cal_time);
 	fprintf(file, "%s\n", t_str);
 	
-	bin_count = (int)((double)ts->num_samples * (1.0 - ts->crop));
-	bw2 = (int)(((double)ts->rate * (double)bin_count) / (ts->num_samples * 2));
+	bin_count = hop->buf_len;
+	bw2 = (int)(((double)hop->rate * (double)bin_count) / (hop->buf_len * 2));
 		
 	//Print all info
-	fprintf(stderr, "Number of frequency hops: %i\n", tune_count);
-	fprintf(stderr, "Dongle bandwidth: %iHz\n", ts->rate);
-	fprintf(stderr, "Downsampling by: %ix\n", ts->downsample);
-	fprintf(stderr, "Cropping by: %0.2f%%\n", ts->crop*100);
-	fprintf(stderr, "Buffer size: %i bytes (%0.2fms)\n", ts->num_samples, 1000 * 0.5 * (float)ts->num_samples / (float)ts->rate);
-	fprintf(file, "Lowest Frequency is %.2f MHz\n", (double)(ts->freq - bw2)/1e6);
-	fprintf(file, "Highest Frequency is %.2f MHz\n", (double)(ts->freq + bw2)/1e6);
-	fprintf(file, "FFT Bin Size would be %.2f kHz\n", (double)(ts->rate / ts->num_samples)/1e3);
-	fprintf(file, "Number of Samples is %i\n", ts->num_samples);
+	fprintf(stderr, "Number of frequency hops: %i\n", session->hop_count);
+	fprintf(stderr, "Dongle bandwidth: %iHz\n", hop->rate);
+	fprintf(stderr, "Downsampling by: %ix\n", 1);
+	fprintf(stderr, "Cropping by: %0.2f%%\n", 0.0);
+	fprintf(stderr, "Buffer size: %i bytes (%0.2fms)\n", hop->buf_len, 1000 * 0.5 * (float)hop->buf_len / (float)hop->rate);
+	fprintf(file, "Lowest Frequency is %.2f MHz\n", (double)(hop->freq - bw2)/1e6);
+	fprintf(file, "Highest Frequency is %.2f MHz\n", (double)(hop->freq + bw2)/1e6);
+	fprintf(file, "FFT Bin Size would be %.2f kHz\n", (double)(hop->rate / hop->buf_len)/1e3);
+	fprintf(file, "Number of Samples is %i\n", hop->buf_len);
 	fprintf(file, "RMS Voltage with DC is %.2f dBFS\n", rms_pow_val);
 	fprintf(file, "RMS Voltage without DC is %.2f dBFS\n", rms_pow_dc_val);
 	
 	fflush(file);
 
-	free(buf8);
-		
-	close_dev();
+	if (timing) {
+		session_timing_report(session, 0);}
+
+	session_free(session);
 
 	return r >= 0 ? r : -r;
 }
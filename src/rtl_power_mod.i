@@ -18,6 +18,46 @@
 	extern void set_value(int index, char param, double value);
 
 	extern uint32_t get_value(char param);
+
+	extern double plan_hops(int count);
+
+	extern int get_hop(int n);
+
+	struct sweep_session;
+
+	extern struct sweep_session *session_new(void);
+
+	extern void session_free(struct sweep_session *s);
+
+	extern int session_open(struct sweep_session *s, int dev_index);
+
+	extern void session_close(struct sweep_session *s);
+
+	extern int session_add_tune(struct sweep_session *s);
+
+	extern void session_set_value(struct sweep_session *s, int index, char param, double value);
+
+	extern uint32_t session_get_value(struct sweep_session *s, char param);
+
+	extern void session_set_tuner(struct sweep_session *s, int index);
+
+	extern void session_read_data(struct sweep_session *s, int index, uint8_t *buf8);
+
+	extern void session_rms_power(struct sweep_session *s, int index, uint8_t *buf, double *rms_pow_val, double *rms_pow_dc_val);
+
+	extern void session_iq_stats(struct sweep_session *s, int index, uint8_t *buf, double *dc_i, double *dc_q, double *rms, double *mean_mag, double *peak);
+
+	extern double session_plan_hops(struct sweep_session *s);
+
+	extern int session_get_hop(struct sweep_session *s, int n);
+
+	extern int session_timing_start(struct sweep_session *s);
+
+	extern void session_timing_report(struct sweep_session *s, int json);
+
+	extern int timing_start(void);
+
+	extern void timing_report(int json);
  %}
  %include "stdint.i"
  %include "cpointer.i"
@@ -42,3 +82,46 @@ extern void set_value(int index, char param, double value);
 
 extern uint32_t get_value(char param);
 
+/* hop order, sweep get_hop(0) to get_hop(count - 1) after plan_hops() */
+
+extern double plan_hops(int count);
+
+extern int get_hop(int n);
+
+/* sessions are independent, one per dongle */
+
+extern struct sweep_session *session_new(void);
+
+extern void session_free(struct sweep_session *s);
+
+extern int session_open(struct sweep_session *s, int dev_index);
+
+extern void session_close(struct sweep_session *s);
+
+extern int session_add_tune(struct sweep_session *s);
+
+extern void session_set_value(struct sweep_session *s, int index, char param, double value);
+
+extern uint32_t session_get_value(struct sweep_session *s, char param);
+
+extern void session_set_tuner(struct sweep_session *s, int index);
+
+extern void session_read_data(struct sweep_session *s, int index, uint8_t *buf8);
+
+extern void session_rms_power(struct sweep_session *s, int index, uint8_t *buf, double *rms_pow_val, double *rms_pow_dc_val);
+
+extern void session_iq_stats(struct sweep_session *s, int index, uint8_t *buf, double *dc_i, double *dc_q, double *rms, double *mean_mag, double *peak);
+
+extern double session_plan_hops(struct sweep_session *s);
+
+extern int session_get_hop(struct sweep_session *s, int n);
+
+/* stage timing, a table on stderr or with json a line on stdout */
+
+extern int session_timing_start(struct sweep_session *s);
+
+extern void session_timing_report(struct sweep_session *s, int json);
+
+extern int timing_start(void);
+
+extern void timing_report(int json);
@@ -118,6 +118,8 @@ int main(int argc, char **argv)
 	int direct_sampling = 0;
 	FILE *file;
 	uint8_t *buffer;
+	unsigned char *stream_buf;
+	uint32_t stream_len;
 	int dev_index = 0;
 	int dev_given = 0;
 	uint32_t frequency = 100000000;
@@ -270,8 +272,20 @@ int main(int argc, char **argv)
 		}
 	} else {
 		fprintf(stderr, "Reading samples in async mode...\n");
-		r = rtlsdr_read_async(dev, rtlsdr_callback, (void *)file,
-				      DEFAULT_ASYNC_BUF_NUMBER, out_block_size);
+		/* write on this thread, a slow disk must not stall USB */
+		r = rtlsdr_stream_start(dev, DEFAULT_ASYNC_BUF_NUMBER,
+					out_block_size);
+		if (r >= 0) {
+			while (!do_exit && rtlsdr_stream_acquire(dev,
+					&stream_buf, &stream_len, -1) >= 0) {
+				rtlsdr_callback(stream_buf, stream_len, (void *)file);
+				rtlsdr_stream_release(dev);
+			}
+			r = rtlsdr_stream_stop(dev);
+			if (rtlsdr_stream_get_overruns(dev))
+				fprintf(stderr, "Dropped %u buffers, samples lost!\n",
+					rtlsdr_stream_get_overruns(dev));
+		}
 	}
 
 	if (do_exit)
@@ -0,0 +1,127 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* iq_stats_measure() against iq_stats_reference() on tone plus noise */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "convenience/iq_stats.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* relative, with a floor of one step for values near zero */
+#define TOLERANCE	1e-7
+
+static uint32_t lcg = 1;
+
+static double noise(void)
+/* roughly gaussian, unit variance */
+{
+	int k;
+	double sum = 0.0;
+	for (k=0; k<12; k++) {
+		lcg = lcg * 1664525u + 1013904223u;
+		sum += (double)(lcg >> 8) / (double)(1 << 24);
+	}
+	return sum - 6.0;
+}
+
+static uint8_t clip(double x)
+{
+	if (x < 0.0) {
+		return 0;}
+	if (x > 255.0) {
+		return 255;}
+	return (uint8_t)lrint(x);
+}
+
+static void synthesize(uint8_t *buf, int len, double amp, double dc_i,
+		       double dc_q, double sigma)
+{
+	int k;
+	double phase;
+	for (k=0; k<len/2; k++) {
+		phase = 2.0 * M_PI * 0.0123 * k;
+		buf[2*k]   = clip(127.5 + dc_i + amp * cos(phase) + sigma * noise());
+		buf[2*k+1] = clip(127.5 + dc_q + amp * sin(phase) + sigma * noise());
+	}
+	if (len & 1) {
+		buf[len-1] = 0xff;}
+}
+
+static int differs(const char *name, double got, double want)
+{
+	double err = fabs(got - want) / (fabs(want) + 1.0);
+	if (err <= TOLERANCE) {
+		return 0;}
+	fprintf(stderr, "  %s: %.9g, expected %.9g\n", name, got, want);
+	return 1;
+}
+
+static int check(uint8_t *buf, int len, double amp, double dc_i,
+		 double dc_q, double sigma)
+{
+	int bad = 0;
+	struct iq_stats got, want;
+	synthesize(buf, len, amp, dc_i, dc_q, sigma);
+	iq_stats_measure(buf, len, &got);
+	iq_stats_reference(buf, len, &want);
+	if (got.samples != want.samples) {
+		fprintf(stderr, "  samples: %i, expected %i\n",
+			got.samples, want.samples);
+		bad = 1;
+	}
+	bad |= differs("dc_i", got.dc_i, want.dc_i);
+	bad |= differs("dc_q", got.dc_q, want.dc_q);
+	bad |= differs("rms", got.rms, want.rms);
+	bad |= differs("mean_mag", got.mean_mag, want.mean_mag);
+	bad |= differs("peak", got.peak, want.peak);
+	bad |= differs("mean_mag about 0", iq_stats_mean_mag(buf, len, 0.0, 0.0), want.mean_mag);
+	if (bad) {
+		fprintf(stderr, "failed: %i bytes, amplitude %g, dc %g/%g, "
+			"noise %g\n", len, amp, dc_i, dc_q, sigma);}
+	return bad;
+}
+
+int main(void)
+{
+	static const int lengths[] = {0, 1, 2, 3, 15, 16, 17, 2*4096,
+		2*4096 + 1, 2*4097, 2*12345 + 1, 2*((1 << 20) + 3)};
+	static const double amps[] = {0.0, 1.0, 10.0, 50.0, 100.0, 200.0};
+	static const double dcs[][2] = {{0.0, 0.0}, {4.0, -3.0}, {-20.5, 35.0}};
+	int l, a, d, failures = 0, runs = 0;
+	int max_len = lengths[sizeof(lengths)/sizeof(lengths[0]) - 1];
+	uint8_t *buf = malloc(max_len);
+	if (!buf) {
+		return 1;}
+	for (l=0; l<(int)(sizeof(lengths)/sizeof(lengths[0])); l++) {
+	for (a=0; a<(int)(sizeof(amps)/sizeof(amps[0])); a++) {
+	for (d=0; d<(int)(sizeof(dcs)/sizeof(dcs[0])); d++) {
+		failures += check(buf, lengths[l], amps[a], dcs[d][0], dcs[d][1], 3.0);
+		runs++;
+	}}}
+	/* a full scale tone, no noise, and a buffer at the rails */
+	failures += check(buf, max_len, 127.5, 0.0, 0.0, 0.0);
+	failures += check(buf, max_len, 0.0, 127.5, -127.5, 0.0);
+	runs += 2;
+	free(buf);
+	fprintf(stderr, "%i of %i cases failed\n", failures, runs);
+	return failures ? 1 : 0;
+}
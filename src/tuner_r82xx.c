@@ -249,14 +249,11 @@ static void shadow_store(struct r82xx_priv *priv, uint8_t reg, const uint8_t *va
 	memcpy(&priv->regs[r], val, len);
 }
 
-static int r82xx_write(struct r82xx_priv *priv, uint8_t reg, const uint8_t *val,
-		       unsigned int len)
+static int r82xx_write_i2c(struct r82xx_priv *priv, uint8_t reg,
+			   const uint8_t *val, unsigned int len)
 {
 	int rc, size, pos = 0;
 
-	/* Store the shadow registers */
-	shadow_store(priv, reg, val, len);
-
 	do {
 		if (len > priv->cfg->max_i2c_msg_len - 1)
 			size = priv->cfg->max_i2c_msg_len - 1;
@@ -286,6 +283,77 @@ static int r82xx_write(struct r82xx_priv *priv, uint8_t reg, const uint8_t *val,
 	return 0;
 }
 
+/* write out dirty shadow registers, adjacent ones in a single burst */
+static int r82xx_flush(struct r82xx_priv *priv)
+{
+	int rc, start, r = 0;
+	unsigned int max = priv->cfg->max_i2c_msg_len - 1;
+
+	while (priv->dirty) {
+		while (!(priv->dirty & (1U << r)))
+			r++;
+
+		start = r;
+		while (r < NUM_REGS && (priv->dirty & (1U << r)) &&
+		       (unsigned int)(r - start) < max)
+			r++;
+
+		rc = r82xx_write_i2c(priv, start + REG_SHADOW_START,
+				     &priv->regs[start], r - start);
+		if (rc < 0)
+			return rc;
+
+		priv->dirty &= ~(((1U << (r - start)) - 1) << start);
+	}
+
+	return 0;
+}
+
+static int r82xx_write(struct r82xx_priv *priv, uint8_t reg, const uint8_t *val,
+		       unsigned int len)
+{
+	int i, r = reg - REG_SHADOW_START;
+	uint32_t changed = 0;
+
+	/* until the chip has been initialized, the shadow means nothing */
+	if (!priv->regs_known || r < 0 || r + len > NUM_REGS) {
+		shadow_store(priv, reg, val, len);
+		return r82xx_write_i2c(priv, reg, val, len);
+	}
+
+	for (i = 0; i < (int)len; i++) {
+		if (priv->regs[r + i] != val[i])
+			changed |= 1U << (r + i);
+	}
+
+	/* Store the shadow registers */
+	shadow_store(priv, reg, val, len);
+
+	priv->dirty |= changed;
+
+	if (priv->batch)
+		return 0;
+
+	return r82xx_flush(priv);
+}
+
+/*
+ * Defer register writes until the matching r82xx_batch_end(), so
+ * a high-level operation costs one I2C transfer per register run.
+ */
+static void r82xx_batch_begin(struct r82xx_priv *priv)
+{
+	priv->batch++;
+}
+
+static int r82xx_batch_end(struct r82xx_priv *priv)
+{
+	if (--priv->batch)
+		return 0;
+
+	return r82xx_flush(priv);
+}
+
 static int r82xx_write_reg(struct r82xx_priv *priv, uint8_t reg, uint8_t val)
 {
 	return r82xx_write(priv, reg, &val, 1);
@@ -327,6 +395,11 @@ static int r82xx_read(struct r82xx_priv *priv, uint8_t reg, uint8_t *val, int le
 	int rc, i;
 	uint8_t *p = &priv->buf[1];
 
+	/* status may depend on pending writes */
+	rc = r82xx_flush(priv);
+	if (rc < 0)
+		return rc;
+
 	priv->buf[0] = reg;
 
 	rc = rtlsdr_i2c_write_fn(priv->rtl_dev, priv->cfg->i2c_addr, priv->buf, 1);
@@ -354,12 +427,9 @@ static int r82xx_read(struct r82xx_priv *priv, uint8_t reg, uint8_t *val, int le
  * r82xx tuning logic
  */
 
-static int r82xx_set_mux(struct r82xx_priv *priv, uint32_t freq)
+static unsigned int r82xx_mux_index(uint32_t freq)
 {
-	const struct r82xx_freq_range *range;
-	int rc;
 	unsigned int i;
-	uint8_t val;
 
 	/* Get the proper frequency range */
 	freq = freq / 1000000;
@@ -367,7 +437,20 @@ static int r82xx_set_mux(struct r82xx_priv *priv, uint32_t freq)
 		if (freq < freq_ranges[i + 1].freq)
 			break;
 	}
-	range = &freq_ranges[i];
+	return i;
+}
+
+static int r82xx_set_mux(struct r82xx_priv *priv, uint32_t freq)
+{
+	const struct r82xx_freq_range *range;
+	int rc;
+	uint8_t val;
+
+	range = &freq_ranges[r82xx_mux_index(freq)];
+
+	/* a sweep mostly stays within one range */
+	if (range == priv->mux_range)
+		return 0;
 
 	/* Open Drain */
 	rc = r82xx_write_reg_mask(priv, 0x17, range->open_d, 0x08);
@@ -410,14 +493,28 @@ static int r82xx_set_mux(struct r82xx_priv *priv, uint32_t freq)
 		return rc;
 
 	rc = r82xx_write_reg_mask(priv, 0x09, 0x00, 0x3f);
+	if (rc < 0)
+		return rc;
+
+	priv->mux_range = range;
 
 	return rc;
 }
 
-static int r82xx_set_pll(struct r82xx_priv *priv, uint32_t freq)
+static struct r82xx_pll_entry *r82xx_pll_slot(struct r82xx_priv *priv,
+					      uint32_t freq)
 {
-	int rc, i;
-	unsigned sleep_time = 10000;
+	/* fibonacci hashing spreads evenly spaced hops over the table */
+	uint32_t key = freq + priv->cfg->xtal;
+
+	return &priv->pll_cache[(uint32_t)(key * 2654435769U) >>
+				(32 - PLL_CACHE_BITS)];
+}
+
+static int r82xx_calc_pll(struct r82xx_priv *priv, uint32_t freq,
+			  struct r82xx_pll_entry *pll)
+{
+	int rc;
 	uint64_t vco_freq;
 	uint32_t vco_fra;	/* VCO contribution by SDM (kHz) */
 	uint32_t vco_min = 1770000;
@@ -429,8 +526,7 @@ static int r82xx_set_pll(struct r82xx_priv *priv, uint32_t freq)
 	uint8_t div_buf = 0;
 	uint8_t div_num = 0;
 	uint8_t vco_power_ref = 2;
-	uint8_t refdiv2 = 0;
-	uint8_t ni, si, nint, vco_fine_tune, val;
+	uint8_t ni, si, nint, vco_fine_tune;
 	uint8_t data[5];
 
 	/* Frequency in kHz */
@@ -438,20 +534,6 @@ static int r82xx_set_pll(struct r82xx_priv *priv, uint32_t freq)
 	pll_ref = priv->cfg->xtal;
 	pll_ref_khz = (priv->cfg->xtal + 500) / 1000;
 
-	rc = r82xx_write_reg_mask(priv, 0x10, refdiv2, 0x10);
-	if (rc < 0)
-		return rc;
-
-	/* set pll autotune = 128kHz */
-	rc = r82xx_write_reg_mask(priv, 0x1a, 0x00, 0x0c);
-	if (rc < 0)
-		return rc;
-
-	/* set VCO current = 100 */
-	rc = r82xx_write_reg_mask(priv, 0x12, 0x80, 0xe0);
-	if (rc < 0)
-		return rc;
-
 	/* Calculate divider */
 	while (mix_div <= 64) {
 		if (((freq_khz * mix_div) >= vco_min) &&
@@ -480,10 +562,6 @@ static int r82xx_set_pll(struct r82xx_priv *priv, uint32_t freq)
 	else if (vco_fine_tune < vco_power_ref)
 		div_num = div_num + 1;
 
-	rc = r82xx_write_reg_mask(priv, 0x10, div_num << 5, 0xe0);
-	if (rc < 0)
-		return rc;
-
 	vco_freq = (uint64_t)freq * (uint64_t)mix_div;
 	nint = vco_freq / (2 * pll_ref);
 	vco_fra = (vco_freq - 2 * pll_ref * nint) / 1000;
@@ -496,19 +574,11 @@ static int r82xx_set_pll(struct r82xx_priv *priv, uint32_t freq)
 	ni = (nint - 13) / 4;
 	si = nint - 4 * ni - 13;
 
-	rc = r82xx_write_reg(priv, 0x14, ni + (si << 6));
-	if (rc < 0)
-		return rc;
-
 	/* pw_sdm */
 	if (!vco_fra)
-		val = 0x08;
+		pll->pw_sdm = 0x08;
 	else
-		val = 0x00;
-
-	rc = r82xx_write_reg_mask(priv, 0x12, val, 0x08);
-	if (rc < 0)
-		return rc;
+		pll->pw_sdm = 0x00;
 
 	/* sdm calculator */
 	while (vco_fra > 1) {
@@ -521,10 +591,73 @@ static int r82xx_set_pll(struct r82xx_priv *priv, uint32_t freq)
 		n_sdm <<= 1;
 	}
 
-	rc = r82xx_write_reg(priv, 0x16, sdm >> 8);
+	pll->freq = freq;
+	pll->xtal = priv->cfg->xtal;
+	pll->div_num = div_num;
+	pll->ni_si = ni + (si << 6);
+	pll->sdm = sdm;
+
+	return 0;
+}
+
+static int r82xx_set_pll(struct r82xx_priv *priv, uint32_t freq)
+{
+	int rc, i;
+	unsigned sleep_time = 10000;
+	uint8_t refdiv2 = 0;
+	uint8_t data[5];
+	struct r82xx_pll_entry *pll;
+	int cached;
+
+	rc = r82xx_write_reg_mask(priv, 0x10, refdiv2, 0x10);
+	if (rc < 0)
+		return rc;
+
+	/* set pll autotune = 128kHz */
+	rc = r82xx_write_reg_mask(priv, 0x1a, 0x00, 0x0c);
+	if (rc < 0)
+		return rc;
+
+	/* set VCO current = 100 */
+	rc = r82xx_write_reg_mask(priv, 0x12, 0x80, 0xe0);
+	if (rc < 0)
+		return rc;
+
+	/* fast autotune has to be active before the dividers change */
+	rc = r82xx_flush(priv);
+	if (rc < 0)
+		return rc;
+
+	pll = r82xx_pll_slot(priv, freq);
+	cached = pll->valid && pll->freq == freq &&
+		 pll->xtal == priv->cfg->xtal;
+
+	if (cached) {
+		priv->pll_cache_hits++;
+	} else {
+		priv->pll_cache_misses++;
+		pll->valid = 0;
+		rc = r82xx_calc_pll(priv, freq, pll);
+		if (rc < 0)
+			return rc;
+	}
+
+	rc = r82xx_write_reg_mask(priv, 0x10, pll->div_num << 5, 0xe0);
 	if (rc < 0)
 		return rc;
-	rc = r82xx_write_reg(priv, 0x15, sdm & 0xff);
+
+	rc = r82xx_write_reg(priv, 0x14, pll->ni_si);
+	if (rc < 0)
+		return rc;
+
+	rc = r82xx_write_reg_mask(priv, 0x12, pll->pw_sdm, 0x08);
+	if (rc < 0)
+		return rc;
+
+	rc = r82xx_write_reg(priv, 0x16, pll->sdm >> 8);
+	if (rc < 0)
+		return rc;
+	rc = r82xx_write_reg(priv, 0x15, pll->sdm & 0xff);
 	if (rc < 0)
 		return rc;
 
@@ -547,12 +680,19 @@ static int r82xx_set_pll(struct r82xx_priv *priv, uint32_t freq)
 	}
 
 	if (!(data[2] & 0x40)) {
+		/* the VCO may have drifted since, recompute once */
+		if (cached) {
+			pll->valid = 0;
+			return r82xx_set_pll(priv, freq);
+		}
+
 		printf("[R82XX] PLL not locked!\n");
 		priv->has_lock = 0;
 		return 0;
 	}
 
 	priv->has_lock = 1;
+	pll->valid = 1;
 
 	/* set pll autotune = 8kHz */
 	rc = r82xx_write_reg_mask(priv, 0x1a, 0x08, 0x08);
@@ -770,6 +910,9 @@ static int r82xx_set_tv_standard(struct r82xx_priv *priv,
 	uint8_t lt_att, flt_ext_widest, polyfil_cur;
 	int need_calibration;
 
+	/* filter calibration below changes the xtal cap bits */
+	priv->mux_range = NULL;
+
 	if (delsys == SYS_ISDBT) {
 		if_khz = 4063;
 		filt_cal_lo = 59000;
@@ -1017,7 +1160,8 @@ static const int r82xx_mixer_gain_steps[]  = {
 	0, 5, 10, 10, 19, 9, 10, 25, 17, 10, 8, 16, 13, 6, 3, -8
 };
 
-int r82xx_set_gain(struct r82xx_priv *priv, int set_manual_gain, int gain)
+static int r82xx_apply_gain(struct r82xx_priv *priv, int set_manual_gain,
+			    int gain)
 {
 	int rc;
 
@@ -1086,12 +1230,28 @@ int r82xx_set_gain(struct r82xx_priv *priv, int set_manual_gain, int gain)
 	return 0;
 }
 
+int r82xx_set_gain(struct r82xx_priv *priv, int set_manual_gain, int gain)
+{
+	int rc;
+
+	r82xx_batch_begin(priv);
+	rc = r82xx_apply_gain(priv, set_manual_gain, gain);
+	if (rc < 0) {
+		r82xx_batch_end(priv);
+		return rc;
+	}
+
+	return r82xx_batch_end(priv);
+}
+
 int r82xx_set_freq(struct r82xx_priv *priv, uint32_t freq)
 {
 	int rc = -1;
 	uint32_t lo_freq = freq + priv->int_freq;
 	uint8_t air_cable1_in;
 
+	r82xx_batch_begin(priv);
+
 	rc = r82xx_set_mux(priv, lo_freq);
 	if (rc < 0)
 		goto err;
@@ -1113,6 +1273,11 @@ int r82xx_set_freq(struct r82xx_priv *priv, uint32_t freq)
 	}
 
 err:
+	if (rc < 0)
+		r82xx_batch_end(priv);
+	else
+		rc = r82xx_batch_end(priv);
+
 	if (rc < 0)
 		fprintf(stderr, "%s: failed=%d\n", __FUNCTION__, rc);
 	return rc;
@@ -1144,6 +1309,26 @@ err:
 
 
 
+int r82xx_get_band(struct r82xx_priv *priv, uint32_t freq)
+{
+	int band = (int)r82xx_mux_index(freq + priv->int_freq);
+
+	/* r82xx_set_freq() also switches the R828D input there */
+	if (priv->cfg->rafael_chip == CHIP_R828D && freq <= MHZ(345))
+		band += ARRAY_SIZE(freq_ranges);
+
+	return band;
+}
+
+void r82xx_get_pll_cache_stats(struct r82xx_priv *priv, uint32_t *hits,
+			       uint32_t *misses)
+{
+	if (hits)
+		*hits = priv->pll_cache_hits;
+	if (misses)
+		*misses = priv->pll_cache_misses;
+}
+
 /*
  * r82xx standby logic
  */
@@ -1156,6 +1341,8 @@ int r82xx_standby(struct r82xx_priv *priv)
 	if (!priv->init_done)
 		return 0;
 
+	priv->mux_range = NULL;
+
 	rc = r82xx_write_reg(priv, 0x06, 0xb1);
 	if (rc < 0)
 		return rc;
@@ -1263,10 +1450,15 @@ int r82xx_init(struct r82xx_priv *priv)
 
 	/* TODO: R828D might need r82xx_xtal_check() */
 	priv->xtal_cap_sel = XTAL_HIGH_CAP_0P;
+	priv->mux_range = NULL;
+	priv->regs_known = 0;
+	priv->dirty = 0;
 
 	/* Initialize registers */
 	rc = r82xx_write(priv, 0x05,
 			 r82xx_init_array, sizeof(r82xx_init_array));
+	if (rc >= 0)
+		priv->regs_known = 1;
 
 	rc = r82xx_set_tv_standard(priv, 3, TUNER_DIGITAL_TV, 0);
 	if (rc < 0)